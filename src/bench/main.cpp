@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <bench.h>
+#include <common.h>
+
+// image.h pulls in stb_image
+#define STB_IMAGE_IMPLEMENTATION
+#include <blur.h>
+#include <convolve.h>
+#include <encode.h>
+#include <graph.h>
+#include <histogram.h>
+#include <image.h>
+#include <integral.h>
+#include <morphology.h>
+#include <palette.h>
+#include <rank.h>
+#include <resample.h>
+
+// bundled assets, paths relative to DATA_DIR like the demos use them.
+const char* ASSETS[] = { "/color-face.jpg", "/face.png", "/wall.jpg" };
+
+// square synthetic inputs, 256^2 up to 8k^2.
+const int MIN_SIZE = 256;
+const int MAX_SIZE = 8192;
+
+// deterministic colors that never sum to zero, toHSI divides by the sum.
+Image syntheticImage(int size, int channels)
+{
+	Image image = {};
+	image.width = size;
+	image.height = size;
+	image.channels = channels;
+	image.rgb = true;
+	image.data = (float*)malloc(sizeof(float) * size * size * channels);
+
+	u32 state = 0x12345678u;
+	for (int i = 0; i < size * size; i++) {
+		for (int c = 0; c < channels; c++) {
+			state = state * 1664525u + 1013904223u;
+			image.data[i * channels + c] = 0.05f + 0.95f * (float)(state >> 8) / (float)(1 << 24);
+		}
+	}
+
+	return image;
+}
+
+// 8 bit binary ppm in memory, stb decodes it without touching the disk.
+std::vector<u8> syntheticPPM(const Image& image)
+{
+	char header[64];
+	int headerSize = snprintf(header, sizeof(header), "P6\n%i %i\n255\n", image.width, image.height);
+
+	std::vector<u8> encoded(header, header + headerSize);
+	encoded.reserve(headerSize + (size_t)image.width * image.height * 3);
+	for (int i = 0; i < image.width * image.height; i++) {
+		for (int c = 0; c < 3; c++) {
+			encoded.push_back((u8)(image.data[i * image.channels + c] * 255.0f + 0.5f));
+		}
+	}
+
+	return encoded;
+}
+
+long fileSize(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return 0;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	return size;
+}
+
+void benchAssets(const BenchSettings& settings, std::vector<BenchResult>& results)
+{
+	for (const char* asset : ASSETS) {
+		char path[512];
+		snprintf(path, sizeof(path), "%s%s", DATA_DIR, asset);
+		const char* input = asset + 1;
+
+		int width, height, channels;
+		if (!stbi_info(path, &width, &height, &channels)) {
+			printf("Failed to read %s\n", path);
+			continue;
+		}
+		double encodedBytes = (double)fileSize(path);
+		double pixels = (double)width * height;
+
+		if (benchSelected(settings, "loadImage", input)) {
+			results.push_back(runBench(settings, "loadImage", input, width, height, encodedBytes + pixels * 4 * sizeof(float), [&]() {
+				Image image = loadImage(asset, 4);
+				stbi_image_free(image.data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "stbi_load", input)) {
+			results.push_back(runBench(settings, "stbi_load", input, width, height, encodedBytes + pixels * 4, [&]() {
+				int x, y, n;
+				stbi_image_free(stbi_load(path, &x, &y, &n, 4));
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "stbi_loadf", input)) {
+			results.push_back(runBench(settings, "stbi_loadf", input, width, height, encodedBytes + pixels * 4 * sizeof(float), [&]() {
+				int x, y, n;
+				stbi_image_free(stbi_loadf(path, &x, &y, &n, 4));
+			}));
+			printBenchResult(results.back());
+		}
+
+		// encoders on real content, noise would not compress
+		int x, y, n;
+		u8* rgb8 = stbi_load(path, &x, &y, &n, 3);
+		if (benchSelected(settings, "encodePNG", input)) {
+			results.push_back(runBench(settings, "encodePNG", input, width, height, pixels * 3, [&]() {
+				encodePNG(rgb8, width, height, 3, &threadPool());
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "encodePNG serial", input)) {
+			results.push_back(runBench(settings, "encodePNG serial", input, width, height, pixels * 3, [&]() {
+				encodePNG(rgb8, width, height, 3);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "encodeQOI", input)) {
+			results.push_back(runBench(settings, "encodeQOI", input, width, height, pixels * 3, [&]() {
+				encodeQOI(rgb8, width, height, 3);
+			}));
+			printBenchResult(results.back());
+		}
+		stbi_image_free(rgb8);
+	}
+}
+
+void benchSynthetic(const BenchSettings& settings, int maxSize, int channels, std::vector<BenchResult>& results)
+{
+	for (int size = MIN_SIZE; size <= maxSize; size *= 2) {
+		char input[32];
+		snprintf(input, sizeof(input), "%ix%i", size, size);
+		double pixels = (double)size * size;
+		double imageBytes = pixels * channels * sizeof(float);
+
+		Image rgb = syntheticImage(size, channels);
+
+		if (benchSelected(settings, "toHSI", input)) {
+			results.push_back(runBench(settings, "toHSI", input, size, size, imageBytes * 2, [&]() {
+				free(toHSI(rgb).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "toRGB", input)) {
+			Image hsi = toHSI(rgb);
+			results.push_back(runBench(settings, "toRGB", input, size, size, imageBytes * 2, [&]() {
+				free(toRGB(hsi).data);
+			}));
+			printBenchResult(results.back());
+			free(hsi.data);
+		}
+
+		// toHSI, scale intensity, toRGB. materialized is three sweeps and two
+		// intermediate images, the graph fuses them into one pass.
+		if (benchSelected(settings, "hsi chain materialized", input)) {
+			results.push_back(runBench(settings, "hsi chain materialized", input, size, size, imageBytes * 2, [&]() {
+				Image hsi = toHSI(rgb);
+				for (int i = 0; i < size * size; i++) {
+					hsi.data[i * channels + 2] *= 1.2f;
+				}
+				free(toRGB(hsi).data);
+				free(hsi.data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "hsi chain fused", input)) {
+			ImageGraph graph;
+			graph.toHSI();
+			graph.point("intensity", [](float* p, int count, int stride, const float* params) {
+				for (int i = 0; i < count; i++) {
+					p[i * stride + 2] *= params[0];
+				}
+			}, 1.2f);
+			graph.toRGB();
+			Image copy = rgb;
+			copy.data = (float*)malloc((size_t)imageBytes);
+			results.push_back(runBench(settings, "hsi chain fused", input, size, size, imageBytes * 2, [&]() {
+				memcpy(copy.data, rgb.data, (size_t)imageBytes);
+				graph.evaluate(copy);
+			}));
+			printBenchResult(results.back());
+			free(copy.data);
+		}
+
+		// the same chain baked into a 33^3 lut, baking is not timed
+		if (benchSelected(settings, "hsi chain lut 33", input)) {
+			ImageGraph graph;
+			graph.toHSI();
+			graph.point("intensity", [](float* p, int count, int stride, const float* params) {
+				for (int i = 0; i < count; i++) {
+					p[i * stride + 2] *= params[0];
+				}
+			}, 1.2f);
+			graph.toRGB();
+			graph.bakePoints(COLOR_LUT_SIZE);
+			Image copy = rgb;
+			copy.data = (float*)malloc((size_t)imageBytes);
+			results.push_back(runBench(settings, "hsi chain lut 33", input, size, size, imageBytes * 2, [&]() {
+				memcpy(copy.data, rgb.data, (size_t)imageBytes);
+				graph.evaluate(copy);
+			}));
+			printBenchResult(results.back());
+			free(copy.data);
+		}
+
+		// not timed: baked luts against the chain they come from. hsiToRgb
+		// cuts to black and grey below 0.05, the luts smear those edges
+		if (benchSelected(settings, "lut accuracy", input)) {
+			ImageGraph direct;
+			direct.toHSI();
+			direct.point("intensity", [](float* p, int count, int stride, const float* params) {
+				for (int i = 0; i < count; i++) {
+					p[i * stride + 2] *= params[0];
+				}
+			}, 0.9f);
+			direct.point("saturation", [](float* p, int count, int stride, const float* params) {
+				for (int i = 0; i < count; i++) {
+					p[i * stride + 1] = fminf(p[i * stride + 1] * params[0], 1.0f);
+				}
+			}, 1.1f);
+			direct.toRGB();
+			Image exact = rgb;
+			exact.data = (float*)malloc((size_t)imageBytes);
+			memcpy(exact.data, rgb.data, (size_t)imageBytes);
+			direct.evaluate(exact, &threadPool());
+
+			Image approximate = rgb;
+			approximate.data = (float*)malloc((size_t)imageBytes);
+			const int lutSizes[] = { 17, 33, 65 };
+			for (int lutSize : lutSizes) {
+				ImageGraph baked = direct;
+				baked.bakePoints(lutSize, &threadPool());
+				memcpy(approximate.data, rgb.data, (size_t)imageBytes);
+				baked.evaluate(approximate, &threadPool());
+
+				float maxError = 0.0f;
+				size_t off = 0;
+				for (size_t i = 0; i < (size_t)size * size; i++) {
+					for (int c = 0; c < 3; c++) {
+						float error = fabsf(approximate.data[i * channels + c] - exact.data[i * channels + c]);
+						maxError = error > maxError ? error : maxError;
+						off += error > 1.0f / 255.0f;
+					}
+				}
+				char name[32];
+				snprintf(name, sizeof(name), "lut accuracy %i", lutSize);
+				printf("%-22s %-16s max error %.4f, %.2f%% of values off by more than 1/255\n", name, input, maxError, 100.0 * off / (3.0 * size * size));
+			}
+			free(approximate.data);
+			free(exact.data);
+		}
+
+		// sigma 2, 13 taps each way
+		if (benchSelected(settings, "gaussian sep", input)) {
+			Kernel1D kernel = gaussianKernel(2.0f);
+			results.push_back(runBench(settings, "gaussian sep", input, size, size, imageBytes * 2, [&]() {
+				free(convolveSeparable(rgb, kernel, kernel, BORDER_MIRROR, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "gaussian sep serial", input)) {
+			Kernel1D kernel = gaussianKernel(2.0f);
+			results.push_back(runBench(settings, "gaussian sep serial", input, size, size, imageBytes * 2, [&]() {
+				free(convolveSeparable(rgb, kernel, kernel, BORDER_MIRROR).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		// 5x5, the separable pair does 10 taps for the same result
+		if (benchSelected(settings, "gaussian 5x5 2d serial", input)) {
+			Kernel1D kernel = gaussianKernel(0.6f);
+			Kernel2D kernel2D = outerKernel(kernel, kernel);
+			results.push_back(runBench(settings, "gaussian 5x5 2d serial", input, size, size, imageBytes * 2, [&]() {
+				free(convolve2D(rgb, kernel2D, BORDER_MIRROR).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		// sigma 8, where the 49 tap kernel has to compete with the constant
+		// time blurs
+		if (benchSelected(settings, "gaussian s8 sep", input)) {
+			Kernel1D kernel = gaussianKernel(8.0f);
+			results.push_back(runBench(settings, "gaussian s8 sep", input, size, size, imageBytes * 2, [&]() {
+				free(convolveSeparable(rgb, kernel, kernel, BORDER_CLAMP, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "gaussian s8 boxes", input)) {
+			results.push_back(runBench(settings, "gaussian s8 boxes", input, size, size, imageBytes * 6, [&]() {
+				free(gaussianBlurBoxes(rgb, 8.0f, BORDER_CLAMP, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "gaussian s8 recursive", input)) {
+			results.push_back(runBench(settings, "gaussian s8 recursive", input, size, size, imageBytes * 2, [&]() {
+				free(gaussianBlurRecursive(rgb, 8.0f, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "box r16 running", input)) {
+			results.push_back(runBench(settings, "box r16 running", input, size, size, imageBytes * 2, [&]() {
+				free(boxBlurRunning(rgb, 16, BORDER_CLAMP, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		// the sorting network, then the histograms at two sizes that should
+		// cost about the same
+		if (benchSelected(settings, "median 3x3", input)) {
+			results.push_back(runBench(settings, "median 3x3", input, size, size, imageBytes * 2, [&]() {
+				free(medianFilter(rgb, 1, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "median 5x5", input)) {
+			results.push_back(runBench(settings, "median 5x5", input, size, size, imageBytes * 2, [&]() {
+				free(medianFilter(rgb, 2, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "median 15x15", input)) {
+			results.push_back(runBench(settings, "median 15x15", input, size, size, imageBytes * 2, [&]() {
+				free(medianFilter(rgb, 7, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		// van herk / gil - werman, both radii should cost the same
+		if (benchSelected(settings, "dilate r1", input)) {
+			results.push_back(runBench(settings, "dilate r1", input, size, size, imageBytes * 2, [&]() {
+				free(morphology(rgb, MORPH_DILATE, 1, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "dilate r15", input)) {
+			results.push_back(runBench(settings, "dilate r15", input, size, size, imageBytes * 2, [&]() {
+				free(morphology(rgb, MORPH_DILATE, 15, &threadPool()).data);
+			}));
+			printBenchResult(results.back());
+		}
+
+		// a 256 color palette once, then mapping with every dither
+		if (benchSelected(settings, "palette 256", input)) {
+			results.push_back(runBench(settings, "palette 256", input, size, size, imageBytes, [&]() {
+				buildPalette(rgb, 256, 8, &threadPool());
+			}));
+			printBenchResult(results.back());
+		}
+
+		const char* ditherNames[] = { "map palette", "map palette ordered", "map palette fs" };
+		Palette palette = {};
+		for (int dither = PALETTE_DITHER_NONE; dither <= PALETTE_DITHER_FLOYD_STEINBERG; dither++) {
+			if (benchSelected(settings, ditherNames[dither], input)) {
+				if (!palette.count) {
+					palette = buildPalette(rgb, 256, 8, &threadPool());
+				}
+				results.push_back(runBench(settings, ditherNames[dither], input, size, size, imageBytes + pixels, [&]() {
+					mapToPalette(rgb, palette, (PaletteDither)dither, &threadPool());
+				}));
+				printBenchResult(results.back());
+			}
+		}
+
+		// halving, the size pre-scaling before upload is about
+		const char* resizeNames[] = { "resize box 1/2", "resize bilinear 1/2", "resize bicubic 1/2", "resize lanczos3 1/2" };
+		for (int filter = RESAMPLE_BOX; filter <= RESAMPLE_LANCZOS3; filter++) {
+			if (benchSelected(settings, resizeNames[filter], input)) {
+				results.push_back(runBench(settings, resizeNames[filter], input, size, size, imageBytes + imageBytes / 4, [&]() {
+					free(resizeImage(rgb, size / 2, size / 2, (ResampleFilter)filter, &threadPool()).data);
+				}));
+				printBenchResult(results.back());
+			}
+		}
+
+		// doubles out, with the squares that is four times the floats in
+		if (benchSelected(settings, "summed area table", input)) {
+			results.push_back(runBench(settings, "summed area table", input, size, size, imageBytes * 9, [&]() {
+				buildSummedAreaTable(rgb, true, &threadPool());
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "histogram", input) || benchSelected(settings, "equalize", input) || benchSelected(settings, "clahe", input)) {
+			Image hsi = toHSI(rgb);
+			Image copy = hsi;
+			copy.data = (float*)malloc((size_t)imageBytes);
+
+			// reads one channel, so the bytes are those of the cache lines
+			if (benchSelected(settings, "histogram", input)) {
+				u32 counts[256];
+				results.push_back(runBench(settings, "histogram", input, size, size, imageBytes, [&]() {
+					computeHistogram(hsi, HSI_INTENSITY, 256, 0.0f, 1.0f, counts, &threadPool());
+				}));
+				printBenchResult(results.back());
+			}
+
+			if (benchSelected(settings, "equalize", input)) {
+				results.push_back(runBench(settings, "equalize", input, size, size, imageBytes * 3, [&]() {
+					memcpy(copy.data, hsi.data, (size_t)imageBytes);
+					equalizeIntensity(copy, 256, &threadPool());
+				}));
+				printBenchResult(results.back());
+			}
+
+			if (benchSelected(settings, "clahe", input)) {
+				results.push_back(runBench(settings, "clahe", input, size, size, imageBytes * 3, [&]() {
+					memcpy(copy.data, hsi.data, (size_t)imageBytes);
+					claheIntensity(copy, 2.0f, 8, 8, 256, &threadPool());
+				}));
+				printBenchResult(results.back());
+			}
+
+			free(copy.data);
+			free(hsi.data);
+		}
+
+		// every row is read and written once
+		if (benchSelected(settings, "stbi__vertical_flip", input)) {
+			results.push_back(runBench(settings, "stbi__vertical_flip", input, size, size, imageBytes * 2, [&]() {
+				stbi__vertical_flip(rgb.data, size, size, channels * sizeof(float));
+			}));
+			printBenchResult(results.back());
+		}
+
+		if (benchSelected(settings, "stbi_load ppm", input) || benchSelected(settings, "stbi_loadf ppm", input)) {
+			std::vector<u8> ppm = syntheticPPM(rgb);
+
+			if (benchSelected(settings, "stbi_load ppm", input)) {
+				results.push_back(runBench(settings, "stbi_load ppm", input, size, size, ppm.size() + pixels * 4, [&]() {
+					int x, y, n;
+					stbi_image_free(stbi_load_from_memory(ppm.data(), (int)ppm.size(), &x, &y, &n, 4));
+				}));
+				printBenchResult(results.back());
+			}
+
+			if (benchSelected(settings, "stbi_loadf ppm", input)) {
+				results.push_back(runBench(settings, "stbi_loadf ppm", input, size, size, ppm.size() + pixels * 4 * sizeof(float), [&]() {
+					int x, y, n;
+					stbi_image_free(stbi_loadf_from_memory(ppm.data(), (int)ppm.size(), &x, &y, &n, 4));
+				}));
+				printBenchResult(results.back());
+			}
+		}
+
+		free(rgb.data);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchSettings settings = {};
+	const char* minReps = findArg(argc, argv, "--reps");
+	const char* minSeconds = findArg(argc, argv, "--min-time");
+	settings.minReps = minReps ? atoi(minReps) : 5;
+	settings.maxReps = settings.minReps > 100 ? settings.minReps : 100;
+	settings.minSeconds = minSeconds ? atof(minSeconds) : 0.5;
+	settings.filter = findArg(argc, argv, "--filter");
+
+	// the 8k float images need a few gigabytes, --max-size trims the sweep.
+	const char* maxSize = findArg(argc, argv, "--max-size");
+	const char* channels = findArg(argc, argv, "--channels");
+	const char* json = findArg(argc, argv, "--json");
+
+	std::vector<BenchResult> results;
+	printBenchHeader();
+	benchAssets(settings, results);
+	benchSynthetic(settings, maxSize ? atoi(maxSize) : MAX_SIZE, channels ? atoi(channels) : 4, results);
+
+	if (json && !writeBenchJson(json, results)) {
+		return -1;
+	}
+
+	return 0;
+}
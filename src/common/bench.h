@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "common.h"
+
+// time stamp counter. this ticks at the reference clock, not the current
+// core clock, so cycles per pixel drift with turbo. 0 where there is none.
+inline u64 cycleCount()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// one measured case, every repetition is kept so the spread can be
+// reported next to the median.
+struct BenchResult
+{
+	std::string name;
+	std::string input;
+	int width, height;
+	// bytes read plus bytes written by one repetition
+	double bytes;
+	std::vector<double> seconds;
+	std::vector<double> cycles;
+
+	double pixels() const
+	{
+		return (double)this->width * this->height;
+	}
+
+	double median() const
+	{
+		std::vector<double> sorted = this->seconds;
+		std::sort(sorted.begin(), sorted.end());
+		size_t count = sorted.size();
+		return count % 2 ? sorted[count / 2] : 0.5 * (sorted[count / 2 - 1] + sorted[count / 2]);
+	}
+
+	double mean() const
+	{
+		double sum = 0.0;
+		for (double s : this->seconds) {
+			sum += s;
+		}
+		return sum / this->seconds.size();
+	}
+
+	// sample variance in seconds squared
+	double variance() const
+	{
+		double average = this->mean();
+		double sum = 0.0;
+		for (double s : this->seconds) {
+			sum += (s - average) * (s - average);
+		}
+		return this->seconds.size() > 1 ? sum / (this->seconds.size() - 1) : 0.0;
+	}
+
+	double minimum() const
+	{
+		return *std::min_element(this->seconds.begin(), this->seconds.end());
+	}
+
+	double megapixelsPerSecond() const
+	{
+		return this->pixels() / this->median() / 1e6;
+	}
+
+	double gigabytesPerSecond() const
+	{
+		return this->bytes / this->median() / 1e9;
+	}
+
+	double cyclesPerPixel() const
+	{
+		std::vector<double> sorted = this->cycles;
+		std::sort(sorted.begin(), sorted.end());
+		return sorted.empty() ? 0.0 : sorted[sorted.size() / 2] / this->pixels();
+	}
+};
+
+struct BenchSettings
+{
+	// repetitions run until both limits are reached, or maxReps
+	int minReps;
+	int maxReps;
+	double minSeconds;
+	// substring of "<name> <input>" a case must contain to run
+	const char* filter;
+};
+
+inline bool benchSelected(const BenchSettings& settings, const char* name, const char* input)
+{
+	if (!settings.filter) {
+		return true;
+	}
+	std::string label = std::string(name) + " " + input;
+	return label.find(settings.filter) != std::string::npos;
+}
+
+// runs fn once to warm caches and page in its buffers, then repeatedly
+// while timing every call.
+template <typename Fn>
+BenchResult runBench(const BenchSettings& settings, const char* name, const char* input, int width, int height, double bytes, Fn fn)
+{
+	BenchResult result;
+	result.name = name;
+	result.input = input;
+	result.width = width;
+	result.height = height;
+	result.bytes = bytes;
+
+	fn();
+
+	double total = 0.0;
+	while ((int)result.seconds.size() < settings.maxReps &&
+		((int)result.seconds.size() < settings.minReps || total < settings.minSeconds)) {
+		u64 cycles = cycleCount();
+		double start = timeNow();
+		fn();
+		double elapsed = timeNow() - start;
+		result.cycles.push_back((double)(cycleCount() - cycles));
+		result.seconds.push_back(elapsed);
+		total += elapsed;
+	}
+
+	return result;
+}
+
+inline void printBenchHeader()
+{
+	printf("%-22s %-16s %5s %10s %9s %9s %9s %8s %10s\n",
+		"kernel", "input", "reps", "median ms", "stddev %", "MPix/s", "GB/s", "cyc/px", "min ms");
+}
+
+inline void printBenchResult(const BenchResult& result)
+{
+	double median = result.median();
+	double deviation = sqrt(result.variance()) / result.mean() * 100.0;
+	printf("%-22s %-16s %5i %10.3f %9.2f %9.1f %9.2f %8.1f %10.3f\n",
+		result.name.c_str(), result.input.c_str(), (int)result.seconds.size(), median * 1000.0,
+		deviation, result.megapixelsPerSecond(), result.gigabytesPerSecond(), result.cyclesPerPixel(),
+		result.minimum() * 1000.0);
+	fflush(stdout);
+}
+
+// one object per case, every repetition included so later runs can be
+// compared with a proper test rather than a single number.
+inline bool writeBenchJson(const char* path, const std::vector<BenchResult>& results)
+{
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		printf("Failed to open %s for writing\n", path);
+		return false;
+	}
+
+	fprintf(file, "{\n\t\"version\": 1,\n\t\"results\": [");
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult& result = results[i];
+		fprintf(file, "%s\n\t\t{\"name\": \"%s\", \"input\": \"%s\", \"width\": %i, \"height\": %i, ",
+			i ? "," : "", result.name.c_str(), result.input.c_str(), result.width, result.height);
+		fprintf(file, "\"bytes\": %.0f, \"median_s\": %.9f, \"mean_s\": %.9f, \"variance_s2\": %.12g, \"min_s\": %.9f, ",
+			result.bytes, result.median(), result.mean(), result.variance(), result.minimum());
+		fprintf(file, "\"mpix_per_s\": %.3f, \"gb_per_s\": %.3f, \"cycles_per_pixel\": %.3f, \"samples_s\": [",
+			result.megapixelsPerSecond(), result.gigabytesPerSecond(), result.cyclesPerPixel());
+		for (size_t s = 0; s < result.seconds.size(); s++) {
+			fprintf(file, "%s%.9f", s ? ", " : "", result.seconds[s]);
+		}
+		fprintf(file, "]}");
+	}
+	fprintf(file, "\n\t]\n}\n");
+
+	fclose(file);
+	return true;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "common.h"
+
+// tightly packed rgba8, top row first.
+struct CaptureImage
+{
+	int width, height;
+	std::vector<u8> pixels;
+};
+
+// framebuffer readback through a ring of pixel pack buffers. glReadPixels
+// into a bound PBO returns immediately, the copy is only waited on when
+// the result is mapped, ideally a frame or more later.
+struct FrameCapture
+{
+	static const int SLOTS = 2;
+
+	u32 pbo[SLOTS];
+	GLsync fence[SLOTS];
+	int width, height;
+	int next;
+
+	void init(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+		this->next = 0;
+
+		glGenBuffers(SLOTS, this->pbo);
+		for (int i = 0; i < SLOTS; i++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbo[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, nullptr, GL_STREAM_READ);
+			this->fence[i] = 0;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	// reads the currently bound read framebuffer, returns the slot to
+	// resolve later.
+	int request()
+	{
+		int slot = this->next;
+		this->next = (this->next + 1) % SLOTS;
+
+		if (this->fence[slot]) {
+			glDeleteSync(this->fence[slot]);
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbo[slot]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		this->fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		return slot;
+	}
+
+	bool ready(int slot)
+	{
+		if (!this->fence[slot]) {
+			return false;
+		}
+		return glClientWaitSync(this->fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0) != GL_TIMEOUT_EXPIRED;
+	}
+
+	// blocks until the copy is done, flips gl's bottom up rows.
+	bool resolve(int slot, CaptureImage& image)
+	{
+		if (!this->fence[slot]) {
+			return false;
+		}
+
+		glClientWaitSync(this->fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 5000000000ull);
+		glDeleteSync(this->fence[slot]);
+		this->fence[slot] = 0;
+
+		size_t rowBytes = (size_t)this->width * 4;
+		image.width = this->width;
+		image.height = this->height;
+		image.pixels.resize(rowBytes * this->height);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbo[slot]);
+		const u8* mapped = (const u8*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rowBytes * this->height, GL_MAP_READ_BIT);
+		if (mapped) {
+			for (int y = 0; y < this->height; y++) {
+				memcpy(&image.pixels[y * rowBytes], mapped + (this->height - 1 - y) * rowBytes, rowBytes);
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		return mapped != nullptr;
+	}
+
+	void destroy()
+	{
+		for (int i = 0; i < SLOTS; i++) {
+			if (this->fence[i]) {
+				glDeleteSync(this->fence[i]);
+				this->fence[i] = 0;
+			}
+		}
+		glDeleteBuffers(SLOTS, this->pbo);
+	}
+};
+
+// binary ppm, rgb only. goldens are small and need no decoder this way.
+inline bool writePPM(const char* path, const CaptureImage& image)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		printf("Failed to open %s for writing\n", path);
+		return false;
+	}
+
+	fprintf(file, "P6\n%i %i\n255\n", image.width, image.height);
+	std::vector<u8> row((size_t)image.width * 3);
+	for (int y = 0; y < image.height; y++) {
+		const u8* source = &image.pixels[(size_t)y * image.width * 4];
+		for (int x = 0; x < image.width; x++) {
+			row[x * 3 + 0] = source[x * 4 + 0];
+			row[x * 3 + 1] = source[x * 4 + 1];
+			row[x * 3 + 2] = source[x * 4 + 2];
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+
+	fclose(file);
+	return true;
+}
+
+inline bool readPPM(const char* path, CaptureImage& image)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+
+	int maxValue = 0;
+	if (fscanf(file, "P6 %i %i %i", &image.width, &image.height, &maxValue) != 3 || maxValue != 255) {
+		printf("%s is not an 8 bit binary ppm\n", path);
+		fclose(file);
+		return false;
+	}
+	// exactly one whitespace byte after the header
+	fgetc(file);
+
+	std::vector<u8> rgb((size_t)image.width * image.height * 3);
+	bool complete = fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+	fclose(file);
+
+	image.pixels.resize((size_t)image.width * image.height * 4);
+	for (size_t i = 0; i < (size_t)image.width * image.height; i++) {
+		image.pixels[i * 4 + 0] = rgb[i * 3 + 0];
+		image.pixels[i * 4 + 1] = rgb[i * 3 + 1];
+		image.pixels[i * 4 + 2] = rgb[i * 3 + 2];
+		image.pixels[i * 4 + 3] = 255;
+	}
+
+	return complete;
+}
+
+struct ImageDiff
+{
+	bool sameSize;
+	// infinite for identical images
+	double psnr;
+	int maxAbs;
+	u32 differingPixels;
+};
+
+// rgb only, alpha of the backbuffer is not meaningful.
+inline ImageDiff compareImages(const CaptureImage& a, const CaptureImage& b)
+{
+	ImageDiff diff = {};
+	diff.sameSize = a.width == b.width && a.height == b.height;
+	if (!diff.sameSize) {
+		diff.maxAbs = 255;
+		return diff;
+	}
+
+	double squaredError = 0.0;
+	size_t pixelCount = (size_t)a.width * a.height;
+	for (size_t i = 0; i < pixelCount; i++) {
+		bool differs = false;
+		for (int c = 0; c < 3; c++) {
+			int delta = abs((int)a.pixels[i * 4 + c] - (int)b.pixels[i * 4 + c]);
+			squaredError += delta * delta;
+			diff.maxAbs = delta > diff.maxAbs ? delta : diff.maxAbs;
+			differs = differs || delta;
+		}
+		diff.differingPixels += differs ? 1 : 0;
+	}
+
+	double mse = squaredError / (pixelCount * 3);
+	diff.psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+	return diff;
+}
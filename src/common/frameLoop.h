@@ -0,0 +1,429 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glfw/glfw3.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "capture.h"
+#include "common.h"
+#include "glCounters.h"
+#include "profiler.h"
+#include "trace.h"
+
+// frames skipped by --bench before it starts measuring, the first frames
+// pay for lazy driver work.
+const u64 BENCH_WARMUP_FRAMES = 10;
+
+// offscreen color target the demos render into when there is no window
+// to present to.
+struct RenderTarget
+{
+	u32 fbo;
+	u32 color;
+	int width, height;
+};
+
+// command line switches shared by every demo binary, and the state of the
+// frame loop they drive.
+struct FrameLoop
+{
+	// --profile <file.csv>, per frame scope timings written on exit
+	const char* profileCsv;
+	// --trace <file.json>, chrome trace of frames, loads and shader builds
+	const char* traceJson;
+	// --headless, hidden window, renders into target instead of the
+	// backbuffer. stops after --frames frames, 100 when not given.
+	bool headless;
+	// --frames <n>, 0 runs until the window is closed
+	u64 frameLimit;
+
+	// regression harness, see runDemos.
+	// --demo <name|all>, run demos from the table in main by name
+	const char* demo;
+	// --golden <dir>, compare the captured frame with <dir>/<program>_<demo>.ppm
+	const char* goldenDir;
+	// --record, write the captured frames as the new goldens instead
+	bool record;
+	// --capture <dir>, also keep every captured frame in dir
+	const char* captureDir;
+	// --capture-frame <n>, frame to read back, the last one by default
+	u64 captureFrame;
+	// --min-psnr <db> and --max-abs <n>, a case passes when both hold
+	double minPsnr;
+	int maxAbs;
+
+	// --bench, no vsync, reports frame time percentiles and gl calls per
+	// frame. runs 1000 frames when --frames is not given.
+	bool bench;
+
+	// argv[0] without directories and extension
+	char program[64];
+
+	u64 frame;
+	double start;
+	RenderTarget target;
+	GLsync frameFence;
+
+	FrameCapture capture;
+	int captureSlot;
+
+	// --bench results since the last report
+	double frameStart;
+	std::vector<double> frameMs;
+	u64 benchCalls, benchDraws;
+};
+
+inline FrameLoop& frameLoop()
+{
+	static FrameLoop loop = {};
+	return loop;
+}
+
+// call first thing in main, before glfwInit.
+inline void initFrameLoop(int argc, char* argv[])
+{
+	FrameLoop& loop = frameLoop();
+	loop.profileCsv = findArg(argc, argv, "--profile");
+	loop.traceJson = findArg(argc, argv, "--trace");
+	loop.headless = hasArg(argc, argv, "--headless");
+	loop.bench = hasArg(argc, argv, "--bench");
+
+	loop.demo = findArg(argc, argv, "--demo");
+	loop.goldenDir = findArg(argc, argv, "--golden");
+	loop.record = hasArg(argc, argv, "--record");
+	loop.captureDir = findArg(argc, argv, "--capture");
+
+	const char* minPsnr = findArg(argc, argv, "--min-psnr");
+	const char* maxAbs = findArg(argc, argv, "--max-abs");
+	loop.minPsnr = minPsnr ? atof(minPsnr) : 40.0;
+	loop.maxAbs = maxAbs ? atoi(maxAbs) : 64;
+
+	// captures need a last frame
+	bool capturing = loop.goldenDir || loop.captureDir;
+	const char* frames = findArg(argc, argv, "--frames");
+	loop.frameLimit = frames ? strtoull(frames, nullptr, 10) : (loop.bench ? 1000 : (loop.headless || capturing ? 100 : 0));
+
+	const char* captureFrame = findArg(argc, argv, "--capture-frame");
+	loop.captureFrame = captureFrame ? strtoull(captureFrame, nullptr, 10) : ~0ull;
+	if (capturing && loop.frameLimit && loop.captureFrame >= loop.frameLimit) {
+		loop.captureFrame = loop.frameLimit - 1;
+	}
+	loop.captureSlot = -1;
+
+	const char* program = argv[0];
+	for (const char* c = argv[0]; *c; c++) {
+		if (*c == '/' || *c == '\\') {
+			program = c + 1;
+		}
+	}
+	snprintf(loop.program, sizeof(loop.program), "%s", program);
+	char* extension = strrchr(loop.program, '.');
+	if (extension) {
+		*extension = 0;
+	}
+
+	if (loop.traceJson) {
+		startTrace(loop.traceJson);
+		traceThreadName("main");
+	}
+
+#ifdef GLFW_PLATFORM_NULL
+	// glfw 3.4+ can run without any display server, the context then
+	// comes from osmesa (llvmpipe). older glfw needs a display even for
+	// hidden windows, xvfb-run works for those.
+	if (loop.headless && !getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY")) {
+		glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+	}
+#endif
+}
+
+// call after the context hints, right before glfwCreateWindow.
+inline void setFrameLoopWindowHints()
+{
+	FrameLoop& loop = frameLoop();
+	if (!loop.headless) {
+		return;
+	}
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef GLFW_PLATFORM_NULL
+	if (glfwGetPlatform() == GLFW_PLATFORM_NULL) {
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+	}
+#endif
+}
+
+// call once glad is loaded. in headless mode every frame renders into an
+// fbo of the given size, the default framebuffer of a hidden window is not
+// guaranteed to have pixel ownership. --bench turns off vsync and starts
+// counting gl calls here.
+inline bool initRenderTarget(int width, int height)
+{
+	FrameLoop& loop = frameLoop();
+	loop.target.width = width;
+	loop.target.height = height;
+	loop.start = timeNow();
+
+	if (loop.bench) {
+		// uncapped, frames are only as long as the work in them
+		glfwSwapInterval(0);
+		installGLCounters();
+	}
+
+	if (!loop.headless) {
+		return true;
+	}
+
+	glGenRenderbuffers(1, &loop.target.color);
+	glBindRenderbuffer(GL_RENDERBUFFER, loop.target.color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenFramebuffers(1, &loop.target.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, loop.target.fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, loop.target.color);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Failed to create the offscreen framebuffer\n");
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+// seconds for animation. fixed 60hz steps when the output has to be
+// reproducible, wall clock otherwise.
+inline double frameTime()
+{
+	FrameLoop& loop = frameLoop();
+	if (loop.headless || loop.goldenDir || loop.captureDir) {
+		return loop.frame / 60.0;
+	}
+	return glfwGetTime();
+}
+
+// the demo loops are
+//     while (beginFrame(window)) { ... endFrame(window); }
+// so frame boundaries live in one place.
+inline bool beginFrame(GLFWwindow* window)
+{
+	FrameLoop& loop = frameLoop();
+	if (glfwWindowShouldClose(window)) {
+		return false;
+	}
+	if (loop.frameLimit && loop.frame >= loop.frameLimit) {
+		return false;
+	}
+
+	profiler().beginFrame();
+	loop.frameStart = timeNow();
+	glCallCounts().calls = 0;
+	glCallCounts().draws = 0;
+	return true;
+}
+
+inline void endFrame(GLFWwindow* window)
+{
+	FrameLoop& loop = frameLoop();
+
+	if ((loop.goldenDir || loop.captureDir) && loop.frame == loop.captureFrame) {
+		PROFILE_CPU("capture");
+		if (!loop.capture.pbo[0]) {
+			loop.capture.init(loop.target.width, loop.target.height);
+		}
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, loop.target.fbo);
+		glReadBuffer(loop.target.fbo ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+		loop.captureSlot = loop.capture.request();
+	}
+
+	if (loop.headless) {
+		// nothing to present. wait for the previous frame instead, so the
+		// cpu stays at most one frame ahead like it would with a swap chain.
+		PROFILE_CPU("frame fence");
+		if (loop.frameFence) {
+			glClientWaitSync(loop.frameFence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			glDeleteSync(loop.frameFence);
+		}
+		loop.frameFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	else {
+		// mostly vsync wait
+		PROFILE_CPU("swap");
+		glfwSwapBuffers(window);
+	}
+	glfwPollEvents();
+
+	profiler().endFrame();
+
+	if (loop.bench && loop.frame >= BENCH_WARMUP_FRAMES) {
+		loop.frameMs.push_back((timeNow() - loop.frameStart) * 1000.0);
+		loop.benchCalls += glCallCounts().calls;
+		loop.benchDraws += glCallCounts().draws;
+	}
+	loop.frame++;
+}
+
+// prints the --bench numbers gathered since the last report and resets them.
+inline void printFrameBench(const char* name)
+{
+	FrameLoop& loop = frameLoop();
+	if (loop.frameMs.empty()) {
+		return;
+	}
+
+	double frames = (double)loop.frameMs.size();
+	double sum = 0.0;
+	for (double ms : loop.frameMs) {
+		sum += ms;
+	}
+
+	double p50 = Profiler::percentile(loop.frameMs, 0.5);
+	double p99 = Profiler::percentile(loop.frameMs, 0.99);
+	double max = Profiler::percentile(loop.frameMs, 1.0);
+	printf("bench %-20s %6.0f frames  p50 %7.3f ms  p99 %7.3f ms  max %7.3f ms  %8.1f fps  %6.1f draws  %7.1f gl calls per frame\n",
+		name, frames, p50, p99, max, frames * 1000.0 / sum, loop.benchDraws / frames, loop.benchCalls / frames);
+
+	loop.frameMs.clear();
+	loop.benchCalls = 0;
+	loop.benchDraws = 0;
+}
+
+// call before the context goes away.
+inline void shutdownFrameLoop()
+{
+	FrameLoop& loop = frameLoop();
+	if (loop.headless) {
+		printf("rendered %llu frames headless in %.3f s\n", (unsigned long long)loop.frame, timeNow() - loop.start);
+	}
+
+	printFrameBench(loop.program);
+	profiler().shutdown(loop.profileCsv);
+	stopTrace();
+
+	if (loop.frameFence) {
+		glDeleteSync(loop.frameFence);
+		loop.frameFence = 0;
+	}
+
+	if (loop.capture.pbo[0]) {
+		loop.capture.destroy();
+	}
+
+	if (loop.target.fbo) {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &loop.target.fbo);
+		glDeleteRenderbuffers(1, &loop.target.color);
+		loop.target.fbo = 0;
+		loop.target.color = 0;
+	}
+}
+
+struct Demo
+{
+	const char* name;
+	int (*run)(GLFWwindow* window);
+};
+
+// checks the frame captured during the last case against its golden,
+// returns false when the case fails.
+inline bool checkCapture(const char* demo, char* status, size_t statusSize)
+{
+	FrameLoop& loop = frameLoop();
+
+	CaptureImage image = {};
+	if (loop.captureSlot < 0 || !loop.capture.resolve(loop.captureSlot, image)) {
+		snprintf(status, statusSize, "no frame captured");
+		return false;
+	}
+	loop.captureSlot = -1;
+
+	char path[512];
+	if (loop.captureDir) {
+		snprintf(path, sizeof(path), "%s/%s_%s.ppm", loop.captureDir, loop.program, demo);
+		writePPM(path, image);
+	}
+
+	if (!loop.goldenDir) {
+		snprintf(status, statusSize, "captured");
+		return true;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s_%s.ppm", loop.goldenDir, loop.program, demo);
+	if (loop.record) {
+		bool written = writePPM(path, image);
+		snprintf(status, statusSize, written ? "recorded" : "failed to record");
+		return written;
+	}
+
+	CaptureImage golden = {};
+	if (!readPPM(path, golden)) {
+		snprintf(status, statusSize, "missing golden %s", path);
+		return false;
+	}
+
+	ImageDiff diff = compareImages(image, golden);
+	bool pass = diff.sameSize && diff.psnr >= loop.minPsnr && diff.maxAbs <= loop.maxAbs;
+	snprintf(status, statusSize, "psnr %.2f db, max abs %i, %u pixels differ, %s",
+		diff.psnr, diff.maxAbs, diff.differingPixels, pass ? "pass" : "FAIL");
+	return pass;
+}
+
+// runs every demo whose name matches --demo, or all of them, one after the
+// other on the same window. each case restarts the frame count, is timed,
+// and has its capture checked. non zero when any case failed.
+inline int runDemos(GLFWwindow* window, const Demo* demos, int count)
+{
+	FrameLoop& loop = frameLoop();
+	bool all = strcmp(loop.demo, "all") == 0;
+	int ran = 0;
+	int failed = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (!all && strcmp(loop.demo, demos[i].name) != 0) {
+			continue;
+		}
+
+		loop.frame = 0;
+		double start = timeNow();
+		int result = 0;
+		{
+			TRACE_SCOPE_DETAIL("demo", "demo", demos[i].name);
+			result = demos[i].run(window);
+		}
+		double seconds = timeNow() - start;
+		ran++;
+
+		char status[256] = "ok";
+		bool pass = result == 0;
+		if (!pass) {
+			snprintf(status, sizeof(status), "returned %i", result);
+		}
+		else if (loop.goldenDir || loop.captureDir) {
+			pass = checkCapture(demos[i].name, status, sizeof(status));
+		}
+		failed += pass ? 0 : 1;
+
+		printf("%-20s %6llu frames %8.3f s %8.3f ms/frame  %s\n", demos[i].name, (unsigned long long)loop.frame,
+			seconds, loop.frame ? seconds * 1000.0 / loop.frame : 0.0, status);
+		printFrameBench(demos[i].name);
+
+		if (glfwWindowShouldClose(window)) {
+			break;
+		}
+	}
+
+	if (!ran) {
+		printf("no demo named %s, choose one of:", loop.demo);
+		for (int i = 0; i < count; i++) {
+			printf(" %s", demos[i].name);
+		}
+		printf(" all\n");
+		return -6;
+	}
+
+	return failed ? -7 : 0;
+}
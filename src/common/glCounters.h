@@ -0,0 +1,146 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "common.h"
+
+// gl calls and draw calls issued since the counters were last reset. only
+// counted once installGLCounters ran, for the render benchmark.
+struct GLCallCounts
+{
+	bool installed;
+	u64 calls;
+	u64 draws;
+};
+
+inline GLCallCounts& glCallCounts()
+{
+	static GLCallCounts counts = {};
+	return counts;
+}
+
+// for entry points loaded outside glad, see MultiDraw.
+inline void countGLDraw()
+{
+	GLCallCounts& counts = glCallCounts();
+	if (counts.installed) {
+		counts.calls++;
+		counts.draws++;
+	}
+}
+
+// swaps one glad function pointer for a wrapper that counts and forwards.
+// slot is the glad_gl* global, one instantiation per entry point.
+template <typename Fn, Fn* slot, bool draw>
+struct GLCallCounter;
+
+template <typename R, typename... Args, R (APIENTRYP* slot)(Args...), bool draw>
+struct GLCallCounter<R (APIENTRYP)(Args...), slot, draw>
+{
+	static R (APIENTRYP original)(Args...);
+
+	static R APIENTRY call(Args... args)
+	{
+		GLCallCounts& counts = glCallCounts();
+		counts.calls++;
+		counts.draws += draw ? 1 : 0;
+		return original(args...);
+	}
+
+	static void install()
+	{
+		if (*slot && *slot != call) {
+			original = *slot;
+			*slot = call;
+		}
+	}
+};
+
+template <typename R, typename... Args, R (APIENTRYP* slot)(Args...), bool draw>
+R (APIENTRYP GLCallCounter<R (APIENTRYP)(Args...), slot, draw>::original)(Args...) = nullptr;
+
+#define GL_COUNT_CALLS(name) GLCallCounter<decltype(glad_##name), &glad_##name, false>::install()
+#define GL_COUNT_DRAWS(name) GLCallCounter<decltype(glad_##name), &glad_##name, true>::install()
+
+// call after glad is loaded. covers every entry point the demos and the
+// common helpers use, extend the list when new ones show up.
+inline void installGLCounters()
+{
+	GL_COUNT_DRAWS(glDrawArrays);
+	GL_COUNT_DRAWS(glDrawElements);
+	GL_COUNT_DRAWS(glDrawElementsBaseVertex);
+	GL_COUNT_DRAWS(glDrawElementsInstanced);
+	GL_COUNT_DRAWS(glDrawElementsInstancedBaseVertex);
+	GL_COUNT_DRAWS(glDrawArraysInstanced);
+
+	GL_COUNT_CALLS(glActiveTexture);
+	GL_COUNT_CALLS(glAttachShader);
+	GL_COUNT_CALLS(glBeginQuery);
+	GL_COUNT_CALLS(glBindBuffer);
+	GL_COUNT_CALLS(glBindBufferBase);
+	GL_COUNT_CALLS(glBindFramebuffer);
+	GL_COUNT_CALLS(glBindRenderbuffer);
+	GL_COUNT_CALLS(glBindTexture);
+	GL_COUNT_CALLS(glBindVertexArray);
+	GL_COUNT_CALLS(glBlendFunc);
+	GL_COUNT_CALLS(glBufferData);
+	GL_COUNT_CALLS(glBufferSubData);
+	GL_COUNT_CALLS(glCheckFramebufferStatus);
+	GL_COUNT_CALLS(glClear);
+	GL_COUNT_CALLS(glClearBufferfv);
+	GL_COUNT_CALLS(glClearColor);
+	GL_COUNT_CALLS(glClientWaitSync);
+	GL_COUNT_CALLS(glCompileShader);
+	GL_COUNT_CALLS(glCopyBufferSubData);
+	GL_COUNT_CALLS(glCreateProgram);
+	GL_COUNT_CALLS(glCreateShader);
+	GL_COUNT_CALLS(glDeleteBuffers);
+	GL_COUNT_CALLS(glDeleteFramebuffers);
+	GL_COUNT_CALLS(glDeleteProgram);
+	GL_COUNT_CALLS(glDeleteQueries);
+	GL_COUNT_CALLS(glDeleteRenderbuffers);
+	GL_COUNT_CALLS(glDeleteShader);
+	GL_COUNT_CALLS(glDeleteSync);
+	GL_COUNT_CALLS(glDeleteTextures);
+	GL_COUNT_CALLS(glDeleteVertexArrays);
+	GL_COUNT_CALLS(glDisable);
+	GL_COUNT_CALLS(glEnable);
+	GL_COUNT_CALLS(glEnableVertexAttribArray);
+	GL_COUNT_CALLS(glEndQuery);
+	GL_COUNT_CALLS(glFenceSync);
+	GL_COUNT_CALLS(glFramebufferRenderbuffer);
+	GL_COUNT_CALLS(glFramebufferTexture2D);
+	GL_COUNT_CALLS(glGenBuffers);
+	GL_COUNT_CALLS(glGenFramebuffers);
+	GL_COUNT_CALLS(glGenQueries);
+	GL_COUNT_CALLS(glGenRenderbuffers);
+	GL_COUNT_CALLS(glGenTextures);
+	GL_COUNT_CALLS(glGenVertexArrays);
+	GL_COUNT_CALLS(glGenerateMipmap);
+	GL_COUNT_CALLS(glGetBufferSubData);
+	GL_COUNT_CALLS(glGetError);
+	GL_COUNT_CALLS(glGetIntegerv);
+	GL_COUNT_CALLS(glGetQueryObjectui64v);
+	GL_COUNT_CALLS(glGetUniformLocation);
+	GL_COUNT_CALLS(glIsEnabled);
+	GL_COUNT_CALLS(glLinkProgram);
+	GL_COUNT_CALLS(glMapBufferRange);
+	GL_COUNT_CALLS(glPixelStorei);
+	GL_COUNT_CALLS(glReadBuffer);
+	GL_COUNT_CALLS(glReadPixels);
+	GL_COUNT_CALLS(glRenderbufferStorage);
+	GL_COUNT_CALLS(glShaderSource);
+	GL_COUNT_CALLS(glTexImage2D);
+	GL_COUNT_CALLS(glTexParameteri);
+	GL_COUNT_CALLS(glUniform1f);
+	GL_COUNT_CALLS(glUniform1i);
+	GL_COUNT_CALLS(glUniform2i);
+	GL_COUNT_CALLS(glUniform3f);
+	GL_COUNT_CALLS(glUniform4i);
+	GL_COUNT_CALLS(glUnmapBuffer);
+	GL_COUNT_CALLS(glUseProgram);
+	GL_COUNT_CALLS(glVertexAttribPointer);
+	GL_COUNT_CALLS(glViewport);
+
+	glCallCounts().installed = true;
+}
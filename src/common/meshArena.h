@@ -0,0 +1,444 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "common.h"
+#include "vertexFormat.h"
+
+// power of two buddy allocator over an abstract range of units. the mesh
+// arena runs one in vertices and one in indices, so every offset it hands
+// out is directly usable as baseVertex / firstIndex.
+struct BuddyAllocator
+{
+	u32 minOrder;
+	u32 maxOrder;
+	u32 usedUnits;
+	// free block offsets per order, sets so buddies can be found and
+	// unlinked in log time when merging.
+	std::vector<std::set<u32>> freeLists;
+	// offset -> order of every live block
+	std::map<u32, u32> blocks;
+
+	BuddyAllocator()
+	{
+		this->minOrder = 0;
+		this->maxOrder = 0;
+		this->usedUnits = 0;
+	}
+
+	BuddyAllocator(u32 capacity, u32 minBlock)
+	{
+		this->minOrder = orderFor(minBlock, 0);
+		this->maxOrder = orderFor(capacity, this->minOrder);
+		this->usedUnits = 0;
+		this->freeLists.resize(this->maxOrder + 1);
+		this->freeLists[this->maxOrder].insert(0);
+	}
+
+	static u32 orderFor(u32 units, u32 minOrder)
+	{
+		u32 order = minOrder;
+		while ((1u << order) < units) {
+			order++;
+		}
+		return order;
+	}
+
+	u32 capacity() const
+	{
+		return 1u << this->maxOrder;
+	}
+
+	bool allocate(u32 units, u32& outOffset)
+	{
+		u32 order = orderFor(units, this->minOrder);
+		if (order > this->maxOrder) {
+			return false;
+		}
+
+		u32 freeOrder = order;
+		while (freeOrder <= this->maxOrder && this->freeLists[freeOrder].empty()) {
+			freeOrder++;
+		}
+		if (freeOrder > this->maxOrder) {
+			return false;
+		}
+
+		u32 offset = *this->freeLists[freeOrder].begin();
+		this->freeLists[freeOrder].erase(this->freeLists[freeOrder].begin());
+
+		// split down, the upper halves go back on the free lists
+		while (freeOrder > order) {
+			freeOrder--;
+			this->freeLists[freeOrder].insert(offset + (1u << freeOrder));
+		}
+
+		this->blocks[offset] = order;
+		this->usedUnits += units;
+		outOffset = offset;
+		return true;
+	}
+
+	void free(u32 offset, u32 units)
+	{
+		std::map<u32, u32>::iterator block = this->blocks.find(offset);
+		ASSERT(block != this->blocks.end());
+
+		u32 order = block->second;
+		this->blocks.erase(block);
+		this->usedUnits -= units;
+
+		// merge with the buddy as long as it is free as well
+		while (order < this->maxOrder) {
+			u32 buddy = offset ^ (1u << order);
+			std::set<u32>::iterator it = this->freeLists[order].find(buddy);
+			if (it == this->freeLists[order].end()) {
+				break;
+			}
+			this->freeLists[order].erase(it);
+			offset = std::min(offset, buddy);
+			order++;
+		}
+
+		this->freeLists[order].insert(offset);
+	}
+
+	// doubles the range, the old range becomes the lower buddy of the new root.
+	void grow()
+	{
+		u32 oldOrder = this->maxOrder;
+		this->maxOrder++;
+		this->freeLists.resize(this->maxOrder + 1);
+
+		std::set<u32>::iterator it = this->freeLists[oldOrder].find(0);
+		if (it != this->freeLists[oldOrder].end()) {
+			this->freeLists[oldOrder].erase(it);
+			this->freeLists[this->maxOrder].insert(0);
+		}
+		else {
+			this->freeLists[oldOrder].insert(1u << oldOrder);
+		}
+	}
+
+	u32 allocatedUnits() const
+	{
+		u32 units = 0;
+		for (std::map<u32, u32>::const_iterator it = this->blocks.begin(); it != this->blocks.end(); ++it) {
+			units += 1u << it->second;
+		}
+		return units;
+	}
+
+	u32 largestFreeBlock() const
+	{
+		for (u32 order = this->maxOrder + 1; order-- > this->minOrder;) {
+			if (!this->freeLists[order].empty()) {
+				return 1u << order;
+			}
+		}
+		return 0;
+	}
+
+	u32 freeBlockCount() const
+	{
+		u32 count = 0;
+		for (size_t i = 0; i < this->freeLists.size(); i++) {
+			count += (u32)this->freeLists[i].size();
+		}
+		return count;
+	}
+};
+
+// handle to a range of a MeshArena. handles stay valid across grow() and
+// defragment(), only the offsets behind them move.
+struct Mesh
+{
+	u32 slot;
+};
+
+struct MeshSlot
+{
+	bool alive;
+	u32 baseVertex;
+	u32 vertexCount;
+	u32 firstIndex;
+	u32 indexCount;
+};
+
+struct ArenaStats
+{
+	u32 meshes;
+	u32 bufferObjects;
+	u32 vertexCapacity, verticesUsed, verticesAllocated;
+	u32 indexCapacity, indicesUsed, indicesAllocated;
+	u32 freeBlocks;
+	// 0 when all free space is one block, approaching 1 when it is scattered.
+	float fragmentation;
+};
+
+// one vao, one vertex buffer and one index buffer shared by every mesh of a
+// vertex format. replaces the per demo vao/vbo/ebo triple.
+struct MeshArena
+{
+	u32 vao;
+	u32 vbo;
+	u32 ebo;
+	VertexFormat format;
+	// GL_UNSIGNED_SHORT unless a mesh needs more than 65536 vertices, indices
+	// are relative to baseVertex so only the size of one mesh matters.
+	u32 indexType;
+	u32 indexSize;
+	BuddyAllocator vertexAllocator;
+	BuddyAllocator indexAllocator;
+	std::vector<MeshSlot> slots;
+	std::vector<u32> freeSlots;
+
+	MeshArena(const VertexFormat& format, u32 indexType = GL_UNSIGNED_SHORT, u32 vertexCapacity = 1 << 12, u32 indexCapacity = 1 << 13)
+	{
+		this->format = format;
+		this->indexType = indexType;
+		this->indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+		this->vertexAllocator = BuddyAllocator(vertexCapacity, 4);
+		this->indexAllocator = BuddyAllocator(indexCapacity, 8);
+
+		glGenVertexArrays(1, &this->vao);
+		glBindVertexArray(this->vao);
+
+		this->vbo = createBuffer(GL_ARRAY_BUFFER, this->vertexAllocator.capacity() * this->format.stride);
+		this->ebo = createBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexAllocator.capacity() * this->indexSize);
+		this->format.apply();
+	}
+
+	static u32 createBuffer(u32 target, size_t bytes)
+	{
+		u32 buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(target, buffer);
+		glBufferData(target, bytes, nullptr, GL_STATIC_DRAW);
+		return buffer;
+	}
+
+	// indexData may be null for meshes drawn with glDrawArrays.
+	Mesh allocate(const void* vertexData, u32 vertexCount, const u32* indexData, u32 indexCount)
+	{
+		MeshSlot slot = {};
+		slot.alive = true;
+		slot.vertexCount = vertexCount;
+		slot.indexCount = indexData ? indexCount : 0;
+
+		while (!this->vertexAllocator.allocate(vertexCount, slot.baseVertex)) {
+			this->growVertices();
+		}
+		while (slot.indexCount && !this->indexAllocator.allocate(slot.indexCount, slot.firstIndex)) {
+			this->growIndices();
+		}
+
+		glBindVertexArray(this->vao);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, slot.baseVertex * this->format.stride, vertexCount * this->format.stride, vertexData);
+		if (slot.indexCount && this->indexType == GL_UNSIGNED_SHORT) {
+			for (u32 i = 0; i < slot.indexCount; i++) {
+				ASSERT(indexData[i] <= 0xffff);
+			}
+			std::vector<u16> shortIndices(indexData, indexData + slot.indexCount);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, slot.firstIndex * this->indexSize, slot.indexCount * this->indexSize, shortIndices.data());
+		}
+		else if (slot.indexCount) {
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, slot.firstIndex * this->indexSize, slot.indexCount * this->indexSize, indexData);
+		}
+
+		Mesh mesh = {};
+		if (!this->freeSlots.empty()) {
+			mesh.slot = this->freeSlots.back();
+			this->freeSlots.pop_back();
+			this->slots[mesh.slot] = slot;
+		}
+		else {
+			mesh.slot = (u32)this->slots.size();
+			this->slots.push_back(slot);
+		}
+		return mesh;
+	}
+
+	void release(Mesh mesh)
+	{
+		MeshSlot& slot = this->slots[mesh.slot];
+		ASSERT(slot.alive);
+
+		this->vertexAllocator.free(slot.baseVertex, slot.vertexCount);
+		if (slot.indexCount) {
+			this->indexAllocator.free(slot.firstIndex, slot.indexCount);
+		}
+		slot.alive = false;
+		this->freeSlots.push_back(mesh.slot);
+	}
+
+	const MeshSlot& get(Mesh mesh) const
+	{
+		return this->slots[mesh.slot];
+	}
+
+	void bind() const
+	{
+		glBindVertexArray(this->vao);
+	}
+
+	// expects bind(), so a run of draws from the same arena binds once.
+	void draw(Mesh mesh) const
+	{
+		const MeshSlot& slot = this->slots[mesh.slot];
+		if (slot.indexCount) {
+			glDrawElementsBaseVertex(GL_TRIANGLES, slot.indexCount, this->indexType, (void*)(size_t)(slot.firstIndex * this->indexSize), slot.baseVertex);
+		}
+		else {
+			glDrawArrays(GL_TRIANGLES, slot.baseVertex, slot.vertexCount);
+		}
+	}
+
+	// copies the given ranges of a buffer into a new one of newBytes and
+	// deletes the old buffer.
+	static u32 copyBuffer(u32 oldBuffer, size_t newBytes, const std::vector<u32>& srcOffsets, const std::vector<u32>& dstOffsets, const std::vector<u32>& sizes)
+	{
+		u32 newBuffer = createBuffer(GL_COPY_WRITE_BUFFER, newBytes);
+		glBindBuffer(GL_COPY_READ_BUFFER, oldBuffer);
+		for (size_t i = 0; i < sizes.size(); i++) {
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, srcOffsets[i], dstOffsets[i], sizes[i]);
+		}
+		glDeleteBuffers(1, &oldBuffer);
+		return newBuffer;
+	}
+
+	void growVertices()
+	{
+		size_t oldBytes = this->vertexAllocator.capacity() * this->format.stride;
+		this->vertexAllocator.grow();
+
+		std::vector<u32> offsets(1, 0);
+		std::vector<u32> sizes(1, (u32)oldBytes);
+		this->vbo = copyBuffer(this->vbo, this->vertexAllocator.capacity() * this->format.stride, offsets, offsets, sizes);
+
+		// the attribute pointers captured the old buffer
+		glBindVertexArray(this->vao);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+		this->format.apply();
+	}
+
+	void growIndices()
+	{
+		size_t oldBytes = this->indexAllocator.capacity() * this->indexSize;
+		this->indexAllocator.grow();
+
+		std::vector<u32> offsets(1, 0);
+		std::vector<u32> sizes(1, (u32)oldBytes);
+		this->ebo = copyBuffer(this->ebo, this->indexAllocator.capacity() * this->indexSize, offsets, offsets, sizes);
+
+		glBindVertexArray(this->vao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ebo);
+	}
+
+	// repacks every live mesh to the front of fresh buffers. allocating the
+	// biggest blocks first leaves a buddy allocator with no holes, so all
+	// free space ends up in as few blocks as possible.
+	void defragment()
+	{
+		std::vector<u32> live;
+		for (u32 i = 0; i < this->slots.size(); i++) {
+			if (this->slots[i].alive) {
+				live.push_back(i);
+			}
+		}
+
+		std::vector<MeshSlot>& slots = this->slots;
+		std::sort(live.begin(), live.end(), [&slots](u32 a, u32 b) {
+			return slots[a].vertexCount > slots[b].vertexCount;
+		});
+
+		BuddyAllocator vertices = BuddyAllocator(this->vertexAllocator.capacity(), 1u << this->vertexAllocator.minOrder);
+		std::vector<u32> srcOffsets, dstOffsets, sizes;
+		for (size_t i = 0; i < live.size(); i++) {
+			MeshSlot& slot = slots[live[i]];
+			u32 baseVertex = 0;
+			vertices.allocate(slot.vertexCount, baseVertex);
+			srcOffsets.push_back(slot.baseVertex * this->format.stride);
+			dstOffsets.push_back(baseVertex * this->format.stride);
+			sizes.push_back(slot.vertexCount * this->format.stride);
+			slot.baseVertex = baseVertex;
+		}
+		this->vbo = copyBuffer(this->vbo, vertices.capacity() * this->format.stride, srcOffsets, dstOffsets, sizes);
+		this->vertexAllocator = vertices;
+
+		std::sort(live.begin(), live.end(), [&slots](u32 a, u32 b) {
+			return slots[a].indexCount > slots[b].indexCount;
+		});
+
+		BuddyAllocator indices = BuddyAllocator(this->indexAllocator.capacity(), 1u << this->indexAllocator.minOrder);
+		srcOffsets.clear();
+		dstOffsets.clear();
+		sizes.clear();
+		for (size_t i = 0; i < live.size(); i++) {
+			MeshSlot& slot = slots[live[i]];
+			if (!slot.indexCount) {
+				continue;
+			}
+			u32 firstIndex = 0;
+			indices.allocate(slot.indexCount, firstIndex);
+			srcOffsets.push_back(slot.firstIndex * this->indexSize);
+			dstOffsets.push_back(firstIndex * this->indexSize);
+			sizes.push_back(slot.indexCount * this->indexSize);
+			slot.firstIndex = firstIndex;
+		}
+		this->ebo = copyBuffer(this->ebo, indices.capacity() * this->indexSize, srcOffsets, dstOffsets, sizes);
+		this->indexAllocator = indices;
+
+		glBindVertexArray(this->vao);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ebo);
+		this->format.apply();
+	}
+
+	ArenaStats stats() const
+	{
+		ArenaStats stats = {};
+		stats.meshes = (u32)(this->slots.size() - this->freeSlots.size());
+		stats.bufferObjects = 2;
+		stats.vertexCapacity = this->vertexAllocator.capacity();
+		stats.verticesUsed = this->vertexAllocator.usedUnits;
+		stats.verticesAllocated = this->vertexAllocator.allocatedUnits();
+		stats.indexCapacity = this->indexAllocator.capacity();
+		stats.indicesUsed = this->indexAllocator.usedUnits;
+		stats.indicesAllocated = this->indexAllocator.allocatedUnits();
+		stats.freeBlocks = this->vertexAllocator.freeBlockCount() + this->indexAllocator.freeBlockCount();
+
+		u32 freeVertices = stats.vertexCapacity - stats.verticesAllocated;
+		if (freeVertices) {
+			stats.fragmentation = 1.0f - (float)this->vertexAllocator.largestFreeBlock() / freeVertices;
+		}
+		return stats;
+	}
+
+	void printStats(const char* name) const
+	{
+		ArenaStats stats = this->stats();
+		printf("%s: %u meshes in %u buffers, vertices %u/%u (%u allocated), indices %u/%u (%u allocated), %u free blocks, fragmentation %.2f\n",
+			name, stats.meshes, stats.bufferObjects,
+			stats.verticesUsed, stats.vertexCapacity, stats.verticesAllocated,
+			stats.indicesUsed, stats.indexCapacity, stats.indicesAllocated,
+			stats.freeBlocks, stats.fragmentation);
+	}
+
+	void destroy()
+	{
+		glDeleteBuffers(1, &this->ebo);
+		glDeleteBuffers(1, &this->vbo);
+		glDeleteVertexArrays(1, &this->vao);
+		this->ebo = 0;
+		this->vbo = 0;
+		this->vao = 0;
+	}
+};
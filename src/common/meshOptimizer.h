@@ -0,0 +1,287 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "common.h"
+
+// an indexed triangle mesh in system memory, the input to the passes below.
+struct MeshData
+{
+	std::vector<u8> vertices;
+	std::vector<u32> indices;
+	u32 vertexCount;
+	u32 stride;
+
+	static MeshData from(const void* vertices, u32 vertexCount, u32 stride, const u32* indices, u32 indexCount)
+	{
+		MeshData mesh = {};
+		mesh.vertices.assign((const u8*)vertices, (const u8*)vertices + vertexCount * stride);
+		mesh.indices.assign(indices, indices + indexCount);
+		mesh.vertexCount = vertexCount;
+		mesh.stride = stride;
+		return mesh;
+	}
+};
+
+// average cache miss ratio, vertex shader invocations per triangle with a
+// fifo post transform cache. 0.5 is the best a regular grid can do, 3 is
+// no reuse at all.
+inline float averageCacheMissRatio(const u32* indices, u32 indexCount, u32 vertexCount, u32 cacheSize = 16)
+{
+	if (indexCount < 3) {
+		return 0.0f;
+	}
+
+	std::vector<u32> timestamps(vertexCount, 0);
+	u32 time = cacheSize + 1;
+	u32 misses = 0;
+
+	for (u32 i = 0; i < indexCount; i++) {
+		u32 vertex = indices[i];
+		if (time - timestamps[vertex] > cacheSize) {
+			timestamps[vertex] = time++;
+			misses++;
+		}
+	}
+
+	return (float)misses / (indexCount / 3);
+}
+
+// tipsify, Sander et al. 2007. greedy fanning around the most recently
+// cached vertex that still has triangles left, linear in the mesh size.
+// the start of every cluster that had to restart from a cold cache is
+// written to clusters, those are the units optimizeOverdraw reorders.
+inline void optimizeVertexCache(u32* destination, const u32* indices, u32 indexCount, u32 vertexCount, u32 cacheSize = 16, std::vector<u32>* clusters = nullptr)
+{
+	u32 triangleCount = indexCount / 3;
+
+	// vertex -> triangle adjacency, packed
+	std::vector<u32> liveTriangles(vertexCount, 0);
+	for (u32 i = 0; i < indexCount; i++) {
+		liveTriangles[indices[i]]++;
+	}
+
+	std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+	for (u32 v = 0; v < vertexCount; v++) {
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+	}
+
+	std::vector<u32> adjacency(indexCount);
+	std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (u32 t = 0; t < triangleCount; t++) {
+		for (u32 k = 0; k < 3; k++) {
+			u32 vertex = indices[t * 3 + k];
+			adjacency[fill[vertex]++] = t;
+		}
+	}
+
+	std::vector<u32> timestamps(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<u32> deadEnd;
+	std::vector<u32> candidates;
+	u32 time = cacheSize + 1;
+	u32 cursor = 0;
+	u32 written = 0;
+
+	int fanning = vertexCount ? 0 : -1;
+	if (clusters) {
+		clusters->clear();
+		clusters->push_back(0);
+	}
+
+	while (fanning >= 0) {
+		candidates.clear();
+
+		for (u32 a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++) {
+			u32 triangle = adjacency[a];
+			if (emitted[triangle]) {
+				continue;
+			}
+
+			for (u32 k = 0; k < 3; k++) {
+				u32 vertex = indices[triangle * 3 + k];
+				destination[written++] = vertex;
+				deadEnd.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+				if (time - timestamps[vertex] > cacheSize) {
+					timestamps[vertex] = time++;
+				}
+			}
+			emitted[triangle] = true;
+		}
+
+		// the candidate that stays in the cache while its remaining
+		// triangles get emitted, preferring the oldest such vertex.
+		int best = -1;
+		int bestPriority = -1;
+		for (size_t c = 0; c < candidates.size(); c++) {
+			u32 vertex = candidates[c];
+			if (!liveTriangles[vertex]) {
+				continue;
+			}
+
+			int priority = 0;
+			if (time - timestamps[vertex] + 2 * liveTriangles[vertex] <= cacheSize) {
+				priority = (int)(time - timestamps[vertex]);
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				best = (int)vertex;
+			}
+		}
+
+		// dead end, back off to a recently touched vertex before giving up
+		// on the cache and scanning forward.
+		while (best < 0 && !deadEnd.empty()) {
+			u32 vertex = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[vertex]) {
+				best = (int)vertex;
+			}
+		}
+		while (best < 0 && cursor < vertexCount) {
+			if (liveTriangles[cursor]) {
+				best = (int)cursor;
+				if (clusters && written < indexCount) {
+					clusters->push_back(written);
+				}
+			}
+			cursor++;
+		}
+
+		fanning = best;
+	}
+
+	ASSERT(written == indexCount);
+}
+
+// orders the clusters from optimizeVertexCache so the ones facing away from
+// the mesh center, likely the front most, are drawn first. cheap version of
+// the overdraw pass from the same paper, reordering whole clusters keeps
+// the cache behaviour inside them.
+inline void optimizeOverdraw(u32* indices, u32 indexCount, const u8* vertices, u32 stride, u32 positionOffset, const std::vector<u32>& clusters)
+{
+	if (clusters.size() < 2) {
+		return;
+	}
+
+	struct Cluster
+	{
+		u32 begin, end;
+		float sortKey;
+	};
+
+	float meshCenter[3] = { 0.0f, 0.0f, 0.0f };
+	for (u32 i = 0; i < indexCount; i++) {
+		const float* position = (const float*)(vertices + indices[i] * stride + positionOffset);
+		for (int k = 0; k < 3; k++) {
+			meshCenter[k] += position[k] / indexCount;
+		}
+	}
+
+	std::vector<Cluster> sorted;
+	for (size_t c = 0; c < clusters.size(); c++) {
+		Cluster cluster = {};
+		cluster.begin = clusters[c];
+		cluster.end = c + 1 < clusters.size() ? clusters[c + 1] : indexCount;
+
+		float center[3] = { 0.0f, 0.0f, 0.0f };
+		float normal[3] = { 0.0f, 0.0f, 0.0f };
+		for (u32 t = cluster.begin; t < cluster.end; t += 3) {
+			const float* p0 = (const float*)(vertices + indices[t + 0] * stride + positionOffset);
+			const float* p1 = (const float*)(vertices + indices[t + 1] * stride + positionOffset);
+			const float* p2 = (const float*)(vertices + indices[t + 2] * stride + positionOffset);
+
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			// area weighted, the cross product length is twice the area
+			float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0]
+			};
+
+			for (int k = 0; k < 3; k++) {
+				normal[k] += n[k];
+				center[k] += (p0[k] + p1[k] + p2[k]) / (cluster.end - cluster.begin);
+			}
+		}
+
+		cluster.sortKey = 0.0f;
+		for (int k = 0; k < 3; k++) {
+			cluster.sortKey += (center[k] - meshCenter[k]) * normal[k];
+		}
+		sorted.push_back(cluster);
+	}
+
+	std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) {
+		return a.sortKey > b.sortKey;
+	});
+
+	std::vector<u32> source(indices, indices + indexCount);
+	u32 written = 0;
+	for (size_t c = 0; c < sorted.size(); c++) {
+		for (u32 i = sorted[c].begin; i < sorted[c].end; i++) {
+			indices[written++] = source[i];
+		}
+	}
+}
+
+// renumbers the vertices in the order the indices first touch them so the
+// vertex fetch walks memory forward. unreferenced vertices are dropped,
+// returns the new vertex count.
+inline u32 optimizeVertexFetch(MeshData& mesh)
+{
+	const u32 unused = ~0u;
+	std::vector<u32> remap(mesh.vertexCount, unused);
+	std::vector<u8> vertices(mesh.vertices.size());
+	u32 next = 0;
+
+	for (size_t i = 0; i < mesh.indices.size(); i++) {
+		u32& index = mesh.indices[i];
+		if (remap[index] == unused) {
+			memcpy(&vertices[next * mesh.stride], &mesh.vertices[index * mesh.stride], mesh.stride);
+			remap[index] = next++;
+		}
+		index = remap[index];
+	}
+
+	vertices.resize(next * mesh.stride);
+	mesh.vertices.swap(vertices);
+	mesh.vertexCount = next;
+	return next;
+}
+
+// the whole stage: cache order, then overdraw order of the resulting
+// clusters, then fetch order. positionOffset is the byte offset of a float3
+// position inside a vertex.
+inline void optimizeMesh(MeshData& mesh, u32 positionOffset, const char* name = nullptr)
+{
+	u32 indexCount = (u32)mesh.indices.size();
+	float acmrBefore = averageCacheMissRatio(mesh.indices.data(), indexCount, mesh.vertexCount);
+
+	std::vector<u32> clusters;
+	std::vector<u32> optimized(indexCount);
+	optimizeVertexCache(optimized.data(), mesh.indices.data(), indexCount, mesh.vertexCount, 16, &clusters);
+	optimizeOverdraw(optimized.data(), indexCount, mesh.vertices.data(), mesh.stride, positionOffset, clusters);
+	mesh.indices.swap(optimized);
+	optimizeVertexFetch(mesh);
+
+	float acmrAfter = averageCacheMissRatio(mesh.indices.data(), indexCount, mesh.vertexCount);
+	if (name) {
+		printf("%s: %u triangles, acmr %.3f -> %.3f, %u clusters, %s indices\n", name, indexCount / 3, acmrBefore, acmrAfter,
+			(u32)clusters.size(), mesh.vertexCount <= 0x10000 ? "16 bit" : "32 bit");
+	}
+}
+
+// indices are relative to baseVertex, so this is per mesh.
+inline u32 indexTypeFor(u32 vertexCount)
+{
+	return vertexCount <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glfw/glfw3.h>
+
+#include <vector>
+
+#include "common.h"
+#include "glCounters.h"
+#include "meshArena.h"
+
+// layout mandated by GL_DRAW_INDIRECT_BUFFER, see the
+// glMultiDrawElementsIndirect spec.
+struct DrawElementsIndirectCommand
+{
+	u32 count;
+	u32 instanceCount;
+	u32 firstIndex;
+	int baseVertex;
+	u32 baseInstance;
+};
+
+// a list of indexed meshes from one MeshArena, each one becomes an indirect
+// command. the whole list is then a single glMultiDrawElementsIndirect call
+// on 4.3 contexts, or a tight loop over glDrawElementsInstancedBaseVertex on
+// 3.3 with no state changes in between.
+struct MultiDraw
+{
+	MeshArena* arena;
+	u32 indirectBuffer;
+
+	std::vector<Mesh> meshes;
+	std::vector<DrawElementsIndirectCommand> commands;
+
+	PFNGLMULTIDRAWELEMENTSINDIRECTPROC multiDrawElementsIndirect;
+
+	MultiDraw(MeshArena* arena)
+	{
+		this->arena = arena;
+		this->indirectBuffer = 0;
+		this->multiDrawElementsIndirect = nullptr;
+	}
+
+	// returns the index of the command drawing this mesh.
+	u32 add(Mesh mesh, u32 instanceCount = 1)
+	{
+		DrawElementsIndirectCommand command = {};
+		command.instanceCount = instanceCount;
+
+		this->meshes.push_back(mesh);
+		this->commands.push_back(command);
+		return (u32)this->commands.size() - 1;
+	}
+
+	void upload()
+	{
+		if (hasGLVersion(4, 3) || hasGLExtension("GL_ARB_multi_draw_indirect")) {
+			this->multiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)glfwGetProcAddress("glMultiDrawElementsIndirect");
+		}
+
+		if (this->multiDrawElementsIndirect) {
+			glGenBuffers(1, &this->indirectBuffer);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirectBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, this->commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		}
+
+		this->updateCommands();
+	}
+
+	// refresh the commands from the arena, needed after the arena grew or
+	// was defragmented, or after instance counts were edited.
+	void updateCommands()
+	{
+		for (size_t i = 0; i < this->commands.size(); i++) {
+			const MeshSlot& slot = this->arena->get(this->meshes[i]);
+			DrawElementsIndirectCommand& command = this->commands[i];
+			command.count = slot.indexCount;
+			command.firstIndex = slot.firstIndex;
+			command.baseVertex = (int)slot.baseVertex;
+		}
+
+		if (!this->indirectBuffer) {
+			return;
+		}
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirectBuffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, this->commands.size() * sizeof(DrawElementsIndirectCommand), this->commands.data());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	void draw()
+	{
+		this->arena->bind();
+
+		if (this->multiDrawElementsIndirect) {
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirectBuffer);
+			countGLDraw();
+			this->multiDrawElementsIndirect(GL_TRIANGLES, this->arena->indexType, nullptr, (GLsizei)this->commands.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			return;
+		}
+
+		// 3.3 fallback, baseInstance needs 4.2 so it is ignored here.
+		for (size_t i = 0; i < this->commands.size(); i++) {
+			const DrawElementsIndirectCommand& command = this->commands[i];
+			if (!command.count || !command.instanceCount) {
+				continue;
+			}
+
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, this->arena->indexType, (void*)(size_t)(command.firstIndex * this->arena->indexSize), command.instanceCount, command.baseVertex);
+		}
+	}
+
+	void destroy()
+	{
+		glDeleteBuffers(1, &this->indirectBuffer);
+		this->indirectBuffer = 0;
+	}
+};
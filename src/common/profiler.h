@@ -0,0 +1,293 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "common.h"
+#include "trace.h"
+
+// frames of history kept per scope for the percentiles and the csv.
+const int PROFILE_HISTORY = 240;
+// gpu queries are read back this many frames after they were issued, by
+// then the gpu is done with them and reading does not stall.
+const int PROFILE_GPU_LATENCY = 2;
+
+struct ProfileSeries
+{
+	const char* name;
+	bool gpu;
+	// milliseconds per frame, a scope that runs several times in a frame
+	// is summed. negative means no sample that frame.
+	double history[PROFILE_HISTORY];
+	double frameTotal;
+	u64 frames;
+	double sum, min, max;
+};
+
+struct GpuQuery
+{
+	u32 id;
+	int series;
+};
+
+struct Profiler
+{
+	std::vector<ProfileSeries> series;
+	u64 frame;
+	double frameStart;
+
+	std::vector<u32> freeQueries;
+	std::vector<GpuQuery> pending[PROFILE_GPU_LATENCY + 1];
+	// GL_TIME_ELAPSED queries cannot nest
+	bool gpuScopeOpen;
+
+	Profiler()
+	{
+		this->frame = 0;
+		this->frameStart = 0.0;
+		this->gpuScopeOpen = false;
+	}
+
+	int find(const char* name, bool gpu)
+	{
+		for (size_t i = 0; i < this->series.size(); i++) {
+			if (this->series[i].gpu == gpu && strcmp(this->series[i].name, name) == 0) {
+				return (int)i;
+			}
+		}
+
+		ProfileSeries series = {};
+		series.name = name;
+		series.gpu = gpu;
+		for (int i = 0; i < PROFILE_HISTORY; i++) {
+			series.history[i] = -1.0;
+		}
+		series.frameTotal = -1.0;
+		this->series.push_back(series);
+		return (int)this->series.size() - 1;
+	}
+
+	void addSample(int index, double ms)
+	{
+		ProfileSeries& series = this->series[index];
+		series.frameTotal = series.frameTotal < 0.0 ? ms : series.frameTotal + ms;
+	}
+
+	// moves the per frame totals of the given kind into the history of frame.
+	void commit(u64 frame, bool gpu)
+	{
+		for (size_t i = 0; i < this->series.size(); i++) {
+			ProfileSeries& series = this->series[i];
+			if (series.gpu != gpu || series.frameTotal < 0.0) {
+				continue;
+			}
+
+			double ms = series.frameTotal;
+			series.history[frame % PROFILE_HISTORY] = ms;
+			series.min = series.frames ? std::min(series.min, ms) : ms;
+			series.max = series.frames ? std::max(series.max, ms) : ms;
+			series.sum += ms;
+			series.frames++;
+			series.frameTotal = -1.0;
+		}
+	}
+
+	void resolveGpu(u64 frame)
+	{
+		std::vector<GpuQuery>& queries = this->pending[frame % (PROFILE_GPU_LATENCY + 1)];
+		if (queries.empty()) {
+			return;
+		}
+
+		for (size_t i = 0; i < queries.size(); i++) {
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(queries[i].id, GL_QUERY_RESULT, &nanoseconds);
+			this->addSample(queries[i].series, nanoseconds / 1.0e6);
+			this->freeQueries.push_back(queries[i].id);
+		}
+		queries.clear();
+
+		this->commit(frame, true);
+	}
+
+	void beginFrame()
+	{
+		this->frameStart = timeNow();
+	}
+
+	void endFrame()
+	{
+		double end = timeNow();
+		this->addSample(this->find("frame", false), (end - this->frameStart) * 1000.0);
+		traceComplete("frame", "frame", this->frameStart, end);
+		this->commit(this->frame, false);
+
+		if (this->frame >= PROFILE_GPU_LATENCY) {
+			this->resolveGpu(this->frame - PROFILE_GPU_LATENCY);
+		}
+		this->frame++;
+	}
+
+	void beginGpu(const char* name)
+	{
+		ASSERT(!this->gpuScopeOpen);
+		this->gpuScopeOpen = true;
+
+		GpuQuery query = {};
+		query.series = this->find(name, true);
+		if (!this->freeQueries.empty()) {
+			query.id = this->freeQueries.back();
+			this->freeQueries.pop_back();
+		}
+		else {
+			glGenQueries(1, &query.id);
+		}
+
+		this->pending[this->frame % (PROFILE_GPU_LATENCY + 1)].push_back(query);
+		glBeginQuery(GL_TIME_ELAPSED, query.id);
+	}
+
+	void endGpu()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		this->gpuScopeOpen = false;
+	}
+
+	static double percentile(std::vector<double>& values, double p)
+	{
+		if (values.empty()) {
+			return 0.0;
+		}
+		size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+		std::nth_element(values.begin(), values.begin() + index, values.end());
+		return values[index];
+	}
+
+	void printSummary()
+	{
+		if (!this->frame) {
+			return;
+		}
+
+		printf("profile over %llu frames, percentiles over the last %i:\n", (unsigned long long)this->frame, PROFILE_HISTORY);
+		printf("    %-20s %4s %9s %9s %9s %9s %9s\n", "scope", "", "avg ms", "min ms", "p50 ms", "p95 ms", "max ms");
+		for (size_t i = 0; i < this->series.size(); i++) {
+			ProfileSeries& series = this->series[i];
+			if (!series.frames) {
+				continue;
+			}
+
+			std::vector<double> values;
+			for (int f = 0; f < PROFILE_HISTORY; f++) {
+				if (series.history[f] >= 0.0) {
+					values.push_back(series.history[f]);
+				}
+			}
+
+			printf("    %-20s %4s %9.3f %9.3f %9.3f %9.3f %9.3f\n", series.name, series.gpu ? "gpu" : "cpu",
+				series.sum / series.frames, series.min, percentile(values, 0.5), percentile(values, 0.95), series.max);
+		}
+	}
+
+	// one row per frame of history, one column per scope.
+	bool writeCsv(const char* path)
+	{
+		FILE* file = fopen(path, "w");
+		if (!file) {
+			printf("Failed to open %s for writing\n", path);
+			return false;
+		}
+
+		fprintf(file, "frame");
+		for (size_t i = 0; i < this->series.size(); i++) {
+			fprintf(file, ",%s %s ms", this->series[i].name, this->series[i].gpu ? "gpu" : "cpu");
+		}
+		fprintf(file, "\n");
+
+		u64 first = this->frame > PROFILE_HISTORY ? this->frame - PROFILE_HISTORY : 0;
+		for (u64 f = first; f < this->frame; f++) {
+			fprintf(file, "%llu", (unsigned long long)f);
+			for (size_t i = 0; i < this->series.size(); i++) {
+				double ms = this->series[i].history[f % PROFILE_HISTORY];
+				if (ms >= 0.0) {
+					fprintf(file, ",%.4f", ms);
+				}
+				else {
+					fprintf(file, ",");
+				}
+			}
+			fprintf(file, "\n");
+		}
+
+		fclose(file);
+		return true;
+	}
+
+	// reads back whatever is still in flight, needs the context alive.
+	void shutdown(const char* csvPath)
+	{
+		u64 first = this->frame > PROFILE_GPU_LATENCY ? this->frame - PROFILE_GPU_LATENCY : 0;
+		for (u64 f = first; f < this->frame; f++) {
+			this->resolveGpu(f);
+		}
+
+		this->printSummary();
+		if (csvPath) {
+			this->writeCsv(csvPath);
+		}
+
+		if (!this->freeQueries.empty()) {
+			glDeleteQueries((GLsizei)this->freeQueries.size(), this->freeQueries.data());
+			this->freeQueries.clear();
+		}
+	}
+};
+
+inline Profiler& profiler()
+{
+	static Profiler instance;
+	return instance;
+}
+
+struct CpuProfileScope
+{
+	int series;
+	double start;
+
+	CpuProfileScope(const char* name)
+	{
+		this->series = profiler().find(name, false);
+		this->start = timeNow();
+	}
+
+	~CpuProfileScope()
+	{
+		double end = timeNow();
+		profiler().addSample(this->series, (end - this->start) * 1000.0);
+		// cpu scopes show up on the trace timeline as well
+		traceComplete(profiler().series[this->series].name, "profile", this->start, end);
+	}
+};
+
+struct GpuProfileScope
+{
+	GpuProfileScope(const char* name)
+	{
+		profiler().beginGpu(name);
+	}
+
+	~GpuProfileScope()
+	{
+		profiler().endGpu();
+	}
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// name must outlive the profiler, string literals in practice.
+#define PROFILE_CPU(name) CpuProfileScope PROFILE_CONCAT(cpuProfileScope, __LINE__)(name)
+#define PROFILE_GPU(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "trace.h"
+
+// fixed set of worker threads running submitted tasks in order.
+struct ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	int active;
+	bool stopping;
+
+	ThreadPool(int count)
+	{
+		this->active = 0;
+		this->stopping = false;
+
+		count = count > 0 ? count : 1;
+		for (int i = 0; i < count; i++) {
+			this->workers.push_back(std::thread([this, i]() { this->run(i); }));
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+		}
+		this->wake.notify_all();
+		for (std::thread& worker : this->workers) {
+			worker.join();
+		}
+	}
+
+	int size() const
+	{
+		return (int)this->workers.size();
+	}
+
+	void run(int index)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "worker %i", index);
+		traceThreadName(name);
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+		for (;;) {
+			this->wake.wait(lock, [this]() { return this->stopping || !this->tasks.empty(); });
+			if (this->tasks.empty()) {
+				return;
+			}
+
+			std::function<void()> task = std::move(this->tasks.front());
+			this->tasks.pop_front();
+			this->active++;
+
+			lock.unlock();
+			task();
+			lock.lock();
+
+			this->active--;
+			if (this->tasks.empty() && !this->active) {
+				this->idle.notify_all();
+			}
+		}
+	}
+
+	void submit(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->tasks.push_back(std::move(task));
+		}
+		this->wake.notify_one();
+	}
+
+	// blocks until every submitted task, and whatever they submitted, ran.
+	// not callable from a worker.
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->idle.wait(lock, [this]() { return this->tasks.empty() && !this->active; });
+	}
+
+	// calls fn(i) for every i in [0, count). the calling thread works too
+	// and only waits for items other threads already started, so this is
+	// safe to call from inside a task.
+	void parallelFor(int count, const std::function<void(int)>& fn)
+	{
+		if (count <= 0) {
+			return;
+		}
+
+		struct Shared
+		{
+			std::atomic<int> next;
+			std::atomic<int> done;
+			int count;
+			std::function<void(int)> fn;
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+
+		std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+		shared->next = 0;
+		shared->done = 0;
+		shared->count = count;
+		shared->fn = fn;
+
+		auto work = [shared]() {
+			for (;;) {
+				int i = shared->next++;
+				if (i >= shared->count) {
+					return;
+				}
+				shared->fn(i);
+				if (++shared->done == shared->count) {
+					std::lock_guard<std::mutex> lock(shared->mutex);
+					shared->finished.notify_all();
+				}
+			}
+		};
+
+		int helpers = std::min(count - 1, this->size());
+		for (int i = 0; i < helpers; i++) {
+			this->submit(work);
+		}
+		work();
+
+		std::unique_lock<std::mutex> lock(shared->mutex);
+		shared->finished.wait(lock, [&shared]() { return shared->done == shared->count; });
+	}
+};
+
+// one pool for the whole process, sized to the machine.
+inline ThreadPool& threadPool()
+{
+	static ThreadPool pool((int)std::thread::hardware_concurrency());
+	return pool;
+}
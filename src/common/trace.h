@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// chrome trace event format, open the file in chrome://tracing or
+// ui.perfetto.dev. only complete ("X"), instant ("i") and thread name
+// metadata ("M") events are written.
+struct TraceEvent
+{
+	const char* name;
+	const char* category;
+	char phase;
+	u32 thread;
+	double start;
+	double duration;
+	std::string detail;
+};
+
+struct Tracer
+{
+	bool enabled;
+	const char* path;
+	double origin;
+	std::mutex mutex;
+	std::vector<TraceEvent> events;
+	u32 nextThread;
+
+	Tracer()
+	{
+		this->enabled = false;
+		this->path = nullptr;
+		this->origin = 0.0;
+		this->nextThread = 0;
+	}
+
+	// small stable ids in order of first use, the main thread is usually 0.
+	u32 threadId()
+	{
+		static thread_local u32 id = ~0u;
+		if (id == ~0u) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			id = this->nextThread++;
+		}
+		return id;
+	}
+
+	void add(const char* name, const char* category, char phase, double start, double duration, const char* detail)
+	{
+		if (!this->enabled) {
+			return;
+		}
+
+		TraceEvent event;
+		event.name = name;
+		event.category = category;
+		event.phase = phase;
+		event.thread = this->threadId();
+		event.start = start;
+		event.duration = duration;
+		if (detail) {
+			event.detail = detail;
+		}
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->events.push_back(event);
+	}
+
+	static void writeString(FILE* file, const char* text)
+	{
+		fputc('"', file);
+		for (const char* c = text; *c; c++) {
+			if (*c == '"' || *c == '\\') {
+				fputc('\\', file);
+				fputc(*c, file);
+			}
+			else if ((unsigned char)*c < 0x20) {
+				fprintf(file, "\\u%04x", *c);
+			}
+			else {
+				fputc(*c, file);
+			}
+		}
+		fputc('"', file);
+	}
+
+	bool write()
+	{
+		FILE* file = fopen(this->path, "w");
+		if (!file) {
+			printf("Failed to open %s for writing\n", this->path);
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		for (size_t i = 0; i < this->events.size(); i++) {
+			const TraceEvent& event = this->events[i];
+			fprintf(file, "%s{\"name\":", i ? ",\n" : "");
+			writeString(file, event.name);
+
+			if (event.phase == 'M') {
+				fprintf(file, ",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":", event.thread);
+				writeString(file, event.detail.c_str());
+				fprintf(file, "}}");
+				continue;
+			}
+
+			fprintf(file, ",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":0,\"tid\":%u,\"ts\":%.3f", event.category, event.phase, event.thread, (event.start - this->origin) * 1.0e6);
+			if (event.phase == 'X') {
+				fprintf(file, ",\"dur\":%.3f", event.duration * 1.0e6);
+			}
+			else if (event.phase == 'i') {
+				fprintf(file, ",\"s\":\"t\"");
+			}
+			if (!event.detail.empty()) {
+				fprintf(file, ",\"args\":{\"detail\":");
+				writeString(file, event.detail.c_str());
+				fprintf(file, "}");
+			}
+			fprintf(file, "}");
+		}
+		fprintf(file, "\n]}\n");
+		fclose(file);
+
+		printf("wrote %u trace events to %s\n", (u32)this->events.size(), this->path);
+		return true;
+	}
+};
+
+inline Tracer& tracer()
+{
+	static Tracer instance;
+	return instance;
+}
+
+inline void startTrace(const char* path)
+{
+	Tracer& trace = tracer();
+	trace.path = path;
+	trace.origin = timeNow();
+	trace.enabled = true;
+}
+
+inline void stopTrace()
+{
+	Tracer& trace = tracer();
+	if (!trace.enabled) {
+		return;
+	}
+
+	trace.enabled = false;
+	trace.write();
+	trace.events.clear();
+}
+
+// names the calling thread in the viewer.
+inline void traceThreadName(const char* name)
+{
+	tracer().add("thread_name", "", 'M', 0.0, 0.0, name);
+}
+
+inline void traceInstant(const char* name, const char* category = "event")
+{
+	tracer().add(name, category, 'i', timeNow(), 0.0, nullptr);
+}
+
+inline void traceComplete(const char* name, const char* category, double start, double end, const char* detail = nullptr)
+{
+	tracer().add(name, category, 'X', start, end - start, detail);
+}
+
+struct TraceScope
+{
+	const char* name;
+	const char* category;
+	// copied, so a temporary c_str() can be passed. only when tracing
+	std::string detail;
+	double start;
+
+	// name and category must be string literals, detail is copied.
+	TraceScope(const char* name, const char* category, const char* detail = nullptr)
+	{
+		this->name = name;
+		this->category = category;
+		this->start = 0.0;
+		if (tracer().enabled) {
+			this->detail = detail ? detail : "";
+			this->start = timeNow();
+		}
+	}
+
+	~TraceScope()
+	{
+		if (tracer().enabled) {
+			traceComplete(this->name, this->category, this->start, timeNow(), this->detail.empty() ? nullptr : this->detail.c_str());
+		}
+	}
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name, category) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, category)
+#define TRACE_SCOPE_DETAIL(name, category, detail) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, category, detail)
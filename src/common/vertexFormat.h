@@ -0,0 +1,354 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "common.h"
+
+struct VertexAttribute
+{
+	u32 location;
+	int components;
+	u32 type;
+	bool normalized;
+	u32 offset;
+};
+
+struct VertexFormat
+{
+	u32 stride;
+	std::vector<VertexAttribute> attributes;
+
+	VertexFormat& add(u32 location, int components, u32 type, bool normalized, u32 offset)
+	{
+		VertexAttribute attribute = { location, components, type, normalized, offset };
+		this->attributes.push_back(attribute);
+		return *this;
+	}
+
+	// the float only layouts the demos use, eg floats(3, 2) for
+	// position + texcoord at locations 0 and 1. a 0 skips a location.
+	static VertexFormat floats(int c0, int c1 = 0, int c2 = 0, int c3 = 0)
+	{
+		int components[] = { c0, c1, c2, c3 };
+		VertexFormat format = {};
+		u32 offset = 0;
+		for (u32 i = 0; i < 4; i++) {
+			if (components[i]) {
+				format.add(i, components[i], GL_FLOAT, false, offset);
+				offset += components[i] * sizeof(float);
+			}
+		}
+		format.stride = offset;
+		return format;
+	}
+
+	void apply() const
+	{
+		for (size_t i = 0; i < this->attributes.size(); i++) {
+			const VertexAttribute& attribute = this->attributes[i];
+			glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized,
+				this->stride, (void*)(size_t)attribute.offset);
+			glEnableVertexAttribArray(attribute.location);
+		}
+	}
+};
+
+inline u16 floatToHalf(float value)
+{
+	u32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	u32 sign = (bits >> 16) & 0x8000;
+	u32 floatExponent = (bits >> 23) & 0xff;
+	u32 mantissa = bits & 0x7fffff;
+	int exponent = (int)floatExponent - 127 + 15;
+
+	if (floatExponent == 0xff) {
+		// inf and nan
+		return (u16)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	}
+	if (exponent >= 31) {
+		return (u16)(sign | 0x7c00);
+	}
+
+	if (exponent <= 0) {
+		// denormal, or zero when even the top bit would be shifted out
+		if (exponent < -10) {
+			return (u16)sign;
+		}
+		mantissa |= 0x800000;
+		u32 shift = (u32)(14 - exponent);
+		u32 half = mantissa >> shift;
+		u32 remainder = mantissa & ((1u << shift) - 1);
+		u32 halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) {
+			half++;
+		}
+		return (u16)(sign | half);
+	}
+
+	// round to nearest even, a carry out of the mantissa bumps the exponent
+	// which is exactly what we want.
+	u32 half = ((u32)exponent << 10) | (mantissa >> 13);
+	u32 remainder = mantissa & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+		half++;
+	}
+	return (u16)(sign | half);
+}
+
+inline float halfToFloat(u16 value)
+{
+	u32 sign = (u32)(value & 0x8000) << 16;
+	u32 exponent = (value >> 10) & 0x1f;
+	u32 mantissa = value & 0x3ff;
+
+	if (exponent == 0) {
+		float denormal = (float)ldexp((double)mantissa, -24);
+		return sign ? -denormal : denormal;
+	}
+
+	u32 bits = sign | (mantissa << 13);
+	if (exponent == 31) {
+		bits |= 0x7f800000;
+	}
+	else {
+		bits |= (exponent + 112) << 23;
+	}
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+// attribute locations the linker kept for a program, anything else in a
+// vertex layout is fetched for nothing.
+inline std::vector<u32> activeAttributeLocations(u32 program)
+{
+	std::vector<u32> locations;
+
+	int count = 0;
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+	for (int i = 0; i < count; i++) {
+		char name[256];
+		int size = 0;
+		u32 type = 0;
+		glGetActiveAttrib(program, i, sizeof(name), nullptr, &size, &type, name);
+
+		// builtins like gl_VertexID report -1
+		int location = glGetAttribLocation(program, name);
+		if (location >= 0) {
+			locations.push_back((u32)location);
+		}
+	}
+
+	return locations;
+}
+
+enum VertexEncoding
+{
+	VERTEX_UNORM8,
+	VERTEX_UNORM16,
+	VERTEX_HALF,
+	VERTEX_FLOAT,
+	VERTEX_ENCODING_COUNT
+};
+
+struct VertexEncodingInfo
+{
+	u32 type;
+	bool normalized;
+	u32 size;
+	const char* name;
+};
+
+inline VertexEncodingInfo vertexEncodingInfo(VertexEncoding encoding)
+{
+	// snorm is left out on purpose, 3.3 maps signed normalized values with
+	// (2c + 1) / (2^b - 1) which cannot represent 0 exactly. signed data goes
+	// through half floats instead.
+	static const VertexEncodingInfo infos[VERTEX_ENCODING_COUNT] = {
+		{ GL_UNSIGNED_BYTE, true, 1, "unorm8" },
+		{ GL_UNSIGNED_SHORT, true, 2, "unorm16" },
+		{ GL_HALF_FLOAT, false, 2, "half" },
+		{ GL_FLOAT, false, 4, "float" },
+	};
+	return infos[encoding];
+}
+
+inline void encodeVertexValue(VertexEncoding encoding, float value, u8* dest)
+{
+	switch (encoding) {
+		case VERTEX_UNORM8: {
+			*dest = (u8)floorf(value * 255.0f + 0.5f);
+		} break;
+		case VERTEX_UNORM16: {
+			u16 encoded = (u16)floorf(value * 65535.0f + 0.5f);
+			memcpy(dest, &encoded, sizeof(encoded));
+		} break;
+		case VERTEX_HALF: {
+			u16 encoded = floatToHalf(value);
+			memcpy(dest, &encoded, sizeof(encoded));
+		} break;
+		default: {
+			memcpy(dest, &value, sizeof(value));
+		} break;
+	}
+}
+
+inline float decodeVertexValue(VertexEncoding encoding, const u8* source)
+{
+	switch (encoding) {
+		case VERTEX_UNORM8: {
+			return *source / 255.0f;
+		}
+		case VERTEX_UNORM16: {
+			u16 encoded;
+			memcpy(&encoded, source, sizeof(encoded));
+			return encoded / 65535.0f;
+		}
+		case VERTEX_HALF: {
+			u16 encoded;
+			memcpy(&encoded, source, sizeof(encoded));
+			return halfToFloat(encoded);
+		}
+		default: {
+			float value;
+			memcpy(&value, source, sizeof(value));
+			return value;
+		}
+	}
+}
+
+struct PackedVertices
+{
+	VertexFormat format;
+	std::vector<u8> data;
+	u32 vertexCount;
+	u32 sourceStride;
+	u32 strippedAttributes;
+
+	void print(const char* name) const
+	{
+		printf("%s: vertex stride %u -> %u bytes, %u unused attributes stripped\n", name, this->sourceStride, this->format.stride, this->strippedAttributes);
+		for (size_t i = 0; i < this->format.attributes.size(); i++) {
+			const VertexAttribute& attribute = this->format.attributes[i];
+			printf("    location %u: %i x 0x%x at offset %u\n", attribute.location, attribute.components, attribute.type, attribute.offset);
+		}
+	}
+};
+
+// repacks an all float vertex layout. attributes the program does not read
+// are dropped, every other attribute gets the smallest encoding that
+// reproduces all of its values within tolerance, and the attributes are
+// laid out biggest first on 4 byte boundaries. pass program 0 to keep
+// every attribute.
+inline PackedVertices packVertices(const VertexFormat& source, const void* vertices, u32 vertexCount, u32 program, float tolerance = 1.0f / 4096.0f)
+{
+	PackedVertices packed = {};
+	packed.vertexCount = vertexCount;
+	packed.sourceStride = source.stride;
+
+	std::vector<u32> active;
+	if (program) {
+		active = activeAttributeLocations(program);
+	}
+
+	const u8* sourceBytes = (const u8*)vertices;
+	std::vector<VertexAttribute> kept;
+	std::vector<VertexEncoding> encodings;
+	std::vector<u32> slotSizes;
+
+	for (size_t i = 0; i < source.attributes.size(); i++) {
+		const VertexAttribute& attribute = source.attributes[i];
+		ASSERT(attribute.type == GL_FLOAT);
+
+		if (program && std::find(active.begin(), active.end(), attribute.location) == active.end()) {
+			packed.strippedAttributes++;
+			continue;
+		}
+
+		float minValue = 0.0f;
+		float maxValue = 0.0f;
+		for (u32 v = 0; v < vertexCount; v++) {
+			const float* values = (const float*)(sourceBytes + v * source.stride + attribute.offset);
+			for (int c = 0; c < attribute.components; c++) {
+				if ((v == 0 && c == 0) || values[c] < minValue) {
+					minValue = values[c];
+				}
+				if ((v == 0 && c == 0) || values[c] > maxValue) {
+					maxValue = values[c];
+				}
+			}
+		}
+
+		// smallest first, the first one that round trips wins
+		VertexEncoding encoding = VERTEX_FLOAT;
+		for (int e = 0; e < VERTEX_FLOAT; e++) {
+			VertexEncoding candidate = (VertexEncoding)e;
+			bool normalized = vertexEncodingInfo(candidate).normalized;
+			if (normalized && (minValue < 0.0f || maxValue > 1.0f)) {
+				continue;
+			}
+
+			bool fits = true;
+			for (u32 v = 0; v < vertexCount && fits; v++) {
+				const float* values = (const float*)(sourceBytes + v * source.stride + attribute.offset);
+				for (int c = 0; c < attribute.components && fits; c++) {
+					u8 encoded[4];
+					encodeVertexValue(candidate, values[c], encoded);
+					fits = fabsf(decodeVertexValue(candidate, encoded) - values[c]) <= tolerance;
+				}
+			}
+
+			if (fits) {
+				encoding = candidate;
+				break;
+			}
+		}
+
+		kept.push_back(attribute);
+		encodings.push_back(encoding);
+		slotSizes.push_back((vertexEncodingInfo(encoding).size * attribute.components + 3) & ~3u);
+	}
+
+	// biggest slots first, keeps every attribute naturally aligned
+	std::vector<u32> order;
+	for (u32 i = 0; i < kept.size(); i++) {
+		order.push_back(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [&slotSizes](u32 a, u32 b) {
+		return slotSizes[a] > slotSizes[b];
+	});
+
+	u32 offset = 0;
+	std::vector<u32> offsets(kept.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		u32 index = order[i];
+		VertexEncodingInfo info = vertexEncodingInfo(encodings[index]);
+		packed.format.add(kept[index].location, kept[index].components, info.type, info.normalized, offset);
+		offsets[index] = offset;
+		offset += slotSizes[index];
+	}
+	packed.format.stride = offset;
+
+	packed.data.resize((size_t)packed.format.stride * vertexCount);
+	for (u32 v = 0; v < vertexCount; v++) {
+		u8* dest = packed.data.data() + (size_t)v * packed.format.stride;
+		for (size_t i = 0; i < kept.size(); i++) {
+			const float* values = (const float*)(sourceBytes + v * source.stride + kept[i].offset);
+			u32 size = vertexEncodingInfo(encodings[i]).size;
+			for (int c = 0; c < kept[i].components; c++) {
+				encodeVertexValue(encodings[i], values[c], dest + offsets[i] + c * size);
+			}
+		}
+	}
+
+	return packed;
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <functional>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "convolve.h"
+#include "image.h"
+
+// blurs whose cost per pixel does not depend on the radius. box blurs keep
+// a running sum of the window, the gaussian is either three stacked boxes or
+// the young - van vliet recursive filter. rows are filtered one pixel (all
+// channels) at a time, columns 16 floats side by side, so both directions
+// run on sse2 vectors.
+
+#ifdef IMAGE_SSE2
+typedef __m128 Lanes;
+inline Lanes lanesLoad(const float* p) { return _mm_loadu_ps(p); }
+inline void lanesStore(float* p, Lanes a) { _mm_storeu_ps(p, a); }
+inline Lanes lanesSet(float value) { return _mm_set1_ps(value); }
+inline Lanes lanesAdd(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline Lanes lanesSub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+inline Lanes lanesMul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+#else
+struct Lanes
+{
+	float v[4];
+};
+inline Lanes lanesLoad(const float* p) { Lanes a; memcpy(a.v, p, sizeof(a.v)); return a; }
+inline void lanesStore(float* p, Lanes a) { memcpy(p, a.v, sizeof(a.v)); }
+inline Lanes lanesSet(float value) { Lanes a = { { value, value, value, value } }; return a; }
+inline Lanes lanesAdd(Lanes a, Lanes b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+inline Lanes lanesSub(Lanes a, Lanes b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+inline Lanes lanesMul(Lanes a, Lanes b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+#endif
+
+// floats of a column chunk, the vertical passes keep 4 vectors per row
+const int BLUR_COLUMN_FLOATS = 16;
+// rows per task of the horizontal passes
+const int BLUR_BAND_ROWS = 16;
+
+// fn(begin, end) over [0, count) in pieces of grain, spread over the pool.
+inline void blurParallel(int count, int grain, ThreadPool* pool, const std::function<void(int, int)>& fn)
+{
+	int pieces = (count + grain - 1) / grain;
+	auto piece = [&](int i) {
+		int end = (i + 1) * grain < count ? (i + 1) * grain : count;
+		fn(i * grain, end);
+	};
+
+	if (pool) {
+		pool->parallelFor(pieces, piece);
+	}
+	else {
+		for (int i = 0; i < pieces; i++) {
+			piece(i);
+		}
+	}
+}
+
+// a row as one 4 float vector per pixel, missing channels are 0.
+inline void rowToLanes(const float* row, int width, int channels, float* lanes)
+{
+	if (channels == 4) {
+		memcpy(lanes, row, sizeof(float) * 4 * width);
+		return;
+	}
+	memset(lanes, 0, sizeof(float) * 4 * width);
+	for (int x = 0; x < width; x++) {
+		memcpy(&lanes[x * 4], &row[x * channels], sizeof(float) * channels);
+	}
+}
+
+inline void lanesToRow(const float* lanes, int width, int channels, float* row)
+{
+	if (channels == 4) {
+		memcpy(row, lanes, sizeof(float) * 4 * width);
+		return;
+	}
+	for (int x = 0; x < width; x++) {
+		memcpy(&row[x * channels], &lanes[x * 4], sizeof(float) * channels);
+	}
+}
+
+// sliding window sum over one row of pixel vectors.
+inline void boxLanes(const float* source, float* dest, int width, int radius, BorderMode border)
+{
+	Lanes scale = lanesSet(1.0f / (2 * radius + 1));
+	Lanes sum = lanesSet(0.0f);
+	for (int k = -radius; k <= radius; k++) {
+		sum = lanesAdd(sum, lanesLoad(&source[borderIndex(k, width, border) * 4]));
+	}
+
+	for (int x = 0; x < width; x++) {
+		lanesStore(&dest[x * 4], lanesMul(sum, scale));
+		Lanes enter = lanesLoad(&source[borderIndex(x + radius + 1, width, border) * 4]);
+		Lanes leave = lanesLoad(&source[borderIndex(x - radius, width, border) * 4]);
+		sum = lanesAdd(sum, lanesSub(enter, leave));
+	}
+}
+
+// one step of a sliding window over whole rows: dest = sum * scale, then
+// the window moves by adding the entering row and dropping the leaving one.
+inline void slideRow(float* sum, const float* enter, const float* leave, float scale, float* dest, size_t count)
+{
+	size_t i = 0;
+	Lanes scales = lanesSet(scale);
+	for (; i + 4 <= count; i += 4) {
+		Lanes s = lanesLoad(&sum[i]);
+		lanesStore(&dest[i], lanesMul(s, scales));
+		lanesStore(&sum[i], lanesAdd(s, lanesSub(lanesLoad(&enter[i]), lanesLoad(&leave[i]))));
+	}
+	for (; i < count; i++) {
+		dest[i] = sum[i] * scale;
+		sum[i] += enter[i] - leave[i];
+	}
+}
+
+// sliding window sum down BLUR_COLUMN_FLOATS floats starting at column
+// float x0 of every row, or fewer at the right edge.
+inline void boxColumns(const Image& source, Image& dest, int x0, int radius, BorderMode border)
+{
+	size_t pitch = (size_t)source.width * source.channels;
+	int count = (int)pitch - x0 < BLUR_COLUMN_FLOATS ? (int)pitch - x0 : BLUR_COLUMN_FLOATS;
+	int vectors = (count + 3) / 4;
+	float scratch[BLUR_COLUMN_FLOATS];
+
+	// the last partial vector goes through scratch so nothing past the
+	// image is read or written
+	auto load = [&](int y, int v) {
+		const float* p = &source.data[y * pitch + x0 + v * 4];
+		if (v * 4 + 4 <= count) {
+			return lanesLoad(p);
+		}
+		memset(scratch, 0, sizeof(scratch));
+		memcpy(scratch, p, sizeof(float) * (count - v * 4));
+		return lanesLoad(scratch);
+	};
+	auto store = [&](int y, int v, Lanes value) {
+		float* p = &dest.data[y * pitch + x0 + v * 4];
+		if (v * 4 + 4 <= count) {
+			lanesStore(p, value);
+			return;
+		}
+		lanesStore(scratch, value);
+		memcpy(p, scratch, sizeof(float) * (count - v * 4));
+	};
+
+	Lanes scale = lanesSet(1.0f / (2 * radius + 1));
+	Lanes sums[BLUR_COLUMN_FLOATS / 4];
+	for (int v = 0; v < vectors; v++) {
+		sums[v] = lanesSet(0.0f);
+		for (int k = -radius; k <= radius; k++) {
+			sums[v] = lanesAdd(sums[v], load(borderIndex(k, source.height, border), v));
+		}
+	}
+
+	for (int y = 0; y < source.height; y++) {
+		int enter = borderIndex(y + radius + 1, source.height, border);
+		int leave = borderIndex(y - radius, source.height, border);
+		for (int v = 0; v < vectors; v++) {
+			store(y, v, lanesMul(sums[v], scale));
+			sums[v] = lanesAdd(sums[v], lanesSub(load(enter, v), load(leave, v)));
+		}
+	}
+}
+
+// box blur of every channel, returns a new image the caller frees.
+inline Image boxBlurRunning(const Image& source, int radius, BorderMode border, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("boxBlurRunning", "image");
+	int width = source.width;
+	int channels = source.channels;
+	size_t pitch = (size_t)width * channels;
+
+	Image rows = source;
+	rows.data = (float*)malloc(sizeof(float) * pitch * source.height);
+	blurParallel(source.height, BLUR_BAND_ROWS, pool, [&](int begin, int end) {
+		std::vector<float> lanes((size_t)width * 4);
+		std::vector<float> blurred((size_t)width * 4);
+		for (int y = begin; y < end; y++) {
+			rowToLanes(&source.data[y * pitch], width, channels, lanes.data());
+			boxLanes(lanes.data(), blurred.data(), width, radius, border);
+			lanesToRow(blurred.data(), width, channels, &rows.data[y * pitch]);
+		}
+	});
+
+	Image dest = source;
+	dest.data = (float*)malloc(sizeof(float) * pitch * source.height);
+	int chunks = (int)((pitch + BLUR_COLUMN_FLOATS - 1) / BLUR_COLUMN_FLOATS);
+	blurParallel(chunks, 16, pool, [&](int begin, int end) {
+		for (int chunk = begin; chunk < end; chunk++) {
+			boxColumns(rows, dest, chunk * BLUR_COLUMN_FLOATS, radius, border);
+		}
+	});
+
+	free(rows.data);
+	return dest;
+}
+
+// box radii whose three passes add up to a gaussian of sigma, from
+// "fast almost-gaussian filtering", kovesi 2010.
+inline void gaussianBoxRadii(float sigma, int radii[3])
+{
+	float ideal = sqrtf(12.0f * sigma * sigma / 3.0f + 1.0f);
+	int lower = (int)floorf(ideal);
+	lower -= lower % 2 == 0 ? 1 : 0;
+	int upper = lower + 2;
+
+	// how many of the passes use the smaller width
+	float m = (12.0f * sigma * sigma - 3.0f * lower * lower - 12.0f * lower - 9.0f) / (-4.0f * lower - 4.0f);
+	int smaller = (int)roundf(m);
+	for (int i = 0; i < 3; i++) {
+		radii[i] = ((i < smaller ? lower : upper) - 1) / 2;
+	}
+}
+
+inline Image gaussianBlurBoxes(const Image& source, float sigma, BorderMode border, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("gaussianBlurBoxes", "image");
+	int radii[3];
+	gaussianBoxRadii(sigma, radii);
+
+	Image result = source;
+	for (int i = 0; i < 3; i++) {
+		Image next = boxBlurRunning(result, radii[i], border, pool);
+		if (result.data != source.data) {
+			free(result.data);
+		}
+		result = next;
+	}
+	return result;
+}
+
+// third order recursive gaussian, young, van vliet and van ginkel,
+// "recursive gabor filtering", 2002: the poles are scaled from fixed ones,
+// so the response has the sigma asked for (the 1995 fit came out about 10%
+// wider). a causal pass followed by an anticausal one, each 4 multiplies per
+// value whatever sigma is. good from sigma 0.5 up.
+struct RecursiveGaussian
+{
+	float B, b1, b2, b3;
+	// triggs and sdika, "boundary conditions for young - van vliet recursive
+	// filtering", 2006: the anticausal outputs at count - 1, count and
+	// count + 1 from the last three causal ones, all relative to the edge.
+	float edge[3][3];
+
+	RecursiveGaussian(float sigma)
+	{
+		const double m0 = 1.16680, m1 = 1.10783, m2 = 1.40586;
+		double q = 1.31564 * (sqrt(1.0 + 0.490811 * sigma * sigma) - 1.0);
+		double scale = (m0 + q) * (m1 * m1 + m2 * m2 + 2.0 * m1 * q + q * q);
+		double a1 = q * (2.0 * m0 * m1 + m1 * m1 + m2 * m2 + (2.0 * m0 + 4.0 * m1) * q + 3.0 * q * q) / scale;
+		double a2 = -q * q * (m0 + 2.0 * m1 + 3.0 * q) / scale;
+		double a3 = q * q * q / scale;
+		double a0 = 1.0 - (a1 + a2 + a3);
+		this->b1 = (float)a1;
+		this->b2 = (float)a2;
+		this->b3 = (float)a3;
+		this->B = (float)a0;
+
+		double m[3][3] = {
+			{ 1.0 - a1 * a3 - a2 - a3 * a3, (a3 + a1) * (a2 + a3 * a1), a3 * (a1 + a3 * a2) },
+			{ a1 + a3 * a2, (1.0 - a2) * (a2 + a3 * a1), (1.0 - a1 * a3 - a3 * a3 - a2) * a3 },
+			{ a1 * a3 + a2 + a1 * a1 - a2 * a2, a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3, a3 * (a1 + a3 * a2) },
+		};
+		// the paper's filter has a gain of 1 / a0, this one is normalized
+		double k = a0 / ((1.0 + a1 - a2 + a3) * (1.0 - a1 - a2 - a3) * (1.0 + a2 + (a1 - a3) * a3));
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				this->edge[i][j] = (float)(k * m[i][j]);
+			}
+		}
+	}
+
+	// one step, w1..w3 are the three previous outputs
+	Lanes step(Lanes x, Lanes w1, Lanes w2, Lanes w3) const
+	{
+		Lanes feedback = lanesAdd(lanesAdd(lanesMul(lanesSet(this->b1), w1), lanesMul(lanesSet(this->b2), w2)), lanesMul(lanesSet(this->b3), w3));
+		return lanesAdd(lanesMul(lanesSet(this->B), x), feedback);
+	}
+
+	// row i of the edge matrix applied to the causal outputs d0..d2
+	Lanes edgeStep(int i, Lanes last, Lanes d0, Lanes d1, Lanes d2) const
+	{
+		Lanes sum = lanesAdd(lanesAdd(lanesMul(lanesSet(this->edge[i][0]), d0), lanesMul(lanesSet(this->edge[i][1]), d1)), lanesMul(lanesSet(this->edge[i][2]), d2));
+		return lanesAdd(last, sum);
+	}
+
+	// both passes over count values `stride` floats apart, in place, with
+	// the input clamped past both ends. the causal pass starts from the
+	// first value repeated, which is exact for it. the anticausal pass
+	// starts from the triggs - sdika state for the last input repeated.
+	void filter(float* data, int count, size_t stride) const
+	{
+		Lanes last = lanesLoad(&data[(count - 1) * stride]);
+		Lanes w1 = lanesLoad(data);
+		Lanes w2 = w1;
+		Lanes w3 = w1;
+		for (int i = 0; i < count; i++) {
+			Lanes w = this->step(lanesLoad(&data[i * stride]), w1, w2, w3);
+			lanesStore(&data[i * stride], w);
+			w3 = w2;
+			w2 = w1;
+			w1 = w;
+		}
+
+		// shorter than 3, the missing causal outputs are taken as the first
+		Lanes d0 = lanesSub(lanesLoad(&data[(count - 1) * stride]), last);
+		Lanes d1 = lanesSub(lanesLoad(&data[(count > 1 ? count - 2 : 0) * stride]), last);
+		Lanes d2 = lanesSub(lanesLoad(&data[(count > 2 ? count - 3 : 0) * stride]), last);
+		w1 = this->edgeStep(0, last, d0, d1, d2);
+		w2 = this->edgeStep(1, last, d0, d1, d2);
+		w3 = this->edgeStep(2, last, d0, d1, d2);
+		lanesStore(&data[(count - 1) * stride], w1);
+		for (int i = count - 2; i >= 0; i--) {
+			Lanes w = this->step(lanesLoad(&data[i * stride]), w1, w2, w3);
+			lanesStore(&data[i * stride], w);
+			w3 = w2;
+			w2 = w1;
+			w1 = w;
+		}
+	}
+};
+
+// rows past which the weights of the filter above add up to less than
+// 2^-24 on one side, the context a strip needs to match the whole image to
+// float rounding. its tails decay exponentially rather than like a
+// gaussian, so this is 10 to 13 sigma, not 4. found by running an impulse
+// through both passes in doubles.
+inline int recursiveGaussianReach(float sigma)
+{
+	RecursiveGaussian gaussian(sigma);
+	int center = (int)ceilf(20.0f * sigma) + 64;
+	std::vector<double> response(2 * center + 1, 0.0);
+	response[center] = 1.0;
+	double w1 = 0.0, w2 = 0.0, w3 = 0.0;
+	for (size_t i = 0; i < response.size(); i++) {
+		double w = gaussian.B * response[i] + gaussian.b1 * w1 + gaussian.b2 * w2 + gaussian.b3 * w3;
+		response[i] = w;
+		w3 = w2;
+		w2 = w1;
+		w1 = w;
+	}
+	w1 = w2 = w3 = 0.0;
+	for (size_t i = response.size(); i-- > 0;) {
+		double w = gaussian.B * response[i] + gaussian.b1 * w1 + gaussian.b2 * w2 + gaussian.b3 * w3;
+		response[i] = w;
+		w3 = w2;
+		w2 = w1;
+		w1 = w;
+	}
+
+	double tail = 0.0;
+	for (int reach = center; reach > 0; reach--) {
+		tail += fabs(response[center + reach]);
+		if (tail >= 1.0 / (1 << 24)) {
+			return reach;
+		}
+	}
+	return 0;
+}
+
+// young - van vliet gaussian of every channel with clamped edges, returns a
+// new image the caller frees.
+inline Image gaussianBlurRecursive(const Image& source, float sigma, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("gaussianBlurRecursive", "image");
+	RecursiveGaussian gaussian(sigma);
+	int width = source.width;
+	int channels = source.channels;
+	size_t pitch = (size_t)width * channels;
+
+	Image dest = source;
+	dest.data = (float*)malloc(sizeof(float) * pitch * source.height);
+
+	blurParallel(source.height, BLUR_BAND_ROWS, pool, [&](int begin, int end) {
+		std::vector<float> lanes((size_t)width * 4);
+		for (int y = begin; y < end; y++) {
+			rowToLanes(&source.data[y * pitch], width, channels, lanes.data());
+			gaussian.filter(lanes.data(), width, 4);
+			lanesToRow(lanes.data(), width, channels, &dest.data[y * pitch]);
+		}
+	});
+
+	// columns in place, 4 floats per filter call. the last chunk of a row
+	// that is not a multiple of 4 goes through a copy.
+	int vectors = (int)(pitch / 4);
+	blurParallel(vectors, BLUR_COLUMN_FLOATS, pool, [&](int begin, int end) {
+		for (int v = begin; v < end; v++) {
+			gaussian.filter(&dest.data[v * 4], source.height, pitch);
+		}
+	});
+
+	int rest = (int)(pitch % 4);
+	if (rest) {
+		std::vector<float> column((size_t)source.height * 4);
+		for (int y = 0; y < source.height; y++) {
+			memcpy(&column[y * 4], &dest.data[y * pitch + pitch - rest], sizeof(float) * rest);
+		}
+		gaussian.filter(column.data(), source.height, 4);
+		for (int y = 0; y < source.height; y++) {
+			memcpy(&dest.data[y * pitch + pitch - rest], &column[y * 4], sizeof(float) * rest);
+		}
+	}
+
+	return dest;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <functional>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "image.h"
+
+// 3d color lookup tables. a chain of per pixel color ops is run once over
+// a size^3 lattice of rgb in [0, 1], after that every pixel costs one
+// tetrahedral interpolation however much math the chain does. colors
+// outside [0, 1] are clamped onto the lattice, the stored outputs are what
+// the chain made of the lattice points, unclamped. smooth chains come out
+// close to the direct result, chains with hard edges only roughly near
+// them: hsiToRgb cuts to black and grey below 0.05, and the cells across
+// those cuts stay off by several hundredths even at 65^3.
+
+// the usual grading sizes are 33 and 65, 65 for chains with sharp curves
+const int COLOR_LUT_SIZE = 33;
+// rows per task when applying
+const int COLOR_LUT_BAND_ROWS = 64;
+
+// runs over count pixels of channels floats in place, only the first
+// three channels count.
+typedef std::function<void(float* pixels, int count, int channels)> ColorChain;
+
+struct ColorLut
+{
+	int size;
+	// size^3 entries of rgb plus a pad so every entry is one vector load.
+	// red varies fastest, then green, then blue, like a gl 3d texture.
+	std::vector<float> table;
+
+	const float* entry(int r, int g, int b) const
+	{
+		return &this->table[(((size_t)b * this->size + g) * this->size + r) * 4];
+	}
+};
+
+// the lattice entries are laid out as rgba pixels, so chain runs on the
+// table itself, one blue slice per task.
+inline ColorLut bakeColorLut(int size, const ColorChain& chain, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("bakeColorLut", "image");
+	ColorLut lut;
+	lut.size = size < 2 ? 2 : size;
+	size = lut.size;
+	lut.table.resize((size_t)size * size * size * 4);
+	float step = 1.0f / (size - 1);
+
+	auto slice = [&](int b) {
+		float* pixels = &lut.table[(size_t)b * size * size * 4];
+		for (int g = 0; g < size; g++) {
+			for (int r = 0; r < size; r++) {
+				float* p = &pixels[((size_t)g * size + r) * 4];
+				p[0] = r * step;
+				p[1] = g * step;
+				p[2] = b * step;
+				p[3] = 1.0f;
+			}
+		}
+		chain(pixels, size * size, 4);
+	};
+
+	if (pool) {
+		pool->parallelFor(size, slice);
+	}
+	else {
+		for (int b = 0; b < size; b++) {
+			slice(b);
+		}
+	}
+	return lut;
+}
+
+// tetrahedral interpolation: the lattice cell around a color splits into
+// six tetrahedra along its grey diagonal, and the one holding the color
+// blends its 4 corners, where trilinear would blend all 8. colors on the
+// diagonal only ever read diagonal corners, so greys stay grey.
+inline void applyColorLut(const ColorLut& lut, float* pixels, int count, int channels)
+{
+	int last = lut.size - 1;
+	float scale = (float)last;
+	size_t stepR = 4;
+	size_t stepG = (size_t)lut.size * 4;
+	size_t stepB = (size_t)lut.size * lut.size * 4;
+	const float* table = lut.table.data();
+
+	for (int i = 0; i < count; i++) {
+		float* p = &pixels[(size_t)i * channels];
+		float f[3];
+		size_t strides[3] = { stepR, stepG, stepB };
+		const float* base = table;
+		for (int c = 0; c < 3; c++) {
+			float position = !(p[c] > 0.0f) ? 0.0f : (p[c] < 1.0f ? p[c] * scale : scale);
+			int cell = (int)position;
+			// 1.0 lands on the far side of the last cell
+			cell = cell < last ? cell : last - 1;
+			f[c] = position - cell;
+			base += cell * strides[c];
+		}
+
+		// the path from the low corner to the high one steps along the
+		// largest fraction first, three compare and swaps order them
+		auto order = [&](int a, int b) {
+			if (f[a] < f[b]) {
+				float fraction = f[a];
+				f[a] = f[b];
+				f[b] = fraction;
+				size_t stride = strides[a];
+				strides[a] = strides[b];
+				strides[b] = stride;
+			}
+		};
+		order(0, 1);
+		order(1, 2);
+		order(0, 1);
+
+		const float* c0 = base;
+		const float* c1 = c0 + strides[0];
+		const float* c2 = c1 + strides[1];
+		const float* c3 = c2 + strides[2];
+		float f1 = f[0];
+		float f2 = f[1];
+		float f3 = f[2];
+
+#ifdef IMAGE_SSE2
+		__m128 sum = _mm_mul_ps(_mm_set1_ps(1.0f - f1), _mm_loadu_ps(c0));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(f1 - f2), _mm_loadu_ps(c1)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(f2 - f3), _mm_loadu_ps(c2)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(f3), _mm_loadu_ps(c3)));
+		float out[4];
+		_mm_storeu_ps(out, sum);
+		// alpha, when there is one, is not the lut's
+		memcpy(p, out, sizeof(float) * 3);
+#else
+		for (int c = 0; c < 3; c++) {
+			p[c] = (1.0f - f1) * c0[c] + (f1 - f2) * c1[c] + (f2 - f3) * c2[c] + f3 * c3[c];
+		}
+#endif
+	}
+}
+
+// the whole image in place, bands of rows on pool.
+inline void applyColorLut(const ColorLut& lut, Image& image, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("applyColorLut", "image");
+	int bands = (image.height + COLOR_LUT_BAND_ROWS - 1) / COLOR_LUT_BAND_ROWS;
+	auto band = [&](int b) {
+		int y0 = b * COLOR_LUT_BAND_ROWS;
+		int y1 = y0 + COLOR_LUT_BAND_ROWS < image.height ? y0 + COLOR_LUT_BAND_ROWS : image.height;
+		applyColorLut(lut, &image.data[(size_t)y0 * image.width * image.channels], (y1 - y0) * image.width, image.channels);
+	};
+
+	if (pool) {
+		pool->parallelFor(bands, band);
+	}
+	else {
+		for (int b = 0; b < bands; b++) {
+			band(b);
+		}
+	}
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "image.h"
+
+// convolutions of every channel of an Image. the work is split into bands
+// of rows for the thread pool, and each band into column tiles small
+// enough that the horizontal pass output stays in l2 for the vertical pass.
+// the inner loops run over the interleaved floats of a row, so they
+// vectorize the same for any channel count.
+
+// what pixels outside the image read, named after the gl wrap modes
+enum BorderMode
+{
+	// GL_CLAMP_TO_EDGE
+	BORDER_CLAMP,
+	// GL_MIRRORED_REPEAT, -1 reads 0, -2 reads 1
+	BORDER_MIRROR,
+	// GL_REPEAT
+	BORDER_REPEAT,
+};
+
+inline int borderIndex(int i, int count, BorderMode mode)
+{
+	if (i >= 0 && i < count) {
+		return i;
+	}
+
+	switch (mode) {
+	case BORDER_MIRROR: {
+		int period = 2 * count;
+		i %= period;
+		i = i < 0 ? i + period : i;
+		return i < count ? i : period - 1 - i;
+	}
+	case BORDER_REPEAT:
+		i %= count;
+		return i < 0 ? i + count : i;
+	default:
+		return i < 0 ? 0 : count - 1;
+	}
+}
+
+// weights[k + radius] is the weight of offset k.
+struct Kernel1D
+{
+	int radius;
+	std::vector<float> weights;
+};
+
+// 2 * radiusY + 1 rows of 2 * radiusX + 1 weights.
+struct Kernel2D
+{
+	int radiusX, radiusY;
+	std::vector<float> weights;
+};
+
+// normalized, cut off at 3 sigma.
+inline Kernel1D gaussianKernel(float sigma)
+{
+	Kernel1D kernel;
+	kernel.radius = (int)ceilf(3.0f * sigma);
+	kernel.radius = kernel.radius < 1 ? 1 : kernel.radius;
+	kernel.weights.resize(2 * kernel.radius + 1);
+
+	float sum = 0.0f;
+	for (int k = -kernel.radius; k <= kernel.radius; k++) {
+		float weight = expf(-(float)(k * k) / (2.0f * sigma * sigma));
+		kernel.weights[k + kernel.radius] = weight;
+		sum += weight;
+	}
+	for (float& weight : kernel.weights) {
+		weight /= sum;
+	}
+	return kernel;
+}
+
+inline Kernel1D boxKernel(int radius)
+{
+	Kernel1D kernel;
+	kernel.radius = radius;
+	kernel.weights.assign(2 * radius + 1, 1.0f / (2 * radius + 1));
+	return kernel;
+}
+
+// sobel is the outer product of a central difference along the gradient
+// and [1 2 1] smoothing across it.
+inline Kernel1D sobelDerivative()
+{
+	Kernel1D kernel = { 1, { -1.0f, 0.0f, 1.0f } };
+	return kernel;
+}
+
+inline Kernel1D sobelSmoothing()
+{
+	Kernel1D kernel = { 1, { 1.0f, 2.0f, 1.0f } };
+	return kernel;
+}
+
+inline Kernel2D laplacianKernel()
+{
+	Kernel2D kernel = { 1, 1, { 0.0f, 1.0f, 0.0f, 1.0f, -4.0f, 1.0f, 0.0f, 1.0f, 0.0f } };
+	return kernel;
+}
+
+// the 2d kernel a separable pair is equivalent to.
+inline Kernel2D outerKernel(const Kernel1D& horizontal, const Kernel1D& vertical)
+{
+	Kernel2D kernel;
+	kernel.radiusX = horizontal.radius;
+	kernel.radiusY = vertical.radius;
+	for (float v : vertical.weights) {
+		for (float h : horizontal.weights) {
+			kernel.weights.push_back(v * h);
+		}
+	}
+	return kernel;
+}
+
+// rows per band, the unit of work handed to the pool
+const int CONVOLVE_BAND_ROWS = 32;
+// budget for one tile of horizontal pass output
+const int CONVOLVE_TILE_BYTES = 256 * 1024;
+
+// dest[i] = sum over y, x of weights[y * tapsX + x] * source[y * rowPitch + x * stride + i]
+// for count floats. taps are added in the same order by both paths, so the
+// sse2 and scalar results are identical.
+inline void convolveBlock(const float* source, int stride, int rowPitch, const float* weights, int tapsX, int tapsY, float* dest, int count)
+{
+	int i = 0;
+#ifdef IMAGE_SSE2
+	// four independent sums hide the add latency
+	for (; i + 16 <= count; i += 16) {
+		__m128 sum0 = _mm_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+		__m128 sum2 = _mm_setzero_ps();
+		__m128 sum3 = _mm_setzero_ps();
+		for (int y = 0; y < tapsY; y++) {
+			for (int x = 0; x < tapsX; x++) {
+				__m128 weight = _mm_set1_ps(weights[y * tapsX + x]);
+				const float* row = &source[(size_t)y * rowPitch + x * stride + i];
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(weight, _mm_loadu_ps(row)));
+				sum1 = _mm_add_ps(sum1, _mm_mul_ps(weight, _mm_loadu_ps(row + 4)));
+				sum2 = _mm_add_ps(sum2, _mm_mul_ps(weight, _mm_loadu_ps(row + 8)));
+				sum3 = _mm_add_ps(sum3, _mm_mul_ps(weight, _mm_loadu_ps(row + 12)));
+			}
+		}
+		_mm_storeu_ps(&dest[i], sum0);
+		_mm_storeu_ps(&dest[i + 4], sum1);
+		_mm_storeu_ps(&dest[i + 8], sum2);
+		_mm_storeu_ps(&dest[i + 12], sum3);
+	}
+	for (; i + 4 <= count; i += 4) {
+		__m128 sum = _mm_setzero_ps();
+		for (int y = 0; y < tapsY; y++) {
+			for (int x = 0; x < tapsX; x++) {
+				__m128 weight = _mm_set1_ps(weights[y * tapsX + x]);
+				sum = _mm_add_ps(sum, _mm_mul_ps(weight, _mm_loadu_ps(&source[(size_t)y * rowPitch + x * stride + i])));
+			}
+		}
+		_mm_storeu_ps(&dest[i], sum);
+	}
+#endif
+	for (; i < count; i++) {
+		float sum = 0.0f;
+		for (int y = 0; y < tapsY; y++) {
+			for (int x = 0; x < tapsX; x++) {
+				sum += weights[y * tapsX + x] * source[(size_t)y * rowPitch + x * stride + i];
+			}
+		}
+		dest[i] = sum;
+	}
+}
+
+// pixels [x0 - radius, x1 + radius) of a row with the border applied.
+inline void padRow(const Image& image, int y, int x0, int x1, int radius, BorderMode border, float* dest)
+{
+	int channels = image.channels;
+	const float* row = &image.data[(size_t)y * image.width * channels];
+	int inside0 = x0 - radius < 0 ? 0 : x0 - radius;
+	int inside1 = x1 + radius > image.width ? image.width : x1 + radius;
+
+	for (int x = x0 - radius; x < inside0; x++) {
+		memcpy(&dest[(x - x0 + radius) * channels], &row[borderIndex(x, image.width, border) * channels], sizeof(float) * channels);
+	}
+	memcpy(&dest[(inside0 - x0 + radius) * channels], &row[inside0 * channels], sizeof(float) * channels * (inside1 - inside0));
+	for (int x = inside1; x < x1 + radius; x++) {
+		memcpy(&dest[(x - x0 + radius) * channels], &row[borderIndex(x, image.width, border) * channels], sizeof(float) * channels);
+	}
+}
+
+// calls fn(y0, y1, x0, x1) for every tile, bands spread over the pool.
+template <typename Fn>
+void forEachConvolveTile(const Image& image, int haloRows, ThreadPool* pool, Fn fn)
+{
+	size_t rowBytes = sizeof(float) * image.channels;
+	int tileWidth = (int)(CONVOLVE_TILE_BYTES / (rowBytes * (CONVOLVE_BAND_ROWS + 2 * haloRows)));
+	tileWidth = tileWidth < 16 ? 16 : tileWidth;
+
+	int bands = (image.height + CONVOLVE_BAND_ROWS - 1) / CONVOLVE_BAND_ROWS;
+	auto band = [&](int b) {
+		int y0 = b * CONVOLVE_BAND_ROWS;
+		int y1 = y0 + CONVOLVE_BAND_ROWS < image.height ? y0 + CONVOLVE_BAND_ROWS : image.height;
+		for (int x0 = 0; x0 < image.width; x0 += tileWidth) {
+			fn(y0, y1, x0, x0 + tileWidth < image.width ? x0 + tileWidth : image.width);
+		}
+	};
+
+	if (pool) {
+		pool->parallelFor(bands, band);
+	}
+	else {
+		for (int b = 0; b < bands; b++) {
+			band(b);
+		}
+	}
+}
+
+// horizontal then vertical pass, returns a new image the caller frees.
+inline Image convolveSeparable(const Image& source, const Kernel1D& horizontal, const Kernel1D& vertical, BorderMode border, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("convolveSeparable", "image");
+	Image dest = source;
+	dest.data = (float*)malloc(sizeof(float) * source.width * source.height * source.channels);
+
+	int channels = source.channels;
+	int rx = horizontal.radius;
+	int ry = vertical.radius;
+
+	forEachConvolveTile(source, ry, pool, [&](int y0, int y1, int x0, int x1) {
+		int pitch = (x1 - x0) * channels;
+		int rows = y1 - y0 + 2 * ry;
+		std::vector<float> padded((size_t)(x1 - x0 + 2 * rx) * channels);
+		std::vector<float> tile((size_t)rows * pitch);
+
+		for (int r = 0; r < rows; r++) {
+			padRow(source, borderIndex(y0 - ry + r, source.height, border), x0, x1, rx, border, padded.data());
+			convolveBlock(padded.data(), channels, 0, horizontal.weights.data(), 2 * rx + 1, 1, &tile[(size_t)r * pitch], pitch);
+		}
+		for (int y = y0; y < y1; y++) {
+			float* row = &dest.data[((size_t)y * source.width + x0) * channels];
+			convolveBlock(&tile[(size_t)(y - y0) * pitch], 0, pitch, vertical.weights.data(), 1, 2 * ry + 1, row, pitch);
+		}
+	});
+
+	return dest;
+}
+
+// general 2d kernel, returns a new image the caller frees.
+inline Image convolve2D(const Image& source, const Kernel2D& kernel, BorderMode border, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("convolve2D", "image");
+	Image dest = source;
+	dest.data = (float*)malloc(sizeof(float) * source.width * source.height * source.channels);
+
+	int channels = source.channels;
+	int rx = kernel.radiusX;
+	int ry = kernel.radiusY;
+
+	forEachConvolveTile(source, ry, pool, [&](int y0, int y1, int x0, int x1) {
+		int pitch = (x1 - x0 + 2 * rx) * channels;
+		int rows = y1 - y0 + 2 * ry;
+		std::vector<float> tile((size_t)rows * pitch);
+
+		for (int r = 0; r < rows; r++) {
+			padRow(source, borderIndex(y0 - ry + r, source.height, border), x0, x1, rx, border, &tile[(size_t)r * pitch]);
+		}
+		for (int y = y0; y < y1; y++) {
+			float* row = &dest.data[((size_t)y * source.width + x0) * channels];
+			convolveBlock(&tile[(size_t)(y - y0) * pitch], channels, pitch, kernel.weights.data(), 2 * rx + 1, 2 * ry + 1, row, (x1 - x0) * channels);
+		}
+	});
+
+	return dest;
+}
+
+// sqrt(gx^2 + gy^2) of every channel but alpha, which is kept.
+inline Image sobelMagnitude(const Image& source, BorderMode border, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("sobelMagnitude", "image");
+	Image gx = convolveSeparable(source, sobelDerivative(), sobelSmoothing(), border, pool);
+	Image gy = convolveSeparable(source, sobelSmoothing(), sobelDerivative(), border, pool);
+
+	size_t count = (size_t)source.width * source.height * source.channels;
+	for (size_t i = 0; i < count; i++) {
+		bool alpha = source.channels == 4 && i % 4 == 3;
+		gx.data[i] = alpha ? source.data[i] : sqrtf(gx.data[i] * gx.data[i] + gy.data[i] * gy.data[i]);
+	}
+
+	free(gy.data);
+	return gx;
+}
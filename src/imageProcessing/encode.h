@@ -0,0 +1,723 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "image.h"
+
+// writers for processed images. png and qoi take 8 bit pixels, pfm and raw
+// keep the floats, so hsi or hdr results survive unclamped.
+enum ImageFormat
+{
+	FORMAT_PNG,
+	FORMAT_QOI,
+	FORMAT_PFM,
+	FORMAT_RAW,
+	FORMAT_PPM,
+	FORMAT_COUNT,
+};
+
+const char* const FORMAT_EXTENSIONS[FORMAT_COUNT] = { ".png", ".qoi", ".pfm", ".raw", ".ppm" };
+
+// "png", "qoi", ... or FORMAT_COUNT when unknown.
+inline ImageFormat formatFromName(const char* name)
+{
+	for (int i = 0; i < FORMAT_COUNT; i++) {
+		if (strcmp(name, FORMAT_EXTENSIONS[i] + 1) == 0) {
+			return (ImageFormat)i;
+		}
+	}
+	return FORMAT_COUNT;
+}
+
+// linear floats to gamma encoded bytes, the inverse of what stbi_loadf
+// does to 8 bit files. a table indexed by the exponent and the top 7
+// mantissa bits of a value gives its byte at the bucket start, buckets are
+// narrow enough to hold at most one rounding threshold, so one compare
+// against that threshold finishes it. 8 bit inputs round trip exactly.
+struct GammaTable
+{
+	// values below 2^-20 are under the first threshold
+	static const int MIN_EXPONENT = 127 - 20;
+	static const int BUCKETS = 20 << 7;
+
+	// the value byte i + 1 starts at
+	float thresholds[256];
+	u8 buckets[BUCKETS];
+
+	GammaTable()
+	{
+		for (int i = 0; i < 255; i++) {
+			this->thresholds[i] = (float)pow((i + 0.5) / 255.0, (double)LDR_GAMMA);
+		}
+		this->thresholds[255] = 2.0f;
+
+		int byte = 0;
+		for (int b = 0; b < BUCKETS; b++) {
+			u32 bits = (u32)((MIN_EXPONENT << 7) + b) << 16;
+			float start;
+			memcpy(&start, &bits, sizeof(start));
+			while (start >= this->thresholds[byte]) {
+				byte++;
+			}
+			this->buckets[b] = (u8)byte;
+		}
+	}
+
+	u8 encode(float value) const
+	{
+		// also catches negatives and nan
+		if (!(value >= 1.0f / (1 << 20))) {
+			return 0;
+		}
+		if (value >= 1.0f) {
+			return 255;
+		}
+		u32 bits;
+		memcpy(&bits, &value, sizeof(bits));
+		u8 byte = this->buckets[(bits >> 16) - (MIN_EXPONENT << 7)];
+		return byte + (value >= this->thresholds[byte]);
+	}
+};
+
+// clamps to [0, 1] and rounds. color is gamma encoded, alpha, the last of
+// 2 or 4 channels, is stored linear like stbi reads it.
+inline void quantizeBytes(const float* values, size_t count, int channels, u8* bytes)
+{
+	static const GammaTable table;
+	int alpha = channels == 2 || channels == 4 ? channels - 1 : channels;
+	for (size_t i = 0; i < count; i += channels) {
+		for (int c = 0; c < channels; c++) {
+			float value = values[i + c];
+			if (c == alpha) {
+				value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+				bytes[i + c] = (u8)(value * 255.0f + 0.5f);
+			}
+			else {
+				bytes[i + c] = table.encode(value);
+			}
+		}
+	}
+}
+
+// keeps the channel count.
+inline std::vector<u8> toBytes(const Image& image)
+{
+	std::vector<u8> bytes((size_t)image.width * image.height * image.channels);
+	quantizeBytes(image.data, bytes.size(), image.channels, bytes.data());
+	return bytes;
+}
+
+inline void appendU32BE(std::vector<u8>& out, u32 value)
+{
+	out.push_back((u8)(value >> 24));
+	out.push_back((u8)(value >> 16));
+	out.push_back((u8)(value >> 8));
+	out.push_back((u8)value);
+}
+
+inline u32 crc32(const u8* data, size_t size, u32 crc = 0)
+{
+	struct Table
+	{
+		u32 entries[256];
+
+		Table()
+		{
+			for (u32 i = 0; i < 256; i++) {
+				u32 c = i;
+				for (int k = 0; k < 8; k++) {
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				this->entries[i] = c;
+			}
+		}
+	};
+	static const Table table;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+const u32 ADLER_BASE = 65521;
+
+inline u32 adler32(const u8* data, size_t size)
+{
+	u32 a = 1, b = 0;
+	while (size) {
+		// largest run before b can overflow
+		size_t run = size < 5552 ? size : 5552;
+		size -= run;
+		for (size_t i = 0; i < run; i++) {
+			a += data[i];
+			b += a;
+		}
+		data += run;
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+	}
+	return (b << 16) | a;
+}
+
+// adler of the concatenation from the adlers of the parts, as zlib does it.
+inline u32 adler32Combine(u32 first, u32 second, size_t secondSize)
+{
+	u32 remainder = (u32)(secondSize % ADLER_BASE);
+	u32 sum1 = first & 0xffff;
+	u32 sum2 = (remainder * sum1) % ADLER_BASE;
+	sum1 += (second & 0xffff) + ADLER_BASE - 1;
+	sum2 += ((first >> 16) & 0xffff) + ((second >> 16) & 0xffff) + ADLER_BASE - remainder;
+	sum1 -= sum1 >= ADLER_BASE ? ADLER_BASE : 0;
+	sum1 -= sum1 >= ADLER_BASE ? ADLER_BASE : 0;
+	sum2 -= sum2 >= ADLER_BASE * 2 ? ADLER_BASE * 2 : 0;
+	sum2 -= sum2 >= ADLER_BASE ? ADLER_BASE : 0;
+	return sum1 | (sum2 << 16);
+}
+
+// deflate writes bits lsb first. writes go straight to memory the caller
+// sized for the worst case, 32 bits at a time.
+struct BitWriter
+{
+	u8* cursor;
+	u64 bits;
+	int count;
+
+	void put(u32 value, int size)
+	{
+		this->bits |= (u64)value << this->count;
+		this->count += size;
+		if (this->count >= 32) {
+			this->cursor[0] = (u8)this->bits;
+			this->cursor[1] = (u8)(this->bits >> 8);
+			this->cursor[2] = (u8)(this->bits >> 16);
+			this->cursor[3] = (u8)(this->bits >> 24);
+			this->cursor += 4;
+			this->bits >>= 32;
+			this->count -= 32;
+		}
+	}
+
+	// pads to a byte and writes out everything pending.
+	void align()
+	{
+		while (this->count > 0) {
+			*this->cursor++ = (u8)this->bits;
+			this->bits >>= 8;
+			this->count -= 8;
+		}
+		this->bits = 0;
+		this->count = 0;
+	}
+};
+
+// the fixed huffman code of rfc 1951 3.2.6, bit reversed so it can go
+// through the lsb first writer.
+struct FixedHuffman
+{
+	u16 literalCode[288];
+	u8 literalSize[288];
+	u16 distanceCode[30];
+
+	static u32 reverse(u32 code, int size)
+	{
+		u32 reversed = 0;
+		for (int i = 0; i < size; i++) {
+			reversed = (reversed << 1) | ((code >> i) & 1);
+		}
+		return reversed;
+	}
+
+	FixedHuffman()
+	{
+		for (u32 symbol = 0; symbol < 288; symbol++) {
+			u32 code, size;
+			if (symbol < 144) {
+				code = 0x30 + symbol;
+				size = 8;
+			}
+			else if (symbol < 256) {
+				code = 0x190 + symbol - 144;
+				size = 9;
+			}
+			else if (symbol < 280) {
+				code = symbol - 256;
+				size = 7;
+			}
+			else {
+				code = 0xc0 + symbol - 280;
+				size = 8;
+			}
+			this->literalCode[symbol] = (u16)reverse(code, size);
+			this->literalSize[symbol] = (u8)size;
+		}
+		for (u32 symbol = 0; symbol < 30; symbol++) {
+			this->distanceCode[symbol] = (u16)reverse(symbol, 5);
+		}
+	}
+};
+
+const u16 DEFLATE_LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const u8 DEFLATE_LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const u16 DEFLATE_DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const u8 DEFLATE_DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+const int DEFLATE_HASH_BITS = 15;
+const int DEFLATE_WINDOW = 32768;
+const int DEFLATE_MAX_MATCH = 258;
+
+// one fixed huffman block over data with greedy single probe lz77. the
+// block is not final and is followed by an empty stored block, which byte
+// aligns the output so independently compressed pieces can be appended to
+// each other, like pigz does. matches never reach into a previous piece.
+inline void deflateFixed(const u8* data, size_t size, bool last, std::vector<u8>& out)
+{
+	static const FixedHuffman huffman;
+
+	// literals cost at most 9 bits, matches less than 8 per byte they cover
+	size_t start = out.size();
+	out.resize(start + size + size / 8 + 64);
+	BitWriter writer = { &out[start], 0, 0 };
+	writer.put(last ? 1 : 0, 1);
+	writer.put(1, 2);
+
+	std::vector<int> head((size_t)1 << DEFLATE_HASH_BITS, -1);
+	size_t i = 0;
+	while (i < size) {
+		int length = 0;
+		size_t distance = 0;
+
+		if (i + 4 <= size) {
+			u32 key;
+			memcpy(&key, data + i, 4);
+			u32 hash = (key * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+			int candidate = head[hash];
+			head[hash] = (int)i;
+
+			if (candidate >= 0 && i - candidate <= DEFLATE_WINDOW && memcmp(data + candidate, data + i, 4) == 0) {
+				size_t limit = size - i < DEFLATE_MAX_MATCH ? size - i : DEFLATE_MAX_MATCH;
+				length = 4;
+				while ((size_t)length < limit && data[candidate + length] == data[i + length]) {
+					length++;
+				}
+				distance = i - candidate;
+			}
+		}
+
+		if (!length) {
+			writer.put(huffman.literalCode[data[i]], huffman.literalSize[data[i]]);
+			i++;
+			continue;
+		}
+
+		int lengthSymbol = 28;
+		while (DEFLATE_LENGTH_BASE[lengthSymbol] > length) {
+			lengthSymbol--;
+		}
+		writer.put(huffman.literalCode[257 + lengthSymbol], huffman.literalSize[257 + lengthSymbol]);
+		writer.put(length - DEFLATE_LENGTH_BASE[lengthSymbol], DEFLATE_LENGTH_EXTRA[lengthSymbol]);
+
+		int distanceSymbol = 29;
+		while (DEFLATE_DISTANCE_BASE[distanceSymbol] > distance) {
+			distanceSymbol--;
+		}
+		writer.put(huffman.distanceCode[distanceSymbol], 5);
+		writer.put((u32)(distance - DEFLATE_DISTANCE_BASE[distanceSymbol]), DEFLATE_DISTANCE_EXTRA[distanceSymbol]);
+
+		i += length;
+	}
+
+	// end of block
+	writer.put(huffman.literalCode[256], huffman.literalSize[256]);
+	if (!last) {
+		// empty stored block, aligns to a byte
+		writer.put(0, 3);
+		writer.align();
+		writer.put(0x0000, 16);
+		writer.put(0xffff, 16);
+	}
+	writer.align();
+	out.resize(writer.cursor - out.data());
+}
+
+inline u8 paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return (u8)(pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+}
+
+// picks the filter with the smallest sum of absolute residuals per row,
+// the usual png heuristic. previous is all zeros for the first row. out
+// gets the filter byte and the row, scratch holds 4 rows.
+inline void filterRow(const u8* row, const u8* previous, int rowBytes, int pixelBytes, u8* out, u8* scratch)
+{
+	// png filter types 0 none, 1 sub, 2 up, 4 paeth. average is skipped,
+	// it rarely wins on photos.
+	static const u8 FILTER_TYPES[4] = { 0, 1, 2, 4 };
+	u8* candidates[4] = { (u8*)row, scratch, scratch + rowBytes, scratch + rowBytes * 2 };
+	u8* sub = candidates[1];
+	u8* up = candidates[2];
+	u8* paethed = candidates[3];
+
+	for (int x = 0; x < pixelBytes; x++) {
+		sub[x] = row[x];
+		up[x] = (u8)(row[x] - previous[x]);
+		paethed[x] = up[x];
+	}
+	for (int x = pixelBytes; x < rowBytes; x++) {
+		sub[x] = (u8)(row[x] - row[x - pixelBytes]);
+		up[x] = (u8)(row[x] - previous[x]);
+		paethed[x] = (u8)(row[x] - paeth(row[x - pixelBytes], previous[x], previous[x - pixelBytes]));
+	}
+
+	long best = -1;
+	int bestFilter = 0;
+	for (int filter = 0; filter < 4; filter++) {
+		const u8* residual = candidates[filter];
+		long cost = 0;
+		for (int x = 0; x < rowBytes; x++) {
+			cost += abs((int)(signed char)residual[x]);
+		}
+		if (best < 0 || cost < best) {
+			best = cost;
+			bestFilter = filter;
+		}
+	}
+
+	out[0] = FILTER_TYPES[bestFilter];
+	memcpy(out + 1, candidates[bestFilter], rowBytes);
+}
+
+inline void appendPngChunk(std::vector<u8>& out, const char* type, const u8* data, size_t size)
+{
+	appendU32BE(out, (u32)size);
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data, data + size);
+	appendU32BE(out, crc32(&out[start], out.size() - start));
+}
+
+// idat chunks of at most 1mb, some decoders dislike huge ones. the zlib
+// stream may be split anywhere.
+inline void appendPngData(std::vector<u8>& out, const u8* data, size_t size)
+{
+	const size_t maxChunk = 1 << 20;
+	for (size_t offset = 0; offset < size; offset += maxChunk) {
+		appendPngChunk(out, "IDAT", data + offset, std::min(maxChunk, size - offset));
+	}
+}
+
+// filters and deflates rows as one piece of the zlib stream. previous is
+// the row above the first, null for the top of the image. returns the
+// adler32 of the filtered bytes, filteredSize gets their count.
+inline u32 deflatePngRows(const u8* rows, const u8* previous, int rowCount, int rowBytes, int pixelBytes, bool last, std::vector<u8>& out, size_t& filteredSize)
+{
+	std::vector<u8> filtered((size_t)rowCount * (rowBytes + 1));
+	std::vector<u8> scratch((size_t)rowBytes * 3);
+	std::vector<u8> zeros(previous ? 0 : rowBytes);
+	for (int y = 0; y < rowCount; y++) {
+		const u8* above = y ? rows + (size_t)(y - 1) * rowBytes : (previous ? previous : zeros.data());
+		filterRow(rows + (size_t)y * rowBytes, above, rowBytes, pixelBytes, &filtered[(size_t)y * (rowBytes + 1)], scratch.data());
+	}
+
+	filteredSize = filtered.size();
+	deflateFixed(filtered.data(), filtered.size(), last, out);
+	return adler32(filtered.data(), filtered.size());
+}
+
+// colorType 2 is rgb, 6 rgba and 3 palette indices.
+inline std::vector<u8> pngHeader(int width, int height, u8 colorType)
+{
+	std::vector<u8> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	std::vector<u8> header;
+	appendU32BE(header, width);
+	appendU32BE(header, height);
+	header.push_back(8);
+	header.push_back(colorType);
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(0);
+	appendPngChunk(png, "IHDR", header.data(), header.size());
+	return png;
+}
+
+// rows per independently compressed piece, about 256kb of pixels each.
+inline int pngRowsPerPiece(int rowBytes)
+{
+	int rows = (256 * 1024) / (rowBytes + 1);
+	return rows > 0 ? rows : 1;
+}
+
+// the zlib stream of the filtered rows. the rows are split into pieces that
+// are filtered, deflated and checksummed in parallel on pool, when given.
+inline std::vector<u8> pngStream(const u8* pixels, int width, int height, int pixelBytes, ThreadPool* pool)
+{
+	int rowBytes = width * pixelBytes;
+	int rowsPerPiece = pngRowsPerPiece(rowBytes);
+	int pieceCount = (height + rowsPerPiece - 1) / rowsPerPiece;
+
+	std::vector<std::vector<u8>> pieces(pieceCount);
+	std::vector<u32> adlers(pieceCount);
+	std::vector<size_t> sizes(pieceCount);
+
+	auto compressPiece = [&](int piece) {
+		int firstRow = piece * rowsPerPiece;
+		int rows = std::min(rowsPerPiece, height - firstRow);
+		const u8* previous = firstRow ? pixels + (size_t)(firstRow - 1) * rowBytes : nullptr;
+		adlers[piece] = deflatePngRows(pixels + (size_t)firstRow * rowBytes, previous, rows, rowBytes, pixelBytes, piece == pieceCount - 1, pieces[piece], sizes[piece]);
+	};
+
+	if (pool) {
+		pool->parallelFor(pieceCount, compressPiece);
+	}
+	else {
+		for (int piece = 0; piece < pieceCount; piece++) {
+			compressPiece(piece);
+		}
+	}
+
+	// zlib stream, fastest compression level in the header
+	std::vector<u8> stream = { 0x78, 0x01 };
+	u32 adler = 1;
+	for (int piece = 0; piece < pieceCount; piece++) {
+		stream.insert(stream.end(), pieces[piece].begin(), pieces[piece].end());
+		adler = adler32Combine(adler, adlers[piece], sizes[piece]);
+	}
+	if (!pieceCount) {
+		// empty image still needs a final block
+		deflateFixed(nullptr, 0, true, stream);
+	}
+	appendU32BE(stream, adler);
+	return stream;
+}
+
+// 8 bit rgb or rgba png.
+inline std::vector<u8> encodePNG(const u8* pixels, int width, int height, int channels, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("encodePNG", "encode");
+	ASSERT(channels == 3 || channels == 4);
+
+	std::vector<u8> stream = pngStream(pixels, width, height, channels, pool);
+	std::vector<u8> png = pngHeader(width, height, channels == 4 ? 6 : 2);
+
+	appendPngData(png, stream.data(), stream.size());
+	appendPngChunk(png, "IEND", nullptr, 0);
+
+	return png;
+}
+
+// palette png of one index byte per pixel. colors holds count linear rgb
+// floats, clamped and gamma encoded like every 8 bit format.
+inline std::vector<u8> encodeIndexedPNG(const u8* indices, int width, int height, const float* colors, int count, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("encodeIndexedPNG", "encode");
+	ASSERT(count >= 1 && count <= 256);
+
+	std::vector<u8> stream = pngStream(indices, width, height, 1, pool);
+	std::vector<u8> png = pngHeader(width, height, 3);
+
+	std::vector<u8> palette((size_t)count * 3);
+	quantizeBytes(colors, palette.size(), 3, palette.data());
+	appendPngChunk(png, "PLTE", palette.data(), palette.size());
+	appendPngData(png, stream.data(), stream.size());
+	appendPngChunk(png, "IEND", nullptr, 0);
+
+	return png;
+}
+
+// the quite ok image format, https://qoiformat.org/qoi-specification.pdf
+// the encoder state carries across calls so an image can be fed in strips.
+struct QoiEncoder
+{
+	u8 index[64][4];
+	u8 previous[4];
+	int run;
+	size_t remaining;
+
+	void begin(int width, int height, int channels, std::vector<u8>& out)
+	{
+		memset(this->index, 0, sizeof(this->index));
+		this->previous[0] = 0;
+		this->previous[1] = 0;
+		this->previous[2] = 0;
+		this->previous[3] = 255;
+		this->run = 0;
+		this->remaining = (size_t)width * height;
+
+		out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+		appendU32BE(out, width);
+		appendU32BE(out, height);
+		out.push_back((u8)channels);
+		// srgb with linear alpha
+		out.push_back(0);
+	}
+
+	void encode(const u8* pixels, size_t count, int channels, std::vector<u8>& out)
+	{
+		for (size_t i = 0; i < count; i++) {
+			const u8* source = &pixels[i * channels];
+			u8 pixel[4] = { source[0], source[1], source[2], channels == 4 ? source[3] : (u8)255 };
+			this->remaining--;
+
+			if (memcmp(pixel, this->previous, 4) == 0) {
+				this->run++;
+				if (this->run == 62 || !this->remaining) {
+					out.push_back((u8)(0xc0 | (this->run - 1)));
+					this->run = 0;
+				}
+				continue;
+			}
+
+			if (this->run) {
+				out.push_back((u8)(0xc0 | (this->run - 1)));
+				this->run = 0;
+			}
+
+			int hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+			if (memcmp(this->index[hash], pixel, 4) == 0) {
+				out.push_back((u8)hash);
+			}
+			else {
+				memcpy(this->index[hash], pixel, 4);
+
+				if (pixel[3] == this->previous[3]) {
+					signed char dr = (signed char)(pixel[0] - this->previous[0]);
+					signed char dg = (signed char)(pixel[1] - this->previous[1]);
+					signed char db = (signed char)(pixel[2] - this->previous[2]);
+					signed char drg = (signed char)(dr - dg);
+					signed char dbg = (signed char)(db - dg);
+
+					if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+						out.push_back((u8)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+					}
+					else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+						out.push_back((u8)(0x80 | (dg + 32)));
+						out.push_back((u8)((drg + 8) << 4 | (dbg + 8)));
+					}
+					else {
+						out.push_back(0xfe);
+						out.insert(out.end(), pixel, pixel + 3);
+					}
+				}
+				else {
+					out.push_back(0xff);
+					out.insert(out.end(), pixel, pixel + 4);
+				}
+			}
+
+			memcpy(this->previous, pixel, 4);
+		}
+	}
+
+	void end(std::vector<u8>& out)
+	{
+		static const u8 padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+		out.insert(out.end(), padding, padding + 8);
+	}
+};
+
+inline std::vector<u8> encodeQOI(const u8* pixels, int width, int height, int channels)
+{
+	TRACE_SCOPE("encodeQOI", "encode");
+	ASSERT(channels == 3 || channels == 4);
+
+	std::vector<u8> out;
+	out.reserve(14 + (size_t)width * height * (channels + 1) / 2);
+	QoiEncoder encoder;
+	encoder.begin(width, height, channels, out);
+	encoder.encode(pixels, (size_t)width * height, channels, out);
+	encoder.end(out);
+	return out;
+}
+
+// portable float map, rgb or grey, little endian, bottom row first.
+inline std::vector<u8> encodePFM(const Image& image)
+{
+	TRACE_SCOPE("encodePFM", "encode");
+
+	int channels = image.channels >= 3 ? 3 : 1;
+	char header[64];
+	int headerSize = snprintf(header, sizeof(header), "%s\n%i %i\n-1.0\n", channels == 3 ? "PF" : "Pf", image.width, image.height);
+
+	std::vector<u8> out(header, header + headerSize);
+	out.resize(headerSize + (size_t)image.width * image.height * channels * sizeof(float));
+	float* dest = (float*)&out[headerSize];
+	for (int y = image.height - 1; y >= 0; y--) {
+		const float* row = &image.data[(size_t)y * image.width * image.channels];
+		for (int x = 0; x < image.width; x++) {
+			memcpy(dest, &row[x * image.channels], sizeof(float) * channels);
+			dest += channels;
+		}
+	}
+	return out;
+}
+
+// the float buffer as is, top row first. the size is in the file name.
+inline std::vector<u8> encodeRaw(const Image& image)
+{
+	const u8* data = (const u8*)image.data;
+	return std::vector<u8>(data, data + (size_t)image.width * image.height * image.channels * sizeof(float));
+}
+
+inline std::vector<u8> encodePPM(const u8* pixels, int width, int height, int channels)
+{
+	char header[64];
+	int headerSize = snprintf(header, sizeof(header), "P6\n%i %i\n255\n", width, height);
+
+	std::vector<u8> out(header, header + headerSize);
+	out.reserve(headerSize + (size_t)width * height * 3);
+	for (size_t i = 0; i < (size_t)width * height; i++) {
+		out.insert(out.end(), &pixels[i * channels], &pixels[i * channels] + 3);
+	}
+	return out;
+}
+
+// encodes a float image in any format. 8 bit formats clamp to [0, 1] and
+// gamma encode.
+inline std::vector<u8> encodeImage(const Image& image, ImageFormat format, ThreadPool* pool = nullptr)
+{
+	if (format == FORMAT_PFM) {
+		return encodePFM(image);
+	}
+	if (format == FORMAT_RAW) {
+		return encodeRaw(image);
+	}
+
+	ASSERT(image.channels == 3 || image.channels == 4);
+	std::vector<u8> bytes = toBytes(image);
+	switch (format) {
+	case FORMAT_PNG:
+		return encodePNG(bytes.data(), image.width, image.height, image.channels, pool);
+	case FORMAT_QOI:
+		return encodeQOI(bytes.data(), image.width, image.height, image.channels);
+	default:
+		return encodePPM(bytes.data(), image.width, image.height, image.channels);
+	}
+}
+
+inline bool writeFile(const char* path, const std::vector<u8>& data)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		printf("Failed to open %s for writing\n", path);
+		return false;
+	}
+
+	bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+	if (!written) {
+		printf("Failed to write %s\n", path);
+	}
+	return written;
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glfw/glfw3.h>
+
+#include <stdio.h>
+
+#include <common.h>
+#include <trace.h>
+
+#include "image.h"
+
+// gl side of the imageProcessing demo: shader programs and float textures.
+
+inline bool createShader(const char* shaderSource, GLuint shaderType, int& outShader) 
+{
+	TRACE_SCOPE("createShader", "shader");
+
+	outShader = glCreateShader(shaderType);
+	glShaderSource(outShader, 1, &shaderSource, nullptr);
+	glCompileShader(outShader);
+
+	int success = 0;
+	char infoLog[512];
+	glGetShaderiv(outShader, GL_COMPILE_STATUS, &success);
+
+	if (!success) {
+		glGetShaderInfoLog(outShader, 512, nullptr, infoLog);
+		printf("failed to compile vertex shader: \n%s", infoLog);
+		glDeleteShader(outShader);
+		return false;
+	}
+
+	return true;
+}
+
+struct Pipeline {
+	u32 id;
+
+	Pipeline(const char* vertexSource, const char* fragmentSource) 
+	{
+		TRACE_SCOPE("Pipeline", "shader");
+		this->id = 0;
+
+		u32 id;
+		int vertexShader = 0;
+		if (!createShader(vertexSource, GL_VERTEX_SHADER, vertexShader)) {
+			printf("Failed to create and compile vertex shader\n");
+			return;
+		}
+
+		int fragmentShader = 0;
+		if (!createShader(fragmentSource, GL_FRAGMENT_SHADER, fragmentShader)) {
+			printf("Failed to create and compile fragment shader\n");
+			return;
+		}
+
+		// pipeline
+		id = glCreateProgram();
+		glAttachShader(id, vertexShader);
+		glAttachShader(id, fragmentShader);
+		glLinkProgram(id);
+
+		int success = 0;
+		char infoLog[512];
+		glGetProgramiv(id, GL_LINK_STATUS, &success);
+
+		if (!success) {
+			glGetProgramInfoLog(id, 512, nullptr, infoLog);
+			printf("failed to compile vertex shader: \n%s", infoLog);
+			glDeleteProgram(id);
+			return;
+		}
+
+		this->id = id;
+	}
+
+	void use() 
+	{
+		glUseProgram(this->id);
+	}
+
+	void setUniform(const char* name, int value) 
+	{
+		u32 location = glGetUniformLocation(this->id, name);
+		glUniform1i(location, value);
+	}
+
+	void setUniform(const char* name, bool value) 
+	{
+		this->setUniform(name, (int)value);
+	}
+
+	void setUniform(const char* name, float value) 
+	{
+		u32 location = glGetUniformLocation(this->id, name);
+		u32 error = glGetError();
+		glUniform1f(location, value);
+		u32 error1 = glGetError();
+	}
+};
+
+// gl 4.3 entry points, glad stops at 3.3. loaded once, null on older
+// contexts.
+struct GLCompute
+{
+	bool loaded;
+	PFNGLDISPATCHCOMPUTEPROC dispatchCompute;
+	PFNGLMEMORYBARRIERPROC memoryBarrier;
+	PFNGLBINDIMAGETEXTUREPROC bindImageTexture;
+};
+
+inline GLCompute& glCompute()
+{
+	static GLCompute compute = {};
+	if (!compute.loaded) {
+		compute.loaded = true;
+		if (hasGLVersion(4, 3)) {
+			compute.dispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)glfwGetProcAddress("glDispatchCompute");
+			compute.memoryBarrier = (PFNGLMEMORYBARRIERPROC)glfwGetProcAddress("glMemoryBarrier");
+			compute.bindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)glfwGetProcAddress("glBindImageTexture");
+		}
+	}
+	return compute;
+}
+
+// compute shader counterpart of Pipeline. id stays 0 when the context has
+// no compute support or the shader does not build, callers fall back to
+// fragment passes then.
+struct ComputePipeline {
+	u32 id;
+
+	ComputePipeline(const char* computeSource)
+	{
+		TRACE_SCOPE("ComputePipeline", "shader");
+		this->id = 0;
+
+		if (!ComputePipeline::supported()) {
+			return;
+		}
+
+		int computeShader = 0;
+		if (!createShader(computeSource, GL_COMPUTE_SHADER, computeShader)) {
+			printf("Failed to create and compile compute shader\n");
+			return;
+		}
+
+		u32 id = glCreateProgram();
+		glAttachShader(id, computeShader);
+		glLinkProgram(id);
+		glDeleteShader(computeShader);
+
+		int success = 0;
+		char infoLog[512];
+		glGetProgramiv(id, GL_LINK_STATUS, &success);
+
+		if (!success) {
+			glGetProgramInfoLog(id, 512, nullptr, infoLog);
+			printf("failed to link compute shader: \n%s", infoLog);
+			glDeleteProgram(id);
+			return;
+		}
+
+		this->id = id;
+	}
+
+	static bool supported()
+	{
+		GLCompute& compute = glCompute();
+		return compute.dispatchCompute && compute.memoryBarrier && compute.bindImageTexture;
+	}
+
+	void use()
+	{
+		glUseProgram(this->id);
+	}
+
+	void setUniform(const char* name, int value)
+	{
+		glUniform1i(glGetUniformLocation(this->id, name), value);
+	}
+
+	void setUniform(const char* name, float value)
+	{
+		glUniform1f(glGetUniformLocation(this->id, name), value);
+	}
+
+	// enough groups of groupX x groupY to cover width x height.
+	void dispatch(int width, int height, int groupX, int groupY)
+	{
+		glCompute().dispatchCompute((width + groupX - 1) / groupX, (height + groupY - 1) / groupY, 1);
+	}
+};
+
+struct Texture 
+{
+	u32 id;
+	int width, height;
+
+	Texture(Image image) 
+	{
+		TRACE_SCOPE("Texture upload", "asset");
+
+		this->height = image.height;
+		this->width = image.width;
+
+		glGenTextures(1, &this->id);
+		glBindTexture(GL_TEXTURE_2D, this->id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+
+		u32 format = GL_RGBA;
+		if (image.channels == 3) {
+			format = GL_RGB;
+		}
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, this->width, this->height, 0, format, GL_FLOAT, image.data);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+
+	Texture(const char* file, u32 channels) 
+	{
+		TRACE_SCOPE_DETAIL("Texture", "asset", file);
+
+		Image image = loadImage(file, channels);
+		*this = Texture(image);
+		stbi_image_free(image.data);
+	}
+
+
+};
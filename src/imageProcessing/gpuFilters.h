@@ -0,0 +1,648 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <common.h>
+#include <profiler.h>
+#include <trace.h>
+
+#include "colorLut.h"
+#include "gpu.h"
+
+// image filters as fragment passes. every pass draws one fullscreen
+// triangle into a float texture, the next pass reads it back, two targets
+// ping-pong so nothing is copied or read back to the cpu in between.
+
+enum GpuFilterType
+{
+	GPU_HSI,
+	GPU_RGB,
+	GPU_INTENSITY,
+	GPU_SATURATION,
+	GPU_HUE,
+	GPU_EXPOSURE,
+	GPU_GAMMA,
+	GPU_INVERT,
+	// the lut from setLut
+	GPU_LUT,
+	GPU_BLUR,
+	GPU_FILTER_COUNT,
+};
+
+struct GpuStep
+{
+	GpuFilterType type;
+	// scale, radians, stops, gamma or blur radius
+	float value;
+};
+
+// no vertex buffers, the triangle comes from gl_VertexID.
+const char* const FILTER_VERTEX_SOURCE = R"(
+	#version 330 core
+
+	void main()
+	{
+		vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+		gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+	}
+)";
+
+// shared by every filter, the pixel being written is gl_FragCoord.
+const char* const FILTER_PRELUDE = R"(
+	#version 330 core
+	#define PI 3.14159265359
+
+	uniform sampler2D uTexture;
+	uniform float uValue;
+	uniform int uRadius;
+	uniform ivec2 uStep;
+	out vec4 fColor;
+
+	vec4 source()
+	{
+		return texelFetch(uTexture, ivec2(gl_FragCoord.xy), 0);
+	}
+)";
+
+// same math as rgbToHsi and hsiToRgb in image.h.
+const char* const FILTER_SOURCES[GPU_FILTER_COUNT] = {
+	// GPU_HSI
+	R"(
+	void main()
+	{
+		vec4 c = source();
+		float minimum = min(c.r, min(c.g, c.b));
+		float sum = c.r + c.g + c.b;
+		float denominator = sqrt((c.r - c.g) * (c.r - c.g) + (c.r - c.b) * (c.g - c.b));
+		float hue = denominator > 0.0 ? acos(clamp((c.r - 0.5 * c.g - 0.5 * c.b) / denominator, -1.0, 1.0)) : 0.0;
+		hue = c.b > c.g ? 2.0 * PI - hue : hue;
+		float saturation = sum > 0.0 ? 1.0 - (3.0 / sum) * minimum : 0.0;
+		fColor = vec4(hue, saturation, sum / 3.0, c.a);
+	}
+	)",
+	// GPU_RGB
+	R"(
+	void main()
+	{
+		vec4 c = source();
+		float hue = c.x;
+		float saturation = c.y;
+		float intensity = c.z;
+		vec3 rgb;
+
+		float epsilon = 0.05;
+		if (intensity <= epsilon) {
+			rgb = vec3(0.0);
+		}
+		else if (saturation <= epsilon) {
+			rgb = vec3(intensity);
+		}
+		else {
+			if (hue < 0.0) {
+				hue += 2.0 * PI;
+			}
+
+			float scale = 3.0 * intensity;
+			// which 120 degree sector, the two others are rotations of the first
+			float sector = hue <= PI * 2.0 / 3.0 ? 0.0 : (hue <= PI * 4.0 / 3.0 ? 1.0 : 2.0);
+			hue -= sector * PI * 2.0 / 3.0;
+			float low = (1.0 - saturation) / 3.0 * scale;
+			float high = (1.0 + (saturation * cos(hue) / cos(PI / 3.0 - hue))) / 3.0 * scale;
+			float rest = scale - low - high;
+
+			rgb = sector == 0.0 ? vec3(high, rest, low) : (sector == 1.0 ? vec3(low, high, rest) : vec3(rest, low, high));
+		}
+		fColor = vec4(rgb, c.a);
+	}
+	)",
+	// GPU_INTENSITY
+	R"(
+	void main()
+	{
+		vec4 c = source();
+		fColor = vec4(c.x, c.y, c.z * uValue, c.a);
+	}
+	)",
+	// GPU_SATURATION
+	R"(
+	void main()
+	{
+		vec4 c = source();
+		fColor = vec4(c.x, min(c.y * uValue, 1.0), c.z, c.a);
+	}
+	)",
+	// GPU_HUE
+	R"(
+	void main()
+	{
+		vec4 c = source();
+		fColor = vec4(mod(c.x + uValue + 4.0 * PI, 2.0 * PI), c.y, c.z, c.a);
+	}
+	)",
+	// GPU_EXPOSURE, uValue is the scale
+	R"(
+	void main()
+	{
+		vec4 c = source();
+		fColor = vec4(c.rgb * uValue, c.a);
+	}
+	)",
+	// GPU_GAMMA, uValue is the exponent
+	R"(
+	void main()
+	{
+		vec4 c = source();
+		fColor = vec4(pow(max(c.rgb, vec3(0.0)), vec3(uValue)), c.a);
+	}
+	)",
+	// GPU_INVERT
+	R"(
+	void main()
+	{
+		vec4 c = source();
+		fColor = vec4(1.0 - c.rgb, c.a);
+	}
+	)",
+	// GPU_LUT, the tetrahedral interpolation of applyColorLut. like simplex
+	// noise, pairwise compares give the steps along the largest and the two
+	// largest fractions without branches. ties go to the lower axis, greys
+	// have all three equal and must still find one largest.
+	R"(
+	uniform sampler3D uLut;
+
+	void main()
+	{
+		vec4 c = source();
+		int last = textureSize(uLut, 0).x - 1;
+		vec3 position = clamp(c.rgb, 0.0, 1.0) * float(last);
+		ivec3 cell = min(ivec3(position), ivec3(last - 1));
+		vec3 f = position - vec3(cell);
+
+		vec3 larger = vec3(f.x >= f.y, f.y >= f.z, f.z > f.x);
+		vec3 smaller = 1.0 - larger.zxy;
+		vec3 first = min(larger, smaller);
+		vec3 second = max(larger, smaller);
+		float f1 = dot(f, first);
+		float f2 = dot(f, second) - f1;
+		float f3 = f.x + f.y + f.z - f1 - f2;
+
+		vec3 rgb = (1.0 - f1) * texelFetch(uLut, cell, 0).rgb
+			+ (f1 - f2) * texelFetch(uLut, cell + ivec3(first), 0).rgb
+			+ (f2 - f3) * texelFetch(uLut, cell + ivec3(second), 0).rgb
+			+ f3 * texelFetch(uLut, cell + ivec3(1), 0).rgb;
+		fColor = vec4(rgb, c.a);
+	}
+	)",
+	// GPU_BLUR, one direction per pass, edges clamped
+	R"(
+	void main()
+	{
+		ivec2 pixel = ivec2(gl_FragCoord.xy);
+		ivec2 last = textureSize(uTexture, 0) - 1;
+		vec4 sum = vec4(0.0);
+		for (int k = -uRadius; k <= uRadius; k++) {
+			sum += texelFetch(uTexture, clamp(pixel + uStep * k, ivec2(0), last), 0);
+		}
+		fColor = sum / float(2 * uRadius + 1);
+	}
+	)",
+};
+
+// scales a texture into the current viewport, for showing results.
+const char* const PRESENT_SOURCE = R"(
+	uniform ivec4 uViewport;
+
+	void main()
+	{
+		vec2 uv = (gl_FragCoord.xy - vec2(uViewport.xy)) / vec2(uViewport.zw);
+		fColor = texelFetch(uTexture, ivec2(uv * vec2(textureSize(uTexture, 0))), 0);
+	}
+)";
+
+// compute versions for gl 4.3. a blur pass loads its line segment plus
+// the radius on both sides into shared memory once, every invocation then
+// sums from there instead of fetching 2r+1 texels itself.
+const int BLUR_TILE = 128;
+const int BLUR_MAX_RADIUS = 64;
+
+const char* const BLUR_COMPUTE_SOURCE = R"(
+	#version 430 core
+	#define TILE 128
+	#define MAX_RADIUS 64
+	layout(local_size_x = TILE) in;
+
+	// sampled so the source can be any format, only the targets are rgba32f
+	uniform sampler2D uTexture;
+	layout(rgba32f, binding = 0) uniform writeonly image2D uDest;
+	uniform int uRadius;
+	uniform ivec2 uStep;
+
+	shared vec4 tile[TILE + 2 * MAX_RADIUS];
+
+	void main()
+	{
+		ivec2 size = textureSize(uTexture, 0);
+		int length = uStep.x != 0 ? size.x : size.y;
+		// pixel = uStep * position + across * line
+		ivec2 across = ivec2(1) - uStep;
+		int line = int(gl_WorkGroupID.y);
+		int first = int(gl_WorkGroupID.x) * TILE;
+		int local = int(gl_LocalInvocationID.x);
+
+		for (int i = local; i < TILE + 2 * uRadius; i += TILE) {
+			int position = clamp(first - uRadius + i, 0, length - 1);
+			tile[i] = texelFetch(uTexture, uStep * position + across * line, 0);
+		}
+		barrier();
+
+		if (first + local >= length) {
+			return;
+		}
+		vec4 sum = vec4(0.0);
+		for (int k = 0; k <= 2 * uRadius; k++) {
+			sum += tile[local + k];
+		}
+		imageStore(uDest, uStep * (first + local) + across * line, sum / float(2 * uRadius + 1));
+	}
+)";
+
+// histograms count into shared memory first, only the non zero bins of a
+// workgroup touch the global counts.
+const int HISTOGRAM_MAX_BINS = 256;
+const int HISTOGRAM_GROUP = 16;
+
+const char* const HISTOGRAM_COMPUTE_SOURCE = R"(
+	#version 430 core
+	#define MAX_BINS 256
+	layout(local_size_x = 16, local_size_y = 16) in;
+
+	uniform sampler2D uTexture;
+	uniform int uChannel;
+	uniform int uBins;
+	uniform float uMin;
+	uniform float uMax;
+	layout(std430, binding = 0) buffer Counts { uint counts[]; };
+
+	shared uint local[MAX_BINS];
+
+	void main()
+	{
+		uint index = gl_LocalInvocationIndex;
+		for (uint i = index; i < uint(uBins); i += 256u) {
+			local[i] = 0u;
+		}
+		barrier();
+
+		ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+		if (all(lessThan(pixel, textureSize(uTexture, 0)))) {
+			float value = texelFetch(uTexture, pixel, 0)[uChannel];
+			int bin = clamp(int((value - uMin) / (uMax - uMin) * float(uBins)), 0, uBins - 1);
+			atomicAdd(local[bin], 1u);
+		}
+		barrier();
+
+		for (uint i = index; i < uint(uBins); i += 256u) {
+			if (local[i] != 0u) {
+				atomicAdd(counts[i], local[i]);
+			}
+		}
+	}
+)";
+
+// 3.3 fallback, every pixel is a point drawn onto its bin of a bins x 1
+// float target with additive blending. exact up to 2^24 per bin.
+const char* const HISTOGRAM_VERTEX_SOURCE = R"(
+	#version 330 core
+
+	uniform sampler2D uTexture;
+	uniform int uChannel;
+	uniform int uBins;
+	uniform float uMin;
+	uniform float uMax;
+
+	void main()
+	{
+		ivec2 size = textureSize(uTexture, 0);
+		ivec2 pixel = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+		float value = texelFetch(uTexture, pixel, 0)[uChannel];
+		int bin = clamp(int((value - uMin) / (uMax - uMin) * float(uBins)), 0, uBins - 1);
+		gl_Position = vec4((float(bin) + 0.5) / float(uBins) * 2.0 - 1.0, 0.0, 0.0, 1.0);
+	}
+)";
+
+const char* const HISTOGRAM_FRAGMENT_SOURCE = R"(
+	#version 330 core
+	out vec4 fColor;
+
+	void main()
+	{
+		fColor = vec4(1.0);
+	}
+)";
+
+// float color texture with its own framebuffer.
+struct RenderTexture
+{
+	u32 texture;
+	u32 fbo;
+
+	bool create(int width, int height, u32 format = GL_RGBA32F)
+	{
+		glGenTextures(1, &this->texture);
+		glBindTexture(GL_TEXTURE_2D, this->texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		// hsi needs floats, hue goes up to 2pi
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+		glGenFramebuffers(1, &this->fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->texture, 0);
+		return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+
+	void destroy()
+	{
+		glDeleteFramebuffers(1, &this->fbo);
+		glDeleteTextures(1, &this->texture);
+		this->fbo = 0;
+		this->texture = 0;
+	}
+};
+
+struct GpuFilters
+{
+	u32 programs[GPU_FILTER_COUNT];
+	u32 present;
+	// core profile draws need a vao, even an empty one
+	u32 vao;
+	RenderTexture targets[2];
+	int width, height;
+	// 3d texture of the lut GPU_LUT reads, 0 until setLut
+	u32 lutTexture;
+
+	// compute programs, 0 on 3.3 contexts or when turned off
+	u32 blurCompute;
+	u32 histogramCompute;
+	u32 histogramBuffer;
+	// fragment histogram
+	u32 histogramPoints;
+	RenderTexture histogramTarget;
+
+	// targets are width x height, the size of the images run goes over.
+	// compute is used when the context has it, unless allowCompute is false.
+	bool init(int width, int height, bool allowCompute = true)
+	{
+		TRACE_SCOPE("GpuFilters init", "shader");
+		*this = GpuFilters();
+		this->width = width;
+		this->height = height;
+
+		if (allowCompute && ComputePipeline::supported()) {
+			this->blurCompute = ComputePipeline(BLUR_COMPUTE_SOURCE).id;
+			this->histogramCompute = ComputePipeline(HISTOGRAM_COMPUTE_SOURCE).id;
+			glGenBuffers(1, &this->histogramBuffer);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->histogramBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, HISTOGRAM_MAX_BINS * sizeof(u32), nullptr, GL_DYNAMIC_READ);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+		this->histogramPoints = Pipeline(HISTOGRAM_VERTEX_SOURCE, HISTOGRAM_FRAGMENT_SOURCE).id;
+		if (!this->histogramPoints) {
+			return false;
+		}
+
+		for (int i = 0; i < GPU_FILTER_COUNT; i++) {
+			std::string source = std::string(FILTER_PRELUDE) + FILTER_SOURCES[i];
+			this->programs[i] = Pipeline(FILTER_VERTEX_SOURCE, source.c_str()).id;
+			if (!this->programs[i]) {
+				return false;
+			}
+		}
+		std::string present = std::string(FILTER_PRELUDE) + PRESENT_SOURCE;
+		this->present = Pipeline(FILTER_VERTEX_SOURCE, present.c_str()).id;
+		if (!this->present) {
+			return false;
+		}
+
+		glGenVertexArrays(1, &this->vao);
+
+		// leave whatever the caller renders into bound
+		int framebuffer = 0;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+		bool complete = this->targets[0].create(width, height) && this->targets[1].create(width, height);
+		complete = complete && this->histogramTarget.create(HISTOGRAM_MAX_BINS, 1, GL_R32F);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		if (!complete) {
+			printf("Failed to create the filter render targets\n");
+		}
+		return complete;
+	}
+
+	void destroy()
+	{
+		for (int i = 0; i < GPU_FILTER_COUNT; i++) {
+			glDeleteProgram(this->programs[i]);
+		}
+		glDeleteProgram(this->present);
+		glDeleteProgram(this->blurCompute);
+		glDeleteProgram(this->histogramCompute);
+		glDeleteProgram(this->histogramPoints);
+		glDeleteBuffers(1, &this->histogramBuffer);
+		glDeleteVertexArrays(1, &this->vao);
+		glDeleteTextures(1, &this->lutTexture);
+		this->targets[0].destroy();
+		this->targets[1].destroy();
+		this->histogramTarget.destroy();
+	}
+
+	// uploads lut for the GPU_LUT steps, replacing the previous one.
+	void setLut(const ColorLut& lut)
+	{
+		if (!this->lutTexture) {
+			glGenTextures(1, &this->lutTexture);
+		}
+		glBindTexture(GL_TEXTURE_3D, this->lutTexture);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		// the entries are rgb plus a pad already, so the table goes up as is
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, lut.size, lut.size, lut.size, 0, GL_RGBA, GL_FLOAT, lut.table.data());
+		glBindTexture(GL_TEXTURE_3D, 0);
+	}
+
+	// runs the steps over source, returns the texture holding the result.
+	// blurs take two passes, everything else one. the result stays valid
+	// until the next run.
+	u32 run(u32 source, const GpuStep* steps, int count)
+	{
+		PROFILE_GPU("gpu filters");
+
+		int framebuffer = 0;
+		int viewport[4];
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		glViewport(0, 0, this->width, this->height);
+		glBindVertexArray(this->vao);
+		glActiveTexture(GL_TEXTURE0);
+
+		u32 input = source;
+		int next = 0;
+		for (int i = 0; i < count; i++) {
+			const GpuStep& step = steps[i];
+			u32 program = this->programs[step.type];
+			glUseProgram(program);
+			glUniform1i(glGetUniformLocation(program, "uTexture"), 0);
+
+			float value = step.value;
+			if (step.type == GPU_EXPOSURE) {
+				value = powf(2.0f, step.value);
+			}
+			else if (step.type == GPU_GAMMA) {
+				value = 1.0f / step.value;
+			}
+			glUniform1f(glGetUniformLocation(program, "uValue"), value);
+
+			if (step.type == GPU_LUT) {
+				if (!this->lutTexture) {
+					continue;
+				}
+				glUniform1i(glGetUniformLocation(program, "uLut"), 1);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_3D, this->lutTexture);
+				glActiveTexture(GL_TEXTURE0);
+			}
+
+			int passes = 1;
+			if (step.type == GPU_BLUR) {
+				int radius = (int)step.value;
+				if (radius <= 0) {
+					continue;
+				}
+				if (this->blurCompute && radius <= BLUR_MAX_RADIUS) {
+					for (int pass = 0; pass < 2; pass++) {
+						this->computeBlur(input, this->targets[next], radius, pass == 1);
+						input = this->targets[next].texture;
+						next ^= 1;
+					}
+					continue;
+				}
+				glUniform1i(glGetUniformLocation(program, "uRadius"), radius);
+				passes = 2;
+			}
+
+			for (int pass = 0; pass < passes; pass++) {
+				glUniform2i(glGetUniformLocation(program, "uStep"), pass == 0, pass == 1);
+				glBindFramebuffer(GL_FRAMEBUFFER, this->targets[next].fbo);
+				glBindTexture(GL_TEXTURE_2D, input);
+				glDrawArrays(GL_TRIANGLES, 0, 3);
+
+				input = this->targets[next].texture;
+				next ^= 1;
+			}
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		return input;
+	}
+
+	// one direction of a box blur from input into target.
+	void computeBlur(u32 input, const RenderTexture& target, int radius, bool vertical)
+	{
+		GLCompute& compute = glCompute();
+		glUseProgram(this->blurCompute);
+		glUniform1i(glGetUniformLocation(this->blurCompute, "uTexture"), 0);
+		glUniform1i(glGetUniformLocation(this->blurCompute, "uRadius"), radius);
+		glUniform2i(glGetUniformLocation(this->blurCompute, "uStep"), !vertical, vertical);
+		glBindTexture(GL_TEXTURE_2D, input);
+		compute.bindImageTexture(0, target.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+
+		int length = vertical ? this->height : this->width;
+		int lines = vertical ? this->width : this->height;
+		compute.dispatchCompute((length + BLUR_TILE - 1) / BLUR_TILE, lines, 1);
+		// the next pass samples or renders into what this one wrote
+		compute.memoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	// counts the values of one channel of a width x height texture in
+	// [minValue, maxValue) into bins, values outside go to the first or last
+	// bin. reads the counts back, so it waits for the gpu.
+	void histogram(u32 texture, int channel, int bins, float minValue, float maxValue, u32* counts)
+	{
+		PROFILE_GPU("gpu histogram");
+		ASSERT(bins > 0 && bins <= HISTOGRAM_MAX_BINS);
+		u32 program = this->histogramCompute ? this->histogramCompute : this->histogramPoints;
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "uTexture"), 0);
+		glUniform1i(glGetUniformLocation(program, "uChannel"), channel);
+		glUniform1i(glGetUniformLocation(program, "uBins"), bins);
+		glUniform1f(glGetUniformLocation(program, "uMin"), minValue);
+		glUniform1f(glGetUniformLocation(program, "uMax"), maxValue);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		if (this->histogramCompute) {
+			GLCompute& compute = glCompute();
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->histogramBuffer);
+			std::vector<u32> zeros(bins, 0);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bins * sizeof(u32), zeros.data());
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->histogramBuffer);
+			compute.dispatchCompute((this->width + HISTOGRAM_GROUP - 1) / HISTOGRAM_GROUP, (this->height + HISTOGRAM_GROUP - 1) / HISTOGRAM_GROUP, 1);
+			compute.memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bins * sizeof(u32), counts);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			return;
+		}
+
+		int framebuffer = 0;
+		int viewport[4];
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		bool blend = glIsEnabled(GL_BLEND);
+		float zeros[4] = {};
+
+		glBindFramebuffer(GL_FRAMEBUFFER, this->histogramTarget.fbo);
+		glViewport(0, 0, bins, 1);
+		glClearBufferfv(GL_COLOR, 0, zeros);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		glBindVertexArray(this->vao);
+		glDrawArrays(GL_POINTS, 0, this->width * this->height);
+		if (!blend) {
+			glDisable(GL_BLEND);
+		}
+
+		std::vector<float> sums(bins);
+		glReadPixels(0, 0, bins, 1, GL_RED, GL_FLOAT, sums.data());
+		for (int i = 0; i < bins; i++) {
+			counts[i] = (u32)sums[i];
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	}
+
+	// draws texture scaled into the given rectangle of the bound framebuffer.
+	void draw(u32 texture, int x, int y, int width, int height)
+	{
+		glViewport(x, y, width, height);
+		glBindVertexArray(this->vao);
+		glUseProgram(this->present);
+		glUniform1i(glGetUniformLocation(this->present, "uTexture"), 0);
+		glUniform4i(glGetUniformLocation(this->present, "uViewport"), x, y, width, height);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+};
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "blur.h"
+#include "colorLut.h"
+#include "image.h"
+
+// lazy chain of image operations. nothing runs while the chain is built,
+// evaluate fuses every run of per pixel ops into one pass over the image
+// and runs the blurs tile by tile, so the point ops in front of a blur are
+// computed inside the blur's tiles instead of as separate sweeps. other
+// whole image filters run on their own between the fused stages. runs of
+// point ops from rgb to rgb can be baked into a 3d lut first.
+
+// runs over count pixels in place, only the first three channels.
+typedef void (*PointFn)(float* pixels, int count, int channels, const float* params);
+// replaces image.data with the filtered image.
+typedef std::function<void(Image& image, ThreadPool* pool)> FilterFn;
+
+inline void pointToHSI(float* pixels, int count, int channels, const float*)
+{
+	for (int i = 0; i < count; i++) {
+		rgbToHsi(&pixels[i * channels], &pixels[i * channels]);
+	}
+}
+
+inline void pointToRGB(float* pixels, int count, int channels, const float*)
+{
+	for (int i = 0; i < count; i++) {
+		hsiToRgb(&pixels[i * channels], &pixels[i * channels]);
+	}
+}
+
+// pixels per point op call, the chunk stays in l1 while every op runs on it
+const int GRAPH_CHUNK_PIXELS = 256;
+// output rows per tile, a blur recomputes its radius rows on both sides
+const int GRAPH_TILE_ROWS = 32;
+// a blur's tiles grow to 4 times its radius, so the rows recomputed on
+// both sides stay at most half the tile. blurs whose tiles would be taller
+// than this run as whole image sweeps instead
+const int GRAPH_MAX_TILE_ROWS = 256;
+
+struct GraphNode
+{
+	const char* name;
+	// null for a blur, a filter or a baked lut
+	PointFn fn;
+	float params[4];
+	// box blur when > 0
+	int radius;
+	// which space the image is in after this node
+	bool rgb;
+	FilterFn filter;
+	// a baked run of point ops, a point op itself
+	std::shared_ptr<const ColorLut> lut;
+
+	// a node that does nothing yet, the graph fills in what it is
+	GraphNode(const char* name, bool rgb)
+	{
+		this->name = name;
+		this->fn = nullptr;
+		for (int i = 0; i < 4; i++) {
+			this->params[i] = 0.0f;
+		}
+		this->radius = 0;
+		this->rgb = rgb;
+	}
+
+	bool isPoint() const
+	{
+		return this->fn || this->lut;
+	}
+};
+
+struct ImageGraph
+{
+	std::vector<GraphNode> nodes;
+	// the space of the input and after the last node
+	bool inputRgb;
+	bool rgb;
+
+	ImageGraph(bool rgb = true)
+	{
+		this->inputRgb = rgb;
+		this->rgb = rgb;
+	}
+
+	void point(const char* name, PointFn fn, float a = 0.0f, float b = 0.0f, float c = 0.0f, float d = 0.0f)
+	{
+		GraphNode node(name, this->rgb);
+		node.fn = fn;
+		node.params[0] = a;
+		node.params[1] = b;
+		node.params[2] = c;
+		node.params[3] = d;
+		this->nodes.push_back(node);
+	}
+
+	void toHSI()
+	{
+		ASSERT(this->rgb);
+		this->rgb = false;
+		this->point("toHSI", pointToHSI);
+	}
+
+	void toRGB()
+	{
+		ASSERT(!this->rgb);
+		this->rgb = true;
+		this->point("toRGB", pointToRGB);
+	}
+
+	// box blur of every channel, radius pixels each side, edges clamped.
+	// both passes slide a running sum and tiles grow with the radius, so
+	// the cost per pixel stays about the same for any radius.
+	void blur(int radius)
+	{
+		if (radius > 0) {
+			GraphNode node("blur", this->rgb);
+			node.radius = radius;
+			this->nodes.push_back(node);
+		}
+	}
+
+	void filter(const char* name, FilterFn filter)
+	{
+		GraphNode node(name, this->rgb);
+		node.filter = filter;
+		this->nodes.push_back(node);
+	}
+
+	// replaces every run of point ops that starts and ends in rgb by one
+	// lookup in a size^3 lut baked from the run. exact at the lattice
+	// points, interpolated between them, and colors outside [0, 1] clamp.
+	// runs with discontinuities, like the black and grey cutoffs of the
+	// hsi round trip, are only approximated in the cells around them.
+	// the graph can run any number of images after, the lut is baked once.
+	void bakePoints(int size = COLOR_LUT_SIZE, ThreadPool* pool = nullptr)
+	{
+		TRACE_SCOPE("ImageGraph bakePoints", "image");
+		std::vector<GraphNode> baked;
+		size_t begin = 0;
+		while (begin < this->nodes.size()) {
+			size_t end = begin;
+			while (end < this->nodes.size() && this->nodes[end].isPoint()) {
+				end++;
+			}
+			bool rgbIn = begin == 0 ? this->inputRgb : this->nodes[begin - 1].rgb;
+			if (end > begin && rgbIn && this->nodes[end - 1].rgb) {
+				ColorChain chain = [this, begin, end](float* pixels, int count, int channels) {
+					this->runPoints(pixels, count, channels, begin, end);
+				};
+				GraphNode node("colorLut", true);
+				node.lut = std::make_shared<ColorLut>(bakeColorLut(size, chain, pool));
+				baked.push_back(node);
+			}
+			else {
+				baked.insert(baked.end(), this->nodes.begin() + begin, this->nodes.begin() + end);
+			}
+			if (end < this->nodes.size()) {
+				baked.push_back(this->nodes[end]);
+			}
+			begin = end + 1;
+		}
+		this->nodes = baked;
+	}
+
+	// runs the chain. image.data is replaced when the chain has a blur or
+	// a filter, the caller frees the result either way.
+	void evaluate(Image& image, ThreadPool* pool = nullptr) const
+	{
+		TRACE_SCOPE("ImageGraph evaluate", "image");
+
+		// stages of: point ops, then an optional blur. point ops after the
+		// last blur run on its output rows while they are still in cache.
+		size_t begin = 0;
+		while (begin < this->nodes.size()) {
+			size_t blur = begin;
+			while (blur < this->nodes.size() && this->nodes[blur].isPoint()) {
+				blur++;
+			}
+			size_t end = blur;
+			if (blur < this->nodes.size() && this->nodes[blur].radius > 0) {
+				end = blur + 1;
+				while (end < this->nodes.size() && this->nodes[end].isPoint()) {
+					end++;
+				}
+				// points before the next blur fuse into that blur instead
+				if (end < this->nodes.size() && this->nodes[end].radius > 0) {
+					end = blur + 1;
+				}
+				this->blurStage(image, begin, blur, end, pool);
+			}
+			else if (blur > begin) {
+				this->pointStage(image, begin, end, pool);
+			}
+			else {
+				TRACE_SCOPE(this->nodes[begin].name, "image");
+				this->nodes[begin].filter(image, pool);
+				end = begin + 1;
+			}
+			image.rgb = this->nodes[end - 1].rgb;
+			begin = end;
+		}
+	}
+
+	void runPoints(float* pixels, int count, int channels, size_t begin, size_t end) const
+	{
+		for (int i = 0; i < count; i += GRAPH_CHUNK_PIXELS) {
+			int chunk = count - i < GRAPH_CHUNK_PIXELS ? count - i : GRAPH_CHUNK_PIXELS;
+			for (size_t n = begin; n < end; n++) {
+				const GraphNode& node = this->nodes[n];
+				if (node.lut) {
+					applyColorLut(*node.lut, &pixels[(size_t)i * channels], chunk, channels);
+				}
+				else {
+					node.fn(&pixels[(size_t)i * channels], chunk, channels, node.params);
+				}
+			}
+		}
+	}
+
+	static void forEachTile(int rows, int tileRows, ThreadPool* pool, const std::function<void(int)>& fn)
+	{
+		int tiles = (rows + tileRows - 1) / tileRows;
+		if (pool) {
+			pool->parallelFor(tiles, fn);
+		}
+		else {
+			for (int i = 0; i < tiles; i++) {
+				fn(i);
+			}
+		}
+	}
+
+	void pointStage(Image& image, size_t begin, size_t end, ThreadPool* pool) const
+	{
+		TRACE_SCOPE("point stage", "image");
+		forEachTile(image.height, GRAPH_TILE_ROWS, pool, [&](int tile) {
+			int y = tile * GRAPH_TILE_ROWS;
+			int rows = image.height - y < GRAPH_TILE_ROWS ? image.height - y : GRAPH_TILE_ROWS;
+			this->runPoints(&image.data[(size_t)y * image.width * image.channels], rows * image.width, image.channels, begin, end);
+		});
+	}
+
+	// points [begin, blur), the blur, then points (blur, end) on its output.
+	void blurStage(Image& image, size_t begin, size_t blur, size_t end, ThreadPool* pool) const
+	{
+		TRACE_SCOPE("blur stage", "image");
+		int radius = this->nodes[blur].radius;
+		int tileRows = 4 * radius > GRAPH_TILE_ROWS ? 4 * radius : GRAPH_TILE_ROWS;
+		if (tileRows > GRAPH_MAX_TILE_ROWS) {
+			// one sweep each, the bands would have fallen out of cache
+			if (blur > begin) {
+				this->pointStage(image, begin, blur, pool);
+			}
+			Image blurred = boxBlurRunning(image, radius, BORDER_CLAMP, pool);
+			free(image.data);
+			image.data = blurred.data;
+			if (end > blur + 1) {
+				this->pointStage(image, blur + 1, end, pool);
+			}
+			return;
+		}
+
+		int width = image.width;
+		int height = image.height;
+		int channels = image.channels;
+		size_t rowFloats = (size_t)width * channels;
+		float* output = (float*)malloc(sizeof(float) * rowFloats * height);
+
+		forEachTile(height, tileRows, pool, [&](int tile) {
+			int y0 = tile * tileRows;
+			int y1 = height - y0 < tileRows ? height : y0 + tileRows;
+			// rows the vertical pass reads, clamped to the image
+			int top = y0 - radius < 0 ? 0 : y0 - radius;
+			int bottom = y1 + radius > height ? height : y1 + radius;
+
+			std::vector<float> line(rowFloats);
+			std::vector<float> lanes((size_t)width * 4);
+			std::vector<float> blurred((size_t)width * 4);
+			std::vector<float> band(rowFloats * (bottom - top));
+
+			// points, then the horizontal pass, one row at a time
+			for (int y = top; y < bottom; y++) {
+				memcpy(line.data(), &image.data[y * rowFloats], sizeof(float) * rowFloats);
+				this->runPoints(line.data(), width, channels, begin, blur);
+				rowToLanes(line.data(), width, channels, lanes.data());
+				boxLanes(lanes.data(), blurred.data(), width, radius, BORDER_CLAMP);
+				lanesToRow(blurred.data(), width, channels, &band[(y - top) * rowFloats]);
+			}
+
+			// vertical pass into the output rows as a window sliding down
+			// the band, then the trailing points
+			auto bandRow = [&](int y) {
+				return &band[(borderIndex(y, height, BORDER_CLAMP) - top) * rowFloats];
+			};
+			std::vector<float> sum(rowFloats, 0.0f);
+			for (int k = -radius; k <= radius; k++) {
+				const float* source = bandRow(y0 + k);
+				for (size_t i = 0; i < rowFloats; i++) {
+					sum[i] += source[i];
+				}
+			}
+			for (int y = y0; y < y1; y++) {
+				float* dest = &output[y * rowFloats];
+				// the last row's window never moves, and y + radius + 1 may
+				// be past the band
+				const float* enter = y + 1 < y1 ? bandRow(y + radius + 1) : bandRow(y);
+				const float* leave = y + 1 < y1 ? bandRow(y - radius) : bandRow(y);
+				slideRow(sum.data(), enter, leave, 1.0f / (2 * radius + 1), dest, rowFloats);
+				this->runPoints(dest, width, channels, blur + 1, end);
+			}
+		});
+
+		free(image.data);
+		image.data = output;
+	}
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "image.h"
+
+// histograms and the contrast ops built on them. equalization and clahe
+// only touch the intensity of an hsi image, so hue and saturation come out
+// the way they went in.
+
+// channel 2 of an hsi image
+const int HSI_INTENSITY = 2;
+// rows per task when counting or remapping
+const int HISTOGRAM_BAND_ROWS = 64;
+// every band counts into this many copies of the bins, neighbouring pixels
+// with the same value then do not wait on each other's increments
+const int HISTOGRAM_COPIES = 4;
+
+// same binning as the gpu histogram: values below min land in the first
+// bin, values from max up in the last.
+inline int histogramBin(float value, float min, float scale, int bins)
+{
+	float t = (value - min) * scale;
+	// nan goes to bin 0 too
+	int bin = !(t > 0.0f) ? 0 : (int)t;
+	return bin >= bins ? bins - 1 : bin;
+}
+
+// counts of one channel over the rows [y0, y1) into HISTOGRAM_COPIES
+// interleaved copies of bins, which the caller sums.
+inline void countRows(const Image& image, int channel, int x0, int x1, int y0, int y1, int bins, float min, float max, u32* copies)
+{
+	float scale = bins / (max - min);
+	int channels = image.channels;
+	for (int y = y0; y < y1; y++) {
+		const float* row = &image.data[(size_t)y * image.width * channels + channel];
+		int x = x0;
+		for (; x + HISTOGRAM_COPIES <= x1; x += HISTOGRAM_COPIES) {
+			for (int c = 0; c < HISTOGRAM_COPIES; c++) {
+				copies[c * bins + histogramBin(row[(x + c) * channels], min, scale, bins)]++;
+			}
+		}
+		for (; x < x1; x++) {
+			copies[histogramBin(row[x * channels], min, scale, bins)]++;
+		}
+	}
+}
+
+// counts[bins] of one channel. every band of rows counts into its own
+// bins, which are merged once all bands are done.
+inline void computeHistogram(const Image& image, int channel, int bins, float min, float max, u32* counts, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("computeHistogram", "image");
+	int bands = (image.height + HISTOGRAM_BAND_ROWS - 1) / HISTOGRAM_BAND_ROWS;
+	size_t bandBins = (size_t)bins * HISTOGRAM_COPIES;
+	std::vector<u32> privateCounts(bandBins * bands, 0);
+
+	auto band = [&](int b) {
+		int y0 = b * HISTOGRAM_BAND_ROWS;
+		int y1 = y0 + HISTOGRAM_BAND_ROWS < image.height ? y0 + HISTOGRAM_BAND_ROWS : image.height;
+		countRows(image, channel, 0, image.width, y0, y1, bins, min, max, &privateCounts[b * bandBins]);
+	};
+
+	if (pool) {
+		pool->parallelFor(bands, band);
+	}
+	else {
+		for (int b = 0; b < bands; b++) {
+			band(b);
+		}
+	}
+
+	memset(counts, 0, sizeof(u32) * bins);
+	for (size_t i = 0; i < privateCounts.size(); i++) {
+		counts[i % bins] += privateCounts[i];
+	}
+}
+
+// lut[bins + 1] of the normalized cumulative counts, lut[b] is the share of
+// values below bin b.
+inline void cumulativeLut(const float* counts, int bins, float* lut)
+{
+	double sum = 0.0;
+	for (int b = 0; b < bins; b++) {
+		sum += counts[b];
+	}
+
+	double running = 0.0;
+	lut[0] = 0.0f;
+	for (int b = 0; b < bins; b++) {
+		running += counts[b];
+		lut[b + 1] = sum > 0.0 ? (float)(running / sum) : (float)(b + 1) / bins;
+	}
+}
+
+// value through a lut from cumulativeLut, linear inside a bin so the
+// output has no steps where the input had none.
+inline float applyLut(const float* lut, float value, float min, float scale, int bins)
+{
+	float t = (value - min) * scale;
+	t = !(t > 0.0f) ? 0.0f : (t > (float)bins ? (float)bins : t);
+	int bin = (int)t;
+	bin = bin >= bins ? bins - 1 : bin;
+	return lut[bin] + (t - bin) * (lut[bin + 1] - lut[bin]);
+}
+
+template <typename Fn>
+void forEachHistogramBand(int height, ThreadPool* pool, Fn fn)
+{
+	int bands = (height + HISTOGRAM_BAND_ROWS - 1) / HISTOGRAM_BAND_ROWS;
+	auto band = [&](int b) {
+		int y0 = b * HISTOGRAM_BAND_ROWS;
+		fn(y0, y0 + HISTOGRAM_BAND_ROWS < height ? y0 + HISTOGRAM_BAND_ROWS : height);
+	};
+
+	if (pool) {
+		pool->parallelFor(bands, band);
+	}
+	else {
+		for (int b = 0; b < bands; b++) {
+			band(b);
+		}
+	}
+}
+
+// global histogram equalization of the intensity of an hsi image, [0, 1]
+// in bins steps.
+inline void equalizeIntensity(Image& image, int bins = 256, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("equalizeIntensity", "image");
+	ASSERT(!image.rgb);
+
+	std::vector<u32> counts(bins);
+	computeHistogram(image, HSI_INTENSITY, bins, 0.0f, 1.0f, counts.data(), pool);
+
+	std::vector<float> weights(counts.begin(), counts.end());
+	std::vector<float> lut(bins + 1);
+	cumulativeLut(weights.data(), bins, lut.data());
+
+	forEachHistogramBand(image.height, pool, [&](int y0, int y1) {
+		size_t begin = (size_t)y0 * image.width;
+		size_t end = (size_t)y1 * image.width;
+		for (size_t i = begin; i < end; i++) {
+			float* value = &image.data[i * image.channels + HSI_INTENSITY];
+			*value = applyLut(lut.data(), *value, 0.0f, (float)bins, bins);
+		}
+	});
+}
+
+// caps every bin at limit and hands what was cut off back to all bins
+// evenly, which bounds the slope of the cumulative curve.
+inline void clipHistogram(float* counts, int bins, float limit)
+{
+	// the redistributed share can push bins over the limit again, a few
+	// rounds get the excess to within a pixel
+	for (int round = 0; round < 4; round++) {
+		float excess = 0.0f;
+		for (int b = 0; b < bins; b++) {
+			if (counts[b] > limit) {
+				excess += counts[b] - limit;
+				counts[b] = limit;
+			}
+		}
+		if (excess < 1.0f) {
+			return;
+		}
+		float share = excess / bins;
+		for (int b = 0; b < bins; b++) {
+			counts[b] += share;
+		}
+	}
+}
+
+// contrast limited adaptive histogram equalization of the intensity of an
+// hsi image. every tile of a tilesX x tilesY grid gets its own clipped
+// equalization curve, each pixel blends the curves of the four tile
+// centers around it. clipLimit is in multiples of the mean bin count, 1
+// leaves the image as it is, larger values allow more contrast.
+inline void claheIntensity(Image& image, float clipLimit, int tilesX = 8, int tilesY = 8, int bins = 256, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("claheIntensity", "image");
+	ASSERT(!image.rgb);
+
+	tilesX = tilesX < image.width ? tilesX : image.width;
+	tilesY = tilesY < image.height ? tilesY : image.height;
+	float tileWidth = (float)image.width / tilesX;
+	float tileHeight = (float)image.height / tilesY;
+	int tiles = tilesX * tilesY;
+	std::vector<float> luts((size_t)tiles * (bins + 1));
+
+	auto tileLut = [&](int tile) {
+		int tx = tile % tilesX;
+		int ty = tile / tilesX;
+		int x0 = (int)(tx * tileWidth);
+		int x1 = tx + 1 == tilesX ? image.width : (int)((tx + 1) * tileWidth);
+		int y0 = (int)(ty * tileHeight);
+		int y1 = ty + 1 == tilesY ? image.height : (int)((ty + 1) * tileHeight);
+
+		std::vector<u32> copies((size_t)bins * HISTOGRAM_COPIES, 0);
+		countRows(image, HSI_INTENSITY, x0, x1, y0, y1, bins, 0.0f, 1.0f, copies.data());
+		std::vector<float> counts(bins, 0.0f);
+		for (size_t i = 0; i < copies.size(); i++) {
+			counts[i % bins] += copies[i];
+		}
+
+		float limit = clipLimit * (x1 - x0) * (y1 - y0) / bins;
+		clipHistogram(counts.data(), bins, limit > 1.0f ? limit : 1.0f);
+		cumulativeLut(counts.data(), bins, &luts[(size_t)tile * (bins + 1)]);
+	};
+
+	if (pool) {
+		pool->parallelFor(tiles, tileLut);
+	}
+	else {
+		for (int tile = 0; tile < tiles; tile++) {
+			tileLut(tile);
+		}
+	}
+
+	// tile centers are at (t + 0.5) * size, outside the outermost centers
+	// the nearest curve is used as is
+	auto neighbours = [](float position, float size, int count, int& t0, int& t1, float& weight) {
+		float t = position / size - 0.5f;
+		t0 = (int)floorf(t);
+		weight = t - t0;
+		t1 = t0 + 1;
+		t0 = t0 < 0 ? 0 : (t0 >= count ? count - 1 : t0);
+		t1 = t1 < 0 ? 0 : (t1 >= count ? count - 1 : t1);
+	};
+
+	// the same for every row
+	std::vector<int> columnTiles((size_t)image.width * 2);
+	std::vector<float> columnWeights(image.width);
+	for (int x = 0; x < image.width; x++) {
+		neighbours(x + 0.5f, tileWidth, tilesX, columnTiles[x * 2], columnTiles[x * 2 + 1], columnWeights[x]);
+	}
+
+	forEachHistogramBand(image.height, pool, [&](int y0, int y1) {
+		// the curves of both tile rows around y blended once per row, each
+		// pixel then reads two curves instead of four
+		std::vector<float> rowLuts((size_t)tilesX * (bins + 1));
+		for (int y = y0; y < y1; y++) {
+			int ty0, ty1;
+			float wy;
+			neighbours(y + 0.5f, tileHeight, tilesY, ty0, ty1, wy);
+			for (int tx = 0; tx < tilesX; tx++) {
+				const float* above = &luts[(size_t)(ty0 * tilesX + tx) * (bins + 1)];
+				const float* below = &luts[(size_t)(ty1 * tilesX + tx) * (bins + 1)];
+				float* blended = &rowLuts[(size_t)tx * (bins + 1)];
+				for (int b = 0; b <= bins; b++) {
+					blended[b] = above[b] + wy * (below[b] - above[b]);
+				}
+			}
+
+			float* row = &image.data[(size_t)y * image.width * image.channels + HSI_INTENSITY];
+			for (int x = 0; x < image.width; x++) {
+				float* value = &row[x * image.channels];
+				float left = applyLut(&rowLuts[(size_t)columnTiles[x * 2] * (bins + 1)], *value, 0.0f, (float)bins, bins);
+				float right = applyLut(&rowLuts[(size_t)columnTiles[x * 2 + 1] * (bins + 1)], *value, 0.0f, (float)bins, bins);
+				*value = left + columnWeights[x] * (right - left);
+			}
+		}
+	});
+}
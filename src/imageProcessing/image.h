@@ -0,0 +1,218 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <stb_image.h>
+
+#include <common.h>
+#include <trace.h>
+
+#ifndef PI
+#define PI 3.14159265359f
+#endif
+
+// sse2 is always there on x64. kernels that use it keep a scalar path for
+// everything else.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// cpu side images and the rgb <-> hsi conversions, shared by the demo and
+// the benchmarks. define STB_IMAGE_IMPLEMENTATION in exactly one file
+// before including this.
+struct Image 
+{
+	int width, height, channels;
+	bool rgb;
+	float* data;
+};
+
+// stbi_loadf turns 8 and 16 bit files into linear floats with this gamma,
+// the 8 bit writers encode with it again. alpha stays linear.
+const float LDR_GAMMA = 2.2f;
+
+// channels to decode a file with stb's channel count into: rgb, plus
+// alpha when the file has it. grey is spread over rgb.
+inline int rgbChannels(int fileChannels)
+{
+	return fileChannels == 2 || fileChannels == 4 ? 4 : 3;
+}
+
+inline Image loadImage(const char* file, int desiredChannels) 
+{
+	TRACE_SCOPE_DETAIL("loadImage", "asset", file);
+
+	Image image = {};
+	image.channels = desiredChannels;
+	image.rgb = true;
+
+	char imagePath[255];
+	sprintf_s(imagePath, "%s%s", DATA_DIR, file);
+
+	int unused;
+	image.data = stbi_loadf(imagePath, &image.width, &image.height, &unused, desiredChannels);
+	ASSERT(image.data);
+
+	return image;
+}
+
+// a file in memory to linear floats, rgb files stay rgb and only files
+// with alpha pay for a fourth channel. data is null when stb can't read it.
+inline Image decodeImage(const u8* encoded, int size)
+{
+	Image image = {};
+	int fileChannels = 4;
+	stbi_info_from_memory(encoded, size, &image.width, &image.height, &fileChannels);
+	image.channels = rgbChannels(fileChannels);
+	image.rgb = true;
+	image.data = stbi_loadf_from_memory(encoded, size, &image.width, &image.height, &fileChannels, image.channels);
+	return image;
+}
+
+// per pixel conversions of the first three channels, the whole image
+// versions below and the fused op graph share them.
+inline void rgbToHsi(const float* source, float* dest)
+{
+	float min = source[0];
+	// ignore alpha, dont compare r with r.
+	for (int i = 1; i < 3; i++) {
+		if (min > source[i]) {
+			min = source[i];
+		}
+	}
+	float r = source[0];
+	float g = source[1];
+	float b = source[2];
+
+	float rgbSum = (r + g + b);
+	float intensity = rgbSum / 3.0f;
+
+	// black has no saturation either, 0 / 0 would leave nan for filters to spread
+	float saturation = rgbSum > 0.0f ? 1.0f - (3.0f / rgbSum) * min : 0.0f;
+	double denominator = sqrt((r - g) * (r - g) + (r - b) * (g - b));
+	// grey has no hue, keep it 0 instead of nan
+	double angle = denominator > 0.0 ? (r - 0.5f * g - 0.5f * b) / denominator : 1.0;
+	float hue = (float)acos(angle < -1.0 ? -1.0 : (angle > 1.0 ? 1.0 : angle));
+	
+	// acos only covers half the circle
+	if (b > g) {
+		hue = 2.0f * PI - hue;
+	}
+	
+	dest[0] = hue;
+	dest[1] = saturation;
+	dest[2] = intensity;
+}
+
+inline void hsiToRgb(const float* source, float* dest)
+{
+	float hue = source[0];
+	float saturation = source[1];
+	float intensity = source[2];
+
+	float r, g, b;
+
+	float epsilon = 0.05f;
+	if (intensity <= epsilon) {
+		//black
+		r = 0.0f;
+		g = 0.0f;
+		b = 0.0f;
+	}
+	else if (saturation <= epsilon) {
+		// grey scale
+		r = intensity;
+		g = intensity;
+		b = intensity;
+	}
+	else {
+		if (hue < 0.0f) {
+			hue += 2.0f * PI;
+		}
+
+		float scale = 3.0f * intensity;
+					// 120deg
+		if (hue <= PI * 2.0f / 3.0f) {
+			float angle1 = hue;
+							// 60deg
+			float angle2 = (PI / 3.0f - hue);
+			b = (1.0f - saturation) / 3.0f * scale;
+			r = (1.0f + (saturation * cos(angle1) / cos(angle2))) / 3.0f * scale;
+			g = scale - r - b;
+		}				// 120deg					// 240deg
+		else if (hue > PI * 2.0f / 3.0f && hue <= PI * 4.0f / 3.0f) {
+			hue -= PI * 2.0f / 3.0f;
+			float angle1 = hue;
+			float angle2 = (PI / 3.0f - hue);
+
+			r = (1.0f - saturation) / 3.0f * scale;
+			g = (1.0f + (saturation * cos(angle1) / cos(angle2))) / 3.0f * scale;
+			b = scale - r - g;
+		}
+		else {
+			hue -= PI * 4.0f / 3.0f;
+			float angle1 = hue;
+			float angle2 = (PI / 3.0f - hue);
+
+			g = (1.0f - saturation) / 3.0f * scale;
+			b = (1.0f + (saturation * cos(angle1) / cos(angle2))) / 3.0f * scale;
+			r = scale - g - b;
+		}
+	}
+	
+	dest[0] = r;
+	dest[1] = g;
+	dest[2] = b;
+}
+
+inline Image toHSI(Image sourceImage)
+{
+	TRACE_SCOPE("toHSI", "image");
+	ASSERT(sourceImage.rgb);
+	Image destImage = sourceImage;
+	destImage.data = (float*)malloc(sizeof(float) * destImage.height * destImage.width * sourceImage.channels);
+	destImage.rgb = false;
+
+	for (int y = 0; y < sourceImage.height; y++) {
+		for (int x = 0; x < sourceImage.width; x++) {
+			float* dest = &destImage.data[x * destImage.height * sourceImage.channels + y * sourceImage.channels];
+			float* source = &sourceImage.data[x * destImage.height * sourceImage.channels + y * sourceImage.channels];
+
+			if (sourceImage.channels == 4) {
+				// flat copy of the alpha
+				dest[3] = source[3];
+			}
+
+			rgbToHsi(source, dest);
+		}
+	}
+
+	return destImage;
+}
+
+inline Image toRGB(Image sourceImage) {
+	TRACE_SCOPE("toRGB", "image");
+	ASSERT(!sourceImage.rgb);
+	Image destImage = sourceImage;
+	destImage.data = (float*)malloc(sizeof(float) * destImage.height * destImage.width * sourceImage.channels);
+	destImage.rgb = true;
+
+	for (int y = 0; y < sourceImage.height; y++) {
+		for (int x = 0; x < sourceImage.width; x++) {
+			float* dest = &destImage.data[x * destImage.height * sourceImage.channels + y * sourceImage.channels];
+			float* source = &sourceImage.data[x * destImage.height * sourceImage.channels + y * sourceImage.channels];
+
+			if (sourceImage.channels == 4) {
+				// flat copy of the alpha
+				dest[3] = source[3];
+			}
+
+			hsiToRgb(source, dest);
+		}
+	}
+
+	return destImage;
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "image.h"
+
+// summed area tables: sums over any rectangle in four reads. the sums are
+// doubles, floats would lose the small values of a large image long before
+// the last row.
+
+// rows per task
+const int INTEGRAL_BAND_ROWS = 64;
+
+// (width + 1) x (height + 1) entries of channels doubles, entry (x, y) is
+// the sum of the pixels above and left of it, so row and column 0 are 0.
+struct SummedAreaTable
+{
+	int width, height, channels;
+	std::vector<double> sums;
+	// sums of squared values, empty unless asked for
+	std::vector<double> squares;
+
+	size_t index(int x, int y) const
+	{
+		return ((size_t)y * (this->width + 1) + x) * this->channels;
+	}
+};
+
+// running sum of every channel along a row plus the table row above it,
+// written one entry right of the pixel it includes.
+inline void integrateRow(const float* row, int width, int channels, bool square, const double* above, double* dest)
+{
+	double running[4] = {};
+	memset(dest, 0, sizeof(double) * channels);
+	for (int x = 0; x < width; x++) {
+		for (int c = 0; c < channels; c++) {
+			double value = row[x * channels + c];
+			running[c] += square ? value * value : value;
+			dest[(x + 1) * channels + c] = running[c] + above[(x + 1) * channels + c];
+		}
+	}
+}
+
+// dest[i] += add[i] over count doubles.
+inline void addDoubles(double* dest, const double* add, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGE_SSE2
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_pd(&dest[i], _mm_add_pd(_mm_loadu_pd(&dest[i]), _mm_loadu_pd(&add[i])));
+		_mm_storeu_pd(&dest[i + 2], _mm_add_pd(_mm_loadu_pd(&dest[i + 2]), _mm_loadu_pd(&add[i + 2])));
+	}
+#endif
+	for (; i < count; i++) {
+		dest[i] += add[i];
+	}
+}
+
+// a parallel scan over bands of rows: every band builds the table of its
+// own rows as if it started the image, then the last rows are chained from
+// band to band and each band adds the total of the bands above it. both
+// passes walk memory in order.
+inline void integrate(const Image& image, bool square, std::vector<double>& table, ThreadPool* pool)
+{
+	int channels = image.channels;
+	size_t pitch = (size_t)(image.width + 1) * channels;
+	table.resize(pitch * (image.height + 1));
+	memset(table.data(), 0, sizeof(double) * pitch);
+
+	int bands = (image.height + INTEGRAL_BAND_ROWS - 1) / INTEGRAL_BAND_ROWS;
+	std::vector<double> zeros(pitch, 0.0);
+	auto local = [&](int b) {
+		int y0 = b * INTEGRAL_BAND_ROWS;
+		int y1 = y0 + INTEGRAL_BAND_ROWS < image.height ? y0 + INTEGRAL_BAND_ROWS : image.height;
+		for (int y = y0; y < y1; y++) {
+			const double* above = y == y0 ? zeros.data() : &table[y * pitch];
+			integrateRow(&image.data[(size_t)y * image.width * channels], image.width, channels, square, above, &table[(y + 1) * pitch]);
+		}
+	};
+
+	// carries[b] is the sum of every band above band b
+	std::vector<double> carries(pitch * bands, 0.0);
+	auto carry = [&](int b) {
+		int y0 = b * INTEGRAL_BAND_ROWS;
+		int y1 = y0 + INTEGRAL_BAND_ROWS < image.height ? y0 + INTEGRAL_BAND_ROWS : image.height;
+		for (int y = y0; y < y1; y++) {
+			addDoubles(&table[(y + 1) * pitch], &carries[b * pitch], pitch);
+		}
+	};
+
+	if (pool) {
+		pool->parallelFor(bands, local);
+	}
+	else {
+		for (int b = 0; b < bands; b++) {
+			local(b);
+		}
+	}
+
+	for (int b = 1; b < bands; b++) {
+		memcpy(&carries[b * pitch], &carries[(b - 1) * pitch], sizeof(double) * pitch);
+		addDoubles(&carries[b * pitch], &table[(size_t)b * INTEGRAL_BAND_ROWS * pitch], pitch);
+	}
+
+	if (pool) {
+		pool->parallelFor(bands - 1, [&](int b) { carry(b + 1); });
+	}
+	else {
+		for (int b = 1; b < bands; b++) {
+			carry(b);
+		}
+	}
+}
+
+// squares too when the variance queries are needed.
+inline SummedAreaTable buildSummedAreaTable(const Image& image, bool squares = false, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("buildSummedAreaTable", "image");
+	SummedAreaTable table;
+	table.width = image.width;
+	table.height = image.height;
+	table.channels = image.channels;
+	integrate(image, false, table.sums, pool);
+	if (squares) {
+		integrate(image, true, table.squares, pool);
+	}
+	return table;
+}
+
+// clamps [x0, x1) x [y0, y1) to the image, returns the pixel count.
+inline int clampRect(const SummedAreaTable& table, int& x0, int& y0, int& x1, int& y1)
+{
+	x0 = x0 < 0 ? 0 : (x0 > table.width ? table.width : x0);
+	x1 = x1 < x0 ? x0 : (x1 > table.width ? table.width : x1);
+	y0 = y0 < 0 ? 0 : (y0 > table.height ? table.height : y0);
+	y1 = y1 < y0 ? y0 : (y1 > table.height ? table.height : y1);
+	return (x1 - x0) * (y1 - y0);
+}
+
+inline double rectSum(const SummedAreaTable& table, const std::vector<double>& sums, int x0, int y0, int x1, int y1, int channel)
+{
+	return sums[table.index(x1, y1) + channel] - sums[table.index(x0, y1) + channel]
+		- sums[table.index(x1, y0) + channel] + sums[table.index(x0, y0) + channel];
+}
+
+// sum of one channel over [x0, x1) x [y0, y1), the part outside the image
+// counts as nothing.
+inline double rectSum(const SummedAreaTable& table, int x0, int y0, int x1, int y1, int channel)
+{
+	clampRect(table, x0, y0, x1, y1);
+	return rectSum(table, table.sums, x0, y0, x1, y1, channel);
+}
+
+// mean of the pixels of the rectangle inside the image, 0 when none are.
+inline float rectMean(const SummedAreaTable& table, int x0, int y0, int x1, int y1, int channel)
+{
+	int count = clampRect(table, x0, y0, x1, y1);
+	return count ? (float)(rectSum(table, table.sums, x0, y0, x1, y1, channel) / count) : 0.0f;
+}
+
+// population variance over the same pixels, needs a table built with squares.
+inline float rectVariance(const SummedAreaTable& table, int x0, int y0, int x1, int y1, int channel)
+{
+	ASSERT(!table.squares.empty());
+	int count = clampRect(table, x0, y0, x1, y1);
+	if (!count) {
+		return 0.0f;
+	}
+	double mean = rectSum(table, table.sums, x0, y0, x1, y1, channel) / count;
+	double variance = rectSum(table, table.squares, x0, y0, x1, y1, channel) / count - mean * mean;
+	// cancellation can leave a tiny negative
+	return variance > 0.0 ? (float)variance : 0.0f;
+}
+
+// rectangle sums come from four lookups in a table whose entries reach the
+// whole image's sum, they cancel to a few ulps of that rather than to 0.
+// comparisons against a sum allow this much.
+const double INTEGRAL_CANCEL_EPSILON = 1e-6;
+
+// bradley's adaptive threshold of every channel but alpha: 1 where the
+// value is above (1 - t) times the mean of the (2 * radius + 1)^2 window
+// around it, 0 otherwise. returns a new image the caller frees.
+inline Image adaptiveThreshold(const Image& source, int radius, float t = 0.15f, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("adaptiveThreshold", "image");
+	SummedAreaTable table = buildSummedAreaTable(source, false, pool);
+	Image dest = source;
+	dest.data = (float*)malloc(sizeof(float) * source.width * source.height * source.channels);
+	int colors = source.channels == 4 ? 3 : source.channels;
+
+	int bands = (source.height + INTEGRAL_BAND_ROWS - 1) / INTEGRAL_BAND_ROWS;
+	auto band = [&](int b) {
+		int y0 = b * INTEGRAL_BAND_ROWS;
+		int y1 = y0 + INTEGRAL_BAND_ROWS < source.height ? y0 + INTEGRAL_BAND_ROWS : source.height;
+		for (int y = y0; y < y1; y++) {
+			for (int x = 0; x < source.width; x++) {
+				size_t i = ((size_t)y * source.width + x) * source.channels;
+				int wx0 = x - radius, wy0 = y - radius, wx1 = x + radius + 1, wy1 = y + radius + 1;
+				int count = clampRect(table, wx0, wy0, wx1, wy1);
+				for (int c = 0; c < colors; c++) {
+					// compared as sums, a mean of black can come out a tiny
+					// negative and 0 > -tiny would set it
+					double sum = rectSum(table, table.sums, wx0, wy0, wx1, wy1, c);
+					dest.data[i + c] = (double)source.data[i + c] * count > sum * (1.0 - t) + INTEGRAL_CANCEL_EPSILON ? 1.0f : 0.0f;
+				}
+				if (colors < source.channels) {
+					dest.data[i + 3] = source.data[i + 3];
+				}
+			}
+		}
+	};
+
+	if (pool) {
+		pool->parallelFor(bands, band);
+	}
+	else {
+		for (int b = 0; b < bands; b++) {
+			band(b);
+		}
+	}
+	return dest;
+}
@@ -4,290 +4,26 @@
 #include <stdio.h>
 #include <math.h>
 
+#include <frameLoop.h>
+#include <meshArena.h>
+#include <meshOptimizer.h>
+#include <vertexFormat.h>
+
+// image.h pulls in stb_image
 #define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
+#include "image.h"
+#include "gpu.h"
+#include "colorLut.h"
+#include "gpuFilters.h"
+#include "resample.h"
 
 const int WIDTH = 800;
 const int HEIGHT = 400;
 
 typedef unsigned int u32;
 
-#define PI 3.14159265359f
 #define ASSERT(test) if (!(test)) { *(int*)0 = 0; }
 
-bool createShader(const char* shaderSource, GLuint shaderType, int& outShader) 
-{
-
-	outShader = glCreateShader(shaderType);
-	glShaderSource(outShader, 1, &shaderSource, nullptr);
-	glCompileShader(outShader);
-
-	int success = 0;
-	char infoLog[512];
-	glGetShaderiv(outShader, GL_COMPILE_STATUS, &success);
-
-	if (!success) {
-		glGetShaderInfoLog(outShader, 512, nullptr, infoLog);
-		printf("failed to compile vertex shader: \n%s", infoLog);
-		glDeleteShader(outShader);
-		return false;
-	}
-
-	return true;
-}
-
-struct Pipeline {
-	u32 id;
-
-	Pipeline(const char* vertexSource, const char* fragmentSource) 
-	{
-
-		u32 id;
-		int vertexShader = 0;
-		if (!createShader(vertexSource, GL_VERTEX_SHADER, vertexShader)) {
-			printf("Failed to create and compile vertex shader\n");
-			return;
-		}
-
-		int fragmentShader = 0;
-		if (!createShader(fragmentSource, GL_FRAGMENT_SHADER, fragmentShader)) {
-			printf("Failed to create and compile fragment shader\n");
-			return;
-		}
-
-		// pipeline
-		id = glCreateProgram();
-		glAttachShader(id, vertexShader);
-		glAttachShader(id, fragmentShader);
-		glLinkProgram(id);
-
-		int success = 0;
-		char infoLog[512];
-		glGetProgramiv(id, GL_LINK_STATUS, &success);
-
-		if (!success) {
-			glGetProgramInfoLog(id, 512, nullptr, infoLog);
-			printf("failed to compile vertex shader: \n%s", infoLog);
-			glDeleteProgram(id);
-			return;
-		}
-
-		this->id = id;
-	}
-
-	void use() 
-	{
-		glUseProgram(this->id);
-	}
-
-	void setUniform(const char* name, int value) 
-	{
-		u32 location = glGetUniformLocation(this->id, name);
-		glUniform1i(location, value);
-	}
-
-	void setUniform(const char* name, bool value) 
-	{
-		this->setUniform(name, (int)value);
-	}
-
-	void setUniform(const char* name, float value) 
-	{
-		u32 location = glGetUniformLocation(this->id, name);
-		u32 error = glGetError();
-		glUniform1f(location, value);
-		u32 error1 = glGetError();
-	}
-};
-
-struct Image 
-{
-	int width, height, channels;
-	bool rgb;
-	float* data;
-};
-
-Image loadImage(const char* file, int desiredChannels) 
-{
-	Image image = {};
-	image.channels = desiredChannels;
-	image.rgb = true;
-
-	char imagePath[255];
-	sprintf_s(imagePath, "%s%s", DATA_DIR, file);
-
-	int unused;
-	image.data = stbi_loadf(imagePath, &image.width, &image.height, &unused, desiredChannels);
-	ASSERT(image.data);
-
-	return image;
-}
-
-Image toHSI(Image sourceImage)
-{
-	ASSERT(sourceImage.rgb);
-	Image destImage = sourceImage;
-	destImage.data = (float*)malloc(sizeof(float) * destImage.height * destImage.width * sourceImage.channels);
-	destImage.rgb = false;
-
-	for (int y = 0; y < sourceImage.height; y++) {
-		for (int x = 0; x < sourceImage.width; x++) {
-			float* dest = &destImage.data[x * destImage.height * sourceImage.channels + y * sourceImage.channels];
-			float* source = &sourceImage.data[x * destImage.height * sourceImage.channels + y * sourceImage.channels];
-
-			if (sourceImage.channels == 4) {
-				// flat copy of the alpha
-				dest[3] = source[3];
-			}
-
-			float min = source[0];
-			// ignore alpha, dont compare r with r.
-			for (int i = 1; i < 3; i++) {
-				if (min > source[i]) {
-					min = source[i];
-				}
-			}
-			float r = source[0];
-			float g = source[1];
-			float b = source[2];
-
-			float rgbSum = (r + g + b);
-			float intensity = rgbSum / 3.0f;
-
-			float saturation = 1.0f - (3.0f / rgbSum) * min;
-			double angle = (r - 0.5f * g - 0.5f * b) / sqrt((r - g) * (r - g) + (r - b) * (g - b));
-			float hue = (float)acos(angle);
-			
-			if (hue > 2.0f * PI) {
-				hue = 2.0f * PI - hue;
-			}
-			
-			dest[0] = hue;
-			dest[1] = saturation;
-			dest[2] = intensity;
-		}
-	}
-
-	return destImage;
-}
-
-Image toRGB(Image sourceImage) {
-	ASSERT(!sourceImage.rgb);
-	Image destImage = sourceImage;
-	destImage.data = (float*)malloc(sizeof(float) * destImage.height * destImage.width * sourceImage.channels);
-	destImage.rgb = true;
-
-	for (int y = 0; y < sourceImage.height; y++) {
-		for (int x = 0; x < sourceImage.width; x++) {
-			float* dest = &destImage.data[x * destImage.height * sourceImage.channels + y * sourceImage.channels];
-			float* source = &sourceImage.data[x * destImage.height * sourceImage.channels + y * sourceImage.channels];
-
-			if (sourceImage.channels == 4) {
-				// flat copy of the alpha
-				dest[3] = source[3];
-			}
-
-			float hue = source[0];
-			float saturation = source[1];
-			float intensity = source[2];
-
-			float r, g, b;
-
-			float epsilon = 0.05f;
-			if (intensity <= epsilon) {
-				//black
-				r = 0.0f;
-				g = 0.0f;
-				b = 0.0f;
-			}
-			else if (saturation <= epsilon) {
-				// grey scale
-				r = intensity;
-				g = intensity;
-				b = intensity;
-			}
-			else {
-				if (hue < 0.0f) {
-					hue += 2.0f * PI;
-				}
-
-				float scale = 3.0f * intensity;
-							// 120deg
-				if (hue <= PI * 2.0f / 3.0f) {
-					float angle1 = hue;
-									// 60deg
-					float angle2 = (PI / 3.0f - hue);
-					b = (1.0f - saturation) / 3.0f * scale;
-					r = (1.0f + (saturation * cos(angle1) / cos(angle2))) / 3.0f * scale;
-					g = (1.0f - r - b) * scale;
-				}				// 120deg					// 240deg
-				else if (hue > PI * 2.0f / 3.0f && hue <= PI * 4.0f / 3.0f) {
-					hue -= PI * 2.0f / 3.0f;
-					float angle1 = hue;
-					float angle2 = (PI / 3.0f - hue);
-
-					r = (1.0f - saturation) / 3.0f * scale;
-					g = (1.0f + (saturation * cos(angle1) / cos(angle2))) / 3.0f * scale;
-					b = (1.0f - r - g) * scale;
-				}
-				else {
-					hue -= PI * 4.0f / 3.0f;
-					float angle1 = hue;
-					float angle2 = (PI / 3.0f - hue);
-
-					g = (1.0f - saturation) / 3.0f * scale;
-					b = (1.0f + (saturation * cos(angle1) / cos(angle2))) / 3.0f * scale;
-					r = (1.0f - g - b) * scale;
-				}
-			}
-			
-			dest[0] = r;
-			dest[1] = g;
-			dest[2] = b;
-		}
-	}
-
-	return destImage;
-}
-
-struct Texture 
-{
-	u32 id;
-	int width, height;
-
-	Texture(Image image) 
-	{
-		this->height = image.height;
-		this->width = image.width;
-
-		glGenTextures(1, &this->id);
-		glBindTexture(GL_TEXTURE_2D, this->id);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-
-		u32 format = GL_RGBA;
-		if (image.channels == 3) {
-			format = GL_RGB;
-		}
-
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, this->width, this->height, 0, format, GL_FLOAT, image.data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-	}
-
-	Texture(const char* file, u32 channels) 
-	{
-		Image image = loadImage(file, channels);
-		*this = Texture(image);
-		stbi_image_free(image.data);
-	}
-
-
-};
-
 int singleTexture(GLFWwindow* window) 
 {
 
@@ -309,31 +45,12 @@ int singleTexture(GLFWwindow* window)
 		-0.5f + offset,  1.0f, 0.0f,	0.0f, 1.0f    // top left 
 	};
 
+	// shared by both quads
 	u32 indices[] = {
 		0, 1, 3,
-		1, 2, 3,
-
-		4, 5, 7,
-		5, 6, 7
+		1, 2, 3
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-	u32 ebo;
-	glGenBuffers(1, &ebo);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
 	// vertex shader
 	const char* vertexShaderSource = R"(
 		#version 330 core
@@ -392,13 +109,25 @@ int singleTexture(GLFWwindow* window)
 		return -5;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	Image image = loadImage("/color-face.jpg", 4);
+	// one mesh per quad, optimized separately but packed with one format
+	MeshData leftData = MeshData::from(vertices, 4, 5 * sizeof(float), indices, 6);
+	MeshData rightData = MeshData::from(vertices + 20, 4, 5 * sizeof(float), indices, 6);
+	optimizeMesh(leftData, 0, "singleTexture");
+	optimizeMesh(rightData, 0);
+
+	std::vector<u8> quadVertices = leftData.vertices;
+	quadVertices.insert(quadVertices.end(), rightData.vertices.begin(), rightData.vertices.end());
+
+	// vertex and index storage, packed down to what the pipeline reads
+	PackedVertices packed = packVertices(VertexFormat::floats(3, 2), quadVertices.data(), 8, normalPipeline.id);
+	packed.print("singleTexture");
+	MeshArena arena = MeshArena(packed.format, indexTypeFor(4));
+	Mesh left = arena.allocate(packed.data.data(), 4, leftData.indices.data(), 6);
+	Mesh right = arena.allocate(packed.data.data() + 4 * packed.format.stride, 4, rightData.indices.data(), 6);
+
+	// the photo is 5616 pixels tall, scaled once to what the quad shows
+	// instead of uploading it whole and leaving it to the mipmaps
+	Image image = fitImage(loadImage("/color-face.jpg", 4), WIDTH / 2, HEIGHT, RESAMPLE_LANCZOS3, &threadPool());
 	Image hsiImage = toHSI(image);
 	Image rgbImage = toRGB(hsiImage); // should be same as original
 
@@ -407,37 +136,145 @@ int singleTexture(GLFWwindow* window)
 	Texture rgbTexture = Texture(rgbImage);
 	
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 
 		normalPipeline.use();
 
 		normalPipeline.setUniform("uWidth", texture.width);
 		normalPipeline.setUniform("uHeight", texture.height);
-		glBindVertexArray(vao);
+		arena.bind();
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, texture.id);
 
 		//draw
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		{
+			PROFILE_GPU("original");
+			arena.draw(left);
+		}
 
 		//processingPipeline.use();
 		//processingPipeline.setUniform("uWidth", texture.width);
 		//processingPipeline.setUniform("uHeight", texture.height);
 		glBindTexture(GL_TEXTURE_2D, rgbTexture.id);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)(6 * sizeof(int)));
+		{
+			PROFILE_GPU("round trip");
+			arena.draw(right);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
+	stbi_image_free(image.data);
+	return 0;
+}
+
+// the round trip of singleTexture plus adjustments, all as gpu passes.
+// up/down scale intensity, left/right rotate hue, w/s scale saturation,
+// 0-9 set the blur radius. holding l runs the color steps as one lookup in
+// a lut baked from the same math on the cpu.
+int gpuProcessing(GLFWwindow* window)
+{
+	glClearColor(0.7f, 0.3f, 0.7f, 1.0f);
+
+	Image image = fitImage(loadImage("/color-face.jpg", 4), WIDTH / 2, HEIGHT, RESAMPLE_LANCZOS3, &threadPool());
+	Texture texture = Texture(image);
 	stbi_image_free(image.data);
+
+	GpuFilters filters;
+	if (!filters.init(texture.width, texture.height)) {
+		filters.destroy();
+		return -5;
+	}
+	printf("gpuProcessing: %s blurs\n", filters.blurCompute ? "compute" : "fragment");
+
+	GpuStep steps[] = {
+		{ GPU_HSI, 0.0f },
+		{ GPU_INTENSITY, 1.2f },
+		{ GPU_SATURATION, 1.0f },
+		{ GPU_HUE, 0.0f },
+		{ GPU_RGB, 0.0f },
+		{ GPU_BLUR, 2.0f },
+	};
+	GpuStep& intensity = steps[1];
+	GpuStep& saturation = steps[2];
+	GpuStep& hue = steps[3];
+	GpuStep& blur = steps[5];
+	GpuStep bakedSteps[] = {
+		{ GPU_LUT, 0.0f },
+		{ GPU_BLUR, 2.0f },
+	};
+	float bakedValues[3] = {};
+
+	double last = frameTime();
+	while (beginFrame(window)) {
+		float dt = (float)(frameTime() - last);
+		last = frameTime();
+
+		intensity.value *= 1.0f + dt * (glfwGetKey(window, GLFW_KEY_UP) - glfwGetKey(window, GLFW_KEY_DOWN));
+		saturation.value *= 1.0f + dt * (glfwGetKey(window, GLFW_KEY_W) - glfwGetKey(window, GLFW_KEY_S));
+		hue.value += dt * (glfwGetKey(window, GLFW_KEY_RIGHT) - glfwGetKey(window, GLFW_KEY_LEFT));
+		for (int key = GLFW_KEY_0; key <= GLFW_KEY_9; key++) {
+			if (glfwGetKey(window, key) == GLFW_PRESS) {
+				blur.value = (float)(key - GLFW_KEY_0);
+			}
+		}
+
+		u32 result;
+		if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS) {
+			float values[3] = { intensity.value, saturation.value, hue.value };
+			if (memcmp(values, bakedValues, sizeof(values)) != 0) {
+				memcpy(bakedValues, values, sizeof(values));
+				filters.setLut(bakeColorLut(COLOR_LUT_SIZE, [&values](float* pixels, int count, int channels) {
+					for (int i = 0; i < count; i++) {
+						float* p = &pixels[i * channels];
+						rgbToHsi(p, p);
+						p[2] *= values[0];
+						p[1] = fminf(p[1] * values[1], 1.0f);
+						p[0] = fmodf(p[0] + values[2] + 4.0f * PI, 2.0f * PI);
+						hsiToRgb(p, p);
+					}
+				}, &threadPool()));
+			}
+			bakedSteps[1].value = blur.value;
+			result = filters.run(texture.id, bakedSteps, sizeof(bakedSteps) / sizeof(bakedSteps[0]));
+		}
+		else {
+			result = filters.run(texture.id, steps, sizeof(steps) / sizeof(steps[0]));
+		}
+
+		glClear(GL_COLOR_BUFFER_BIT);
+		int viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		{
+			PROFILE_GPU("original");
+			filters.draw(texture.id, viewport[0], viewport[1], viewport[2] / 2, viewport[3]);
+		}
+		{
+			PROFILE_GPU("processed");
+			filters.draw(result, viewport[0] + viewport[2] / 2, viewport[1], viewport[2] / 2, viewport[3]);
+		}
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+		endFrame(window);
+	}
+
+	filters.destroy();
+	glDeleteTextures(1, &texture.id);
 	return 0;
 }
 
+// every demo by name, for --demo.
+const Demo demos[] = {
+	{ "singleTexture", singleTexture },
+	{ "gpuProcessing", gpuProcessing },
+};
+
 int main(int argc, char* argv[])
 {
 	int result = 0;
+	initFrameLoop(argc, argv);
 	stbi_set_flip_vertically_on_load(true);
 
 	glfwSetErrorCallback(
@@ -456,6 +293,7 @@ int main(int argc, char* argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	setFrameLoopWindowHints();
 
 	GLFWwindow* window = glfwCreateWindow(WIDTH,
 											HEIGHT,
@@ -476,18 +314,28 @@ int main(int argc, char* argv[])
 		goto gladLoadGLFail;
 	}
 
+	if (!initRenderTarget(WIDTH, HEIGHT)) {
+		result = -4;
+		goto gladLoadGLFail;
+	}
+
 	// turn on the different render outputs by changing the falses to 
 	// true. very primitive but quick to prototype.
-	if (true) {
+	if (frameLoop().demo) {
+		result = runDemos(window, demos, sizeof(demos) / sizeof(demos[0]));
+	}
+	else if (true) {
 		result = singleTexture(window);
 	}
 	else if (false) {
-		result = 0;
+		result = gpuProcessing(window);
 	}
 	else {
 		result = 0;
 	}
 
+	shutdownFrameLoop();
+
 	// exit
 gladLoadGLFail:
 	glfwDestroyWindow(window);
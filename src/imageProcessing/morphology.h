@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "blur.h"
+#include "image.h"
+
+// erosion and dilation of every channel by a (2 * radius + 1)^2 square,
+// with the van herk / gil - werman running min and max: a line is cut into
+// blocks as long as the window, and every window is the combination of a
+// suffix of one block and a prefix of the next, 3 compares per value
+// whatever the radius. the horizontal pass runs on four rows at once, one
+// row per sse2 lane, the vertical pass on whole rows of floats. pixels past
+// the edges are ignored, which is the same as clamping.
+
+enum MorphologyOp
+{
+	MORPH_ERODE,
+	MORPH_DILATE,
+	// erode then dilate, removes bright specks smaller than the square
+	MORPH_OPEN,
+	// dilate then erode, fills dark holes smaller than the square
+	MORPH_CLOSE,
+};
+
+struct MinOp
+{
+	static float identity() { return FLT_MAX; }
+	static float apply(float a, float b) { return a < b ? a : b; }
+#ifdef IMAGE_SSE2
+	static __m128 apply(__m128 a, __m128 b) { return _mm_min_ps(a, b); }
+#endif
+};
+
+struct MaxOp
+{
+	static float identity() { return -FLT_MAX; }
+	static float apply(float a, float b) { return a > b ? a : b; }
+#ifdef IMAGE_SSE2
+	static __m128 apply(__m128 a, __m128 b) { return _mm_max_ps(a, b); }
+#endif
+};
+
+#ifdef IMAGE_SSE2
+template <typename Op>
+Lanes lanesApply(Lanes a, Lanes b) { return Op::apply(a, b); }
+#else
+template <typename Op>
+Lanes lanesApply(Lanes a, Lanes b)
+{
+	for (int i = 0; i < 4; i++) {
+		a.v[i] = Op::apply(a.v[i], b.v[i]);
+	}
+	return a;
+}
+#endif
+
+// rows per task of the horizontal pass, a multiple of 4
+const int MORPH_BAND_ROWS = 32;
+// floats per task of the vertical pass
+const int MORPH_COLUMN_FLOATS = 256;
+
+// van herk / gil - werman over count values of 4 lanes, stride floats
+// apart in source and dest. prefix and suffix hold 4 floats for each of
+// count + 2 * radius values rounded up to whole blocks.
+template <typename Op>
+void vanHerkLine(const float* source, size_t stride, int count, int radius, float* dest, float* prefix, float* suffix)
+{
+	int window = 2 * radius + 1;
+	int extended = count + 2 * radius;
+	int blocks = (extended + window - 1) / window;
+	Lanes identity = lanesSet(Op::identity());
+
+	// value e of the line padded by radius on both sides
+	auto value = [&](int e) {
+		int i = e - radius;
+		return i >= 0 && i < count ? lanesLoad(&source[i * stride]) : identity;
+	};
+
+	for (int b = 0; b < blocks; b++) {
+		int first = b * window;
+		Lanes running = value(first);
+		lanesStore(&prefix[first * 4], running);
+		for (int e = first + 1; e < first + window; e++) {
+			running = lanesApply<Op>(running, value(e));
+			lanesStore(&prefix[e * 4], running);
+		}
+		int last = first + window - 1;
+		running = value(last);
+		lanesStore(&suffix[last * 4], running);
+		for (int e = last - 1; e >= first; e--) {
+			running = lanesApply<Op>(running, value(e));
+			lanesStore(&suffix[e * 4], running);
+		}
+	}
+
+	// the window of x covers padded values [x, x + 2 * radius]
+	for (int x = 0; x < count; x++) {
+		Lanes combined = lanesApply<Op>(lanesLoad(&suffix[x * 4]), lanesLoad(&prefix[(x + 2 * radius) * 4]));
+		lanesStore(&dest[x * stride], combined);
+	}
+}
+
+// along x, four rows at a time. the rows are interleaved into 4 lane
+// vectors, one row per lane, and every channel is one line through them.
+template <typename Op>
+void morphRows(const Image& source, int radius, Image& dest, ThreadPool* pool)
+{
+	int width = source.width;
+	int channels = source.channels;
+	size_t pitch = (size_t)width * channels;
+	int window = 2 * radius + 1;
+	int padded = (width + 2 * radius + window - 1) / window * window;
+
+	blurParallel(source.height, MORPH_BAND_ROWS, pool, [&](int y0, int y1) {
+		std::vector<float> lanes(pitch * 4);
+		std::vector<float> result(pitch * 4);
+		std::vector<float> prefix((size_t)padded * 4);
+		std::vector<float> suffix((size_t)padded * 4);
+
+		for (int y = y0; y < y1; y += 4) {
+			int rows = y1 - y < 4 ? y1 - y : 4;
+			for (size_t i = 0; i < pitch; i++) {
+				for (int r = 0; r < 4; r++) {
+					// short groups repeat their last row
+					int row = y + (r < rows ? r : rows - 1);
+					lanes[i * 4 + r] = source.data[row * pitch + i];
+				}
+			}
+			for (int c = 0; c < channels; c++) {
+				vanHerkLine<Op>(&lanes[c * 4], channels * 4, width, radius, &result[c * 4], prefix.data(), suffix.data());
+			}
+			for (size_t i = 0; i < pitch; i++) {
+				for (int r = 0; r < rows; r++) {
+					dest.data[(y + r) * pitch + i] = result[i * 4 + r];
+				}
+			}
+		}
+	});
+}
+
+// along y in place, MORPH_COLUMN_FLOATS floats of every row at a time,
+// 4 of them per vector.
+template <typename Op>
+void morphColumns(Image& image, int radius, ThreadPool* pool)
+{
+	size_t pitch = (size_t)image.width * image.channels;
+	int window = 2 * radius + 1;
+	int padded = (image.height + 2 * radius + window - 1) / window * window;
+
+	blurParallel((int)pitch, MORPH_COLUMN_FLOATS, pool, [&](int begin, int end) {
+		std::vector<float> prefix((size_t)padded * 4);
+		std::vector<float> suffix((size_t)padded * 4);
+		std::vector<float> column((size_t)image.height * 4);
+
+		for (int i = begin; i < end; i += 4) {
+			int floats = end - i < 4 ? end - i : 4;
+			if (floats == 4) {
+				vanHerkLine<Op>(&image.data[i], pitch, image.height, radius, &image.data[i], prefix.data(), suffix.data());
+				continue;
+			}
+			// the last floats of a row that is not a multiple of 4
+			for (int y = 0; y < image.height; y++) {
+				memset(&column[y * 4], 0, sizeof(float) * 4);
+				memcpy(&column[y * 4], &image.data[y * pitch + i], sizeof(float) * floats);
+			}
+			vanHerkLine<Op>(column.data(), 4, image.height, radius, column.data(), prefix.data(), suffix.data());
+			for (int y = 0; y < image.height; y++) {
+				memcpy(&image.data[y * pitch + i], &column[y * 4], sizeof(float) * floats);
+			}
+		}
+	});
+}
+
+template <typename Op>
+Image morphPass(const Image& source, int radius, ThreadPool* pool)
+{
+	Image dest = source;
+	dest.data = (float*)malloc(sizeof(float) * source.width * source.height * source.channels);
+	morphRows<Op>(source, radius, dest, pool);
+	morphColumns<Op>(dest, radius, pool);
+	return dest;
+}
+
+// returns a new image the caller frees.
+inline Image morphology(const Image& source, MorphologyOp op, int radius, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("morphology", "image");
+	radius = radius < 1 ? 1 : radius;
+
+	switch (op) {
+	case MORPH_ERODE:
+		return morphPass<MinOp>(source, radius, pool);
+	case MORPH_DILATE:
+		return morphPass<MaxOp>(source, radius, pool);
+	case MORPH_OPEN: {
+		Image eroded = morphPass<MinOp>(source, radius, pool);
+		Image opened = morphPass<MaxOp>(eroded, radius, pool);
+		free(eroded.data);
+		return opened;
+	}
+	default: {
+		Image dilated = morphPass<MaxOp>(source, radius, pool);
+		Image closed = morphPass<MinOp>(dilated, radius, pool);
+		free(dilated.data);
+		return closed;
+	}
+	}
+}
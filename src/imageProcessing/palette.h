@@ -0,0 +1,653 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "image.h"
+
+// color quantization: a palette of at most 256 colors picked by median cut
+// over a 5 bit per channel histogram and refined with k-means, then every
+// pixel mapped to its nearest color through a 64^3 lookup table, with
+// optional ordered or floyd - steinberg dithering. only the first three
+// channels count, alpha is dropped.
+
+const int PALETTE_MAX_COLORS = 256;
+// histogram cells per channel
+const int PALETTE_HISTOGRAM_CELLS = 32;
+// lookup table cells per channel, and per channel of a block whose
+// candidate colors are found together
+const int PALETTE_LUT_CELLS = 64;
+const int PALETTE_LUT_BLOCK = 8;
+// rows per task when mapping
+const int PALETTE_BAND_ROWS = 64;
+
+enum PaletteDither
+{
+	PALETTE_DITHER_NONE,
+	// 8x8 bayer matrix, every pixel on its own so it runs in parallel
+	PALETTE_DITHER_ORDERED,
+	// error diffusion, serpentine and serial within an image
+	PALETTE_DITHER_FLOYD_STEINBERG,
+};
+
+struct Palette
+{
+	int count;
+	// count rgb triples
+	float colors[PALETTE_MAX_COLORS * 3];
+};
+
+// one palette index per pixel, a quarter of an 8 bit rgba image and a
+// sixteenth of a float one.
+struct IndexedImage
+{
+	int width, height;
+	std::vector<u8> indices;
+	Palette palette;
+};
+
+// [0, 1] onto cells cells, the outer cells centered on 0 and 1.
+inline int paletteCell(float value, int cells)
+{
+	value = !(value > 0.0f) ? 0.0f : (value > 1.0f ? 1.0f : value);
+	return (int)(value * (cells - 1) + 0.5f);
+}
+
+// the mean color and pixel count of one histogram cell.
+struct PaletteEntry
+{
+	float color[3];
+	double weight;
+};
+
+// the non empty cells of the histogram of image. every task counts a share
+// of the rows into its own cells, which are merged once all are done.
+inline std::vector<PaletteEntry> paletteEntries(const Image& image, ThreadPool* pool)
+{
+	const int cells = PALETTE_HISTOGRAM_CELLS * PALETTE_HISTOGRAM_CELLS * PALETTE_HISTOGRAM_CELLS;
+	int tasks = pool ? pool->size() + 1 : 1;
+	tasks = tasks < image.height ? tasks : (image.height > 0 ? image.height : 1);
+	std::vector<u32> counts((size_t)cells * tasks, 0);
+	std::vector<double> sums((size_t)cells * tasks * 3, 0.0);
+
+	auto count = [&](int task) {
+		int y0 = (int)((long long)image.height * task / tasks);
+		int y1 = (int)((long long)image.height * (task + 1) / tasks);
+		u32* taskCounts = &counts[(size_t)cells * task];
+		double* taskSums = &sums[(size_t)cells * task * 3];
+		for (int y = y0; y < y1; y++) {
+			const float* row = &image.data[(size_t)y * image.width * image.channels];
+			for (int x = 0; x < image.width; x++) {
+				const float* p = &row[x * image.channels];
+				int cell = (paletteCell(p[0], PALETTE_HISTOGRAM_CELLS) * PALETTE_HISTOGRAM_CELLS
+					+ paletteCell(p[1], PALETTE_HISTOGRAM_CELLS)) * PALETTE_HISTOGRAM_CELLS
+					+ paletteCell(p[2], PALETTE_HISTOGRAM_CELLS);
+				taskCounts[cell]++;
+				for (int c = 0; c < 3; c++) {
+					// clamped like the cell, so the means stay inside [0, 1]
+					float value = p[c];
+					taskSums[cell * 3 + c] += !(value > 0.0f) ? 0.0f : (value > 1.0f ? 1.0f : value);
+				}
+			}
+		}
+	};
+
+	if (pool) {
+		pool->parallelFor(tasks, count);
+	}
+	else {
+		count(0);
+	}
+
+	std::vector<PaletteEntry> entries;
+	for (int cell = 0; cell < cells; cell++) {
+		double weight = 0.0;
+		double sum[3] = {};
+		for (int task = 0; task < tasks; task++) {
+			size_t i = (size_t)cells * task + cell;
+			weight += counts[i];
+			for (int c = 0; c < 3; c++) {
+				sum[c] += sums[i * 3 + c];
+			}
+		}
+		if (weight > 0.0) {
+			PaletteEntry entry = { { (float)(sum[0] / weight), (float)(sum[1] / weight), (float)(sum[2] / weight) }, weight };
+			entries.push_back(entry);
+		}
+	}
+	return entries;
+}
+
+// entries [begin, end) of a median cut box, with the weighted squared error
+// around its mean and the axis it is widest along.
+struct PaletteBox
+{
+	int begin, end;
+	double weight;
+	double mean[3];
+	double error;
+	int axis;
+};
+
+inline PaletteBox paletteBox(const std::vector<PaletteEntry>& entries, int begin, int end)
+{
+	PaletteBox box = { begin, end, 0.0, {}, 0.0, 0 };
+	for (int i = begin; i < end; i++) {
+		box.weight += entries[i].weight;
+		for (int c = 0; c < 3; c++) {
+			box.mean[c] += entries[i].weight * entries[i].color[c];
+		}
+	}
+	for (int c = 0; c < 3; c++) {
+		box.mean[c] /= box.weight;
+	}
+
+	double spread[3] = {};
+	for (int i = begin; i < end; i++) {
+		for (int c = 0; c < 3; c++) {
+			double d = entries[i].color[c] - box.mean[c];
+			spread[c] += entries[i].weight * d * d;
+		}
+	}
+	box.error = spread[0] + spread[1] + spread[2];
+	box.axis = spread[1] > spread[box.axis] ? 1 : box.axis;
+	box.axis = spread[2] > spread[box.axis] ? 2 : box.axis;
+	return box;
+}
+
+// median cut: keeps splitting the box with the largest squared error at
+// the weighted median of its widest axis, every box then becomes its mean.
+inline Palette medianCutPalette(std::vector<PaletteEntry>& entries, int colors)
+{
+	TRACE_SCOPE("medianCutPalette", "image");
+	colors = colors < 1 ? 1 : (colors > PALETTE_MAX_COLORS ? PALETTE_MAX_COLORS : colors);
+
+	std::vector<PaletteBox> boxes;
+	if (!entries.empty()) {
+		boxes.push_back(paletteBox(entries, 0, (int)entries.size()));
+	}
+	while ((int)boxes.size() < colors) {
+		int widest = -1;
+		for (int b = 0; b < (int)boxes.size(); b++) {
+			if (boxes[b].end - boxes[b].begin > 1 && boxes[b].error > 0.0 && (widest < 0 || boxes[b].error > boxes[widest].error)) {
+				widest = b;
+			}
+		}
+		if (widest < 0) {
+			break;
+		}
+
+		PaletteBox box = boxes[widest];
+		int axis = box.axis;
+		std::sort(entries.begin() + box.begin, entries.begin() + box.end, [axis](const PaletteEntry& a, const PaletteEntry& b) {
+			return a.color[axis] < b.color[axis];
+		});
+		// both halves keep at least one entry
+		int split = box.begin + 1;
+		double below = entries[box.begin].weight;
+		while (split < box.end - 1 && below + entries[split].weight <= box.weight * 0.5) {
+			below += entries[split].weight;
+			split++;
+		}
+		boxes[widest] = paletteBox(entries, box.begin, split);
+		boxes.push_back(paletteBox(entries, split, box.end));
+	}
+
+	Palette palette = {};
+	palette.count = (int)boxes.size();
+	for (int b = 0; b < palette.count; b++) {
+		for (int c = 0; c < 3; c++) {
+			palette.colors[b * 3 + c] = (float)boxes[b].mean[c];
+		}
+	}
+	if (!palette.count) {
+		// an empty image still gets a color to index
+		palette.count = 1;
+	}
+	return palette;
+}
+
+// colors split into planes for the nearest color search, padded to a
+// multiple of 4 with colors too far away to ever win.
+struct PalettePlanes
+{
+	std::vector<float> r, g, b;
+	std::vector<u8> indices;
+
+	void add(const Palette& palette, int index)
+	{
+		this->r.push_back(palette.colors[index * 3]);
+		this->g.push_back(palette.colors[index * 3 + 1]);
+		this->b.push_back(palette.colors[index * 3 + 2]);
+		this->indices.push_back((u8)index);
+	}
+
+	void pad()
+	{
+		while (this->r.size() % 4) {
+			this->r.push_back(1e9f);
+			this->g.push_back(1e9f);
+			this->b.push_back(1e9f);
+			this->indices.push_back(0);
+		}
+	}
+};
+
+// palette index of the color nearest to (r, g, b), 4 colors per step.
+inline int nearestColor(const PalettePlanes& planes, float r, float g, float b)
+{
+	int count = (int)planes.r.size();
+	int best = 0;
+#ifdef IMAGE_SSE2
+	__m128 vr = _mm_set1_ps(r);
+	__m128 vg = _mm_set1_ps(g);
+	__m128 vb = _mm_set1_ps(b);
+	__m128 bestDistance = _mm_set1_ps(3e18f);
+	__m128 bestSlot = _mm_setzero_ps();
+	__m128 slot = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	for (int i = 0; i < count; i += 4) {
+		__m128 dr = _mm_sub_ps(_mm_loadu_ps(&planes.r[i]), vr);
+		__m128 dg = _mm_sub_ps(_mm_loadu_ps(&planes.g[i]), vg);
+		__m128 db = _mm_sub_ps(_mm_loadu_ps(&planes.b[i]), vb);
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+		__m128 closer = _mm_cmplt_ps(distance, bestDistance);
+		bestDistance = _mm_min_ps(distance, bestDistance);
+		bestSlot = _mm_or_ps(_mm_and_ps(closer, slot), _mm_andnot_ps(closer, bestSlot));
+		slot = _mm_add_ps(slot, _mm_set1_ps(4.0f));
+	}
+	float distances[4], slots[4];
+	_mm_storeu_ps(distances, bestDistance);
+	_mm_storeu_ps(slots, bestSlot);
+	for (int lane = 1; lane < 4; lane++) {
+		if (distances[lane] < distances[0] || (distances[lane] == distances[0] && slots[lane] < slots[0])) {
+			distances[0] = distances[lane];
+			slots[0] = slots[lane];
+		}
+	}
+	best = (int)slots[0];
+#else
+	float bestDistance = 3e18f;
+	for (int i = 0; i < count; i++) {
+		float dr = planes.r[i] - r;
+		float dg = planes.g[i] - g;
+		float db = planes.b[i] - b;
+		float distance = dr * dr + dg * dg + db * db;
+		if (distance < bestDistance) {
+			bestDistance = distance;
+			best = i;
+		}
+	}
+#endif
+	return planes.indices[best];
+}
+
+inline PalettePlanes palettePlanes(const Palette& palette)
+{
+	PalettePlanes planes;
+	for (int i = 0; i < palette.count; i++) {
+		planes.add(palette, i);
+	}
+	planes.pad();
+	return planes;
+}
+
+// the colors of palette, in planes, that can be the nearest to some point
+// of the box [lo, hi]. the nearest color of any point is no farther than
+// the smallest distance to a far corner of the box, every color that is
+// farther than that from the whole box is dropped.
+inline PalettePlanes paletteCandidates(const Palette& palette, const PalettePlanes& planes, const float* lo, const float* hi)
+{
+	int count = (int)planes.r.size();
+	float nearDistance[PALETTE_MAX_COLORS];
+	float bound = 3e18f;
+	const float* axes[3] = { planes.r.data(), planes.g.data(), planes.b.data() };
+#ifdef IMAGE_SSE2
+	__m128 zero = _mm_setzero_ps();
+	__m128 bounds = _mm_set1_ps(3e18f);
+	for (int i = 0; i < count; i += 4) {
+		__m128 nearSum = zero;
+		__m128 farSum = zero;
+		for (int c = 0; c < 3; c++) {
+			__m128 value = _mm_loadu_ps(&axes[c][i]);
+			__m128 below = _mm_sub_ps(_mm_set1_ps(lo[c]), value);
+			__m128 above = _mm_sub_ps(value, _mm_set1_ps(hi[c]));
+			// at most one of below and above is positive
+			__m128 nearAxis = _mm_add_ps(_mm_max_ps(below, zero), _mm_max_ps(above, zero));
+			__m128 farAxis = _mm_max_ps(_mm_sub_ps(zero, below), _mm_sub_ps(zero, above));
+			nearSum = _mm_add_ps(nearSum, _mm_mul_ps(nearAxis, nearAxis));
+			farSum = _mm_add_ps(farSum, _mm_mul_ps(farAxis, farAxis));
+		}
+		_mm_storeu_ps(&nearDistance[i], nearSum);
+		bounds = _mm_min_ps(bounds, farSum);
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, bounds);
+	for (int lane = 0; lane < 4; lane++) {
+		bound = lanes[lane] < bound ? lanes[lane] : bound;
+	}
+#else
+	for (int i = 0; i < count; i++) {
+		float nearSum = 0.0f;
+		float farSum = 0.0f;
+		for (int c = 0; c < 3; c++) {
+			float below = lo[c] - axes[c][i];
+			float above = axes[c][i] - hi[c];
+			float nearAxis = (below > 0.0f ? below : 0.0f) + (above > 0.0f ? above : 0.0f);
+			float farAxis = -below > -above ? -below : -above;
+			nearSum += nearAxis * nearAxis;
+			farSum += farAxis * farAxis;
+		}
+		nearDistance[i] = nearSum;
+		bound = farSum < bound ? farSum : bound;
+	}
+#endif
+
+	PalettePlanes candidates;
+	for (int p = 0; p < palette.count; p++) {
+		if (nearDistance[p] <= bound) {
+			candidates.add(palette, p);
+		}
+	}
+	candidates.pad();
+	return candidates;
+}
+
+// lloyd's k-means over the histogram entries, starting from palette. stops
+// early once no entry changes color, colors nothing maps to stay put. the
+// entries are bucketed into 4^3 blocks of histogram cells, each block only
+// searches the colors that can be nearest to something inside it.
+inline void refinePalette(const std::vector<PaletteEntry>& entries, Palette& palette, int iterations, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("refinePalette", "image");
+	const int side = PALETTE_HISTOGRAM_CELLS / 4;
+	const int blocks = side * side * side;
+
+	// entries ordered by block, block b owns order[first[b] .. first[b + 1])
+	std::vector<int> first(blocks + 1, 0);
+	std::vector<int> blockOf(entries.size());
+	for (size_t i = 0; i < entries.size(); i++) {
+		const float* color = entries[i].color;
+		blockOf[i] = ((paletteCell(color[0], PALETTE_HISTOGRAM_CELLS) / 4 * side
+			+ paletteCell(color[1], PALETTE_HISTOGRAM_CELLS) / 4) * side
+			+ paletteCell(color[2], PALETTE_HISTOGRAM_CELLS) / 4);
+		first[blockOf[i] + 1]++;
+	}
+	for (int b = 0; b < blocks; b++) {
+		first[b + 1] += first[b];
+	}
+	std::vector<int> order(entries.size());
+	std::vector<int> fill(first.begin(), first.end() - 1);
+	for (size_t i = 0; i < entries.size(); i++) {
+		order[fill[blockOf[i]]++] = (int)i;
+	}
+
+	// the bounds of the entries of every block
+	std::vector<float> bounds((size_t)blocks * 6);
+	for (int b = 0; b < blocks; b++) {
+		float* lo = &bounds[b * 6];
+		float* hi = &bounds[b * 6 + 3];
+		for (int c = 0; c < 3; c++) {
+			lo[c] = 1.0f;
+			hi[c] = 0.0f;
+		}
+		for (int k = first[b]; k < first[b + 1]; k++) {
+			for (int c = 0; c < 3; c++) {
+				lo[c] = fminf(lo[c], entries[order[k]].color[c]);
+				hi[c] = fmaxf(hi[c], entries[order[k]].color[c]);
+			}
+		}
+	}
+
+	std::vector<u8> nearest(entries.size(), 0);
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		PalettePlanes planes = palettePlanes(palette);
+		std::vector<int> changes(blocks, 0);
+		auto assign = [&](int b) {
+			if (first[b] == first[b + 1]) {
+				return;
+			}
+			PalettePlanes candidates = paletteCandidates(palette, planes, &bounds[b * 6], &bounds[b * 6 + 3]);
+			for (int k = first[b]; k < first[b + 1]; k++) {
+				int i = order[k];
+				const float* color = entries[i].color;
+				u8 index = (u8)nearestColor(candidates, color[0], color[1], color[2]);
+				changes[b] += index != nearest[i] || iteration == 0;
+				nearest[i] = index;
+			}
+		};
+
+		if (pool) {
+			pool->parallelFor(blocks, assign);
+		}
+		else {
+			for (int b = 0; b < blocks; b++) {
+				assign(b);
+			}
+		}
+
+		int changed = 0;
+		for (int b = 0; b < blocks; b++) {
+			changed += changes[b];
+		}
+		if (!changed) {
+			return;
+		}
+
+		std::vector<double> sums((size_t)palette.count * 4, 0.0);
+		for (size_t i = 0; i < entries.size(); i++) {
+			double* sum = &sums[nearest[i] * 4];
+			for (int c = 0; c < 3; c++) {
+				sum[c] += entries[i].weight * entries[i].color[c];
+			}
+			sum[3] += entries[i].weight;
+		}
+		for (int p = 0; p < palette.count; p++) {
+			if (sums[p * 4 + 3] > 0.0) {
+				for (int c = 0; c < 3; c++) {
+					palette.colors[p * 3 + c] = (float)(sums[p * 4 + c] / sums[p * 4 + 3]);
+				}
+			}
+		}
+	}
+}
+
+// at most colors colors for image, median cut then iterations rounds of
+// k-means.
+inline Palette buildPalette(const Image& image, int colors, int iterations = 8, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("buildPalette", "image");
+	std::vector<PaletteEntry> entries = paletteEntries(image, pool);
+	Palette palette = medianCutPalette(entries, colors);
+	refinePalette(entries, palette, iterations, pool);
+	return palette;
+}
+
+// the palette index nearest to the center of every cell of a 64^3 grid
+// over [0, 1]^3. every 8^3 block of cells searches only its candidates, a
+// handful instead of the whole palette, and the result is still the exact
+// nearest color of every cell center.
+inline std::vector<u8> buildPaletteLut(const Palette& palette, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("buildPaletteLut", "image");
+	const int cells = PALETTE_LUT_CELLS;
+	const int blocks = cells / PALETTE_LUT_BLOCK;
+	const float step = 1.0f / (cells - 1);
+	std::vector<u8> lut((size_t)cells * cells * cells);
+	PalettePlanes planes = palettePlanes(palette);
+
+	auto fillBlock = [&](int index) {
+		int corner[3] = { index / (blocks * blocks), index / blocks % blocks, index % blocks };
+		float lo[3], hi[3];
+		for (int c = 0; c < 3; c++) {
+			lo[c] = corner[c] * PALETTE_LUT_BLOCK * step;
+			hi[c] = (corner[c] * PALETTE_LUT_BLOCK + PALETTE_LUT_BLOCK - 1) * step;
+		}
+
+		PalettePlanes candidates = paletteCandidates(palette, planes, lo, hi);
+
+		for (int r = 0; r < PALETTE_LUT_BLOCK; r++) {
+			for (int g = 0; g < PALETTE_LUT_BLOCK; g++) {
+				for (int b = 0; b < PALETTE_LUT_BLOCK; b++) {
+					int cr = corner[0] * PALETTE_LUT_BLOCK + r;
+					int cg = corner[1] * PALETTE_LUT_BLOCK + g;
+					int cb = corner[2] * PALETTE_LUT_BLOCK + b;
+					lut[((size_t)cr * cells + cg) * cells + cb] = (u8)nearestColor(candidates, cr * step, cg * step, cb * step);
+				}
+			}
+		}
+	};
+
+	int count = blocks * blocks * blocks;
+	if (pool) {
+		pool->parallelFor(count, fillBlock);
+	}
+	else {
+		for (int i = 0; i < count; i++) {
+			fillBlock(i);
+		}
+	}
+	return lut;
+}
+
+inline u8 lookupPalette(const u8* lut, float r, float g, float b)
+{
+	const int cells = PALETTE_LUT_CELLS;
+	return lut[((size_t)paletteCell(r, cells) * cells + paletteCell(g, cells)) * cells + paletteCell(b, cells)];
+}
+
+// bayer thresholds in 64ths
+const u8 PALETTE_BAYER[8][8] = {
+	{ 0, 32, 8, 40, 2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44, 4, 36, 14, 46, 6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{ 3, 35, 11, 43, 1, 33, 9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47, 7, 39, 13, 45, 5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+// serpentine floyd - steinberg, the error of every pixel goes 7/16 ahead,
+// 3/16 behind below, 5/16 below and 1/16 ahead below. two rows of error,
+// padded by a pixel on both sides.
+inline void ditherFloydSteinberg(const Image& image, const Palette& palette, const u8* lut, u8* indices)
+{
+	TRACE_SCOPE("ditherFloydSteinberg", "image");
+	size_t pitch = (size_t)(image.width + 2) * 3;
+	std::vector<float> current(pitch, 0.0f);
+	std::vector<float> next(pitch, 0.0f);
+
+	for (int y = 0; y < image.height; y++) {
+		bool reverse = y & 1;
+		int step = reverse ? -1 : 1;
+		const float* row = &image.data[(size_t)y * image.width * image.channels];
+		for (int i = 0; i < image.width; i++) {
+			int x = reverse ? image.width - 1 - i : i;
+			float* error = &current[(x + 1) * 3];
+			float value[3];
+			for (int c = 0; c < 3; c++) {
+				value[c] = row[x * image.channels + c] + error[c];
+				value[c] = value[c] < 0.0f ? 0.0f : (value[c] > 1.0f ? 1.0f : value[c]);
+			}
+			u8 index = lookupPalette(lut, value[0], value[1], value[2]);
+			indices[(size_t)y * image.width + x] = index;
+
+			float* ahead = &current[(x + 1 + step) * 3];
+			float* below = &next[(x + 1) * 3];
+			for (int c = 0; c < 3; c++) {
+				float residual = value[c] - palette.colors[index * 3 + c];
+				ahead[c] += residual * (7.0f / 16.0f);
+				below[c - step * 3] += residual * (3.0f / 16.0f);
+				below[c] += residual * (5.0f / 16.0f);
+				below[c + step * 3] += residual * (1.0f / 16.0f);
+			}
+		}
+		current.swap(next);
+		std::fill(next.begin(), next.end(), 0.0f);
+	}
+}
+
+// the mean distance from a palette color to its nearest other color, spread
+// over the three channels the ordered dither offsets. a palette fitted to
+// the image is much denser than one covering the whole cube.
+inline float paletteSpacing(const Palette& palette)
+{
+	if (palette.count < 2) {
+		return 0.0f;
+	}
+	double sum = 0.0;
+	for (int p = 0; p < palette.count; p++) {
+		float nearest = 3e18f;
+		for (int q = 0; q < palette.count; q++) {
+			float dr = palette.colors[p * 3] - palette.colors[q * 3];
+			float dg = palette.colors[p * 3 + 1] - palette.colors[q * 3 + 1];
+			float db = palette.colors[p * 3 + 2] - palette.colors[q * 3 + 2];
+			float distance = dr * dr + dg * dg + db * db;
+			nearest = q != p && distance < nearest ? distance : nearest;
+		}
+		sum += sqrtf(nearest);
+	}
+	return (float)(sum / palette.count / sqrt(3.0));
+}
+
+// the nearest palette color of every pixel, bands of rows on pool unless
+// the dither is floyd - steinberg.
+inline IndexedImage mapToPalette(const Image& image, const Palette& palette, PaletteDither dither = PALETTE_DITHER_NONE, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("mapToPalette", "image");
+	IndexedImage indexed;
+	indexed.width = image.width;
+	indexed.height = image.height;
+	indexed.indices.resize((size_t)image.width * image.height);
+	indexed.palette = palette;
+	std::vector<u8> lut = buildPaletteLut(palette, pool);
+
+	if (dither == PALETTE_DITHER_FLOYD_STEINBERG) {
+		ditherFloydSteinberg(image, palette, lut.data(), indexed.indices.data());
+		return indexed;
+	}
+
+	float spread = dither == PALETTE_DITHER_ORDERED ? paletteSpacing(palette) : 0.0f;
+	int bands = (image.height + PALETTE_BAND_ROWS - 1) / PALETTE_BAND_ROWS;
+	auto band = [&](int b) {
+		int y0 = b * PALETTE_BAND_ROWS;
+		int y1 = y0 + PALETTE_BAND_ROWS < image.height ? y0 + PALETTE_BAND_ROWS : image.height;
+		for (int y = y0; y < y1; y++) {
+			const float* row = &image.data[(size_t)y * image.width * image.channels];
+			u8* dest = &indexed.indices[(size_t)y * image.width];
+			for (int x = 0; x < image.width; x++) {
+				const float* p = &row[x * image.channels];
+				float offset = spread * ((PALETTE_BAYER[y & 7][x & 7] + 0.5f) / 64.0f - 0.5f);
+				dest[x] = lookupPalette(lut.data(), p[0] + offset, p[1] + offset, p[2] + offset);
+			}
+		}
+	};
+
+	if (pool) {
+		pool->parallelFor(bands, band);
+	}
+	else {
+		for (int b = 0; b < bands; b++) {
+			band(b);
+		}
+	}
+	return indexed;
+}
+
+// palette colors back into an rgb image the caller frees.
+inline Image expandIndexed(const IndexedImage& indexed)
+{
+	Image image = { indexed.width, indexed.height, 3, true, nullptr };
+	image.data = (float*)malloc(sizeof(float) * indexed.indices.size() * 3);
+	for (size_t i = 0; i < indexed.indices.size(); i++) {
+		memcpy(&image.data[i * 3], &indexed.palette.colors[indexed.indices[i] * 3], sizeof(float) * 3);
+	}
+	return image;
+}
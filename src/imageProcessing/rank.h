@@ -0,0 +1,333 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "convolve.h"
+#include "image.h"
+
+// median and other percentiles of the square window around every pixel,
+// for every channel, edges clamped. 3x3 windows sort the float values
+// exactly with a sorting network, four floats per sse2 vector. larger
+// windows quantize to 8 bits and use the constant time histograms of
+// perreault and hebert, "median filtering in constant time", 2007, so the
+// cost per pixel is the same for a 15x15 window as for a 5x5 one.
+
+// rows per task
+const int RANK_BAND_ROWS = 64;
+// u16 counts, a window of (2 * 127 + 1)^2 still fits
+const int RANK_MAX_RADIUS = 127;
+
+template <typename Fn>
+void forEachRankBand(int height, ThreadPool* pool, Fn fn)
+{
+	int bands = (height + RANK_BAND_ROWS - 1) / RANK_BAND_ROWS;
+	auto band = [&](int b) {
+		int y0 = b * RANK_BAND_ROWS;
+		fn(y0, y0 + RANK_BAND_ROWS < height ? y0 + RANK_BAND_ROWS : height);
+	};
+
+	if (pool) {
+		pool->parallelFor(bands, band);
+	}
+	else {
+		for (int b = 0; b < bands; b++) {
+			band(b);
+		}
+	}
+}
+
+// min to a, max to b. the scalar version picks the same operands as
+// minps and maxps, so both paths agree on every input.
+#ifdef IMAGE_SSE2
+inline void compareExchange(__m128& a, __m128& b)
+{
+	__m128 low = _mm_min_ps(a, b);
+	b = _mm_max_ps(a, b);
+	a = low;
+}
+#endif
+
+inline void compareExchange(float& a, float& b)
+{
+	float low = a < b ? a : b;
+	b = a > b ? a : b;
+	a = low;
+}
+
+// 25 exchange sorting network for 9 values
+template <typename T>
+void sortNine(T* v)
+{
+	compareExchange(v[0], v[3]); compareExchange(v[1], v[7]); compareExchange(v[2], v[5]); compareExchange(v[4], v[8]);
+	compareExchange(v[0], v[7]); compareExchange(v[2], v[4]); compareExchange(v[3], v[8]); compareExchange(v[5], v[6]);
+	compareExchange(v[0], v[2]); compareExchange(v[1], v[3]); compareExchange(v[4], v[5]); compareExchange(v[7], v[8]);
+	compareExchange(v[1], v[4]); compareExchange(v[3], v[6]); compareExchange(v[5], v[7]);
+	compareExchange(v[0], v[1]); compareExchange(v[2], v[4]); compareExchange(v[3], v[5]); compareExchange(v[6], v[8]);
+	compareExchange(v[2], v[3]); compareExchange(v[4], v[5]); compareExchange(v[6], v[7]);
+	compareExchange(v[1], v[2]); compareExchange(v[3], v[4]); compareExchange(v[5], v[6]);
+}
+
+// the rank-th smallest value of every 3x3 window, exact.
+inline void rankFilter3x3(const Image& source, int rank, Image& dest, ThreadPool* pool)
+{
+	int channels = source.channels;
+	int pitch = (source.width + 2) * channels;
+	int count = source.width * channels;
+
+	forEachRankBand(source.height, pool, [&](int y0, int y1) {
+		// rows y - 1, y, y + 1 padded by one pixel on both sides
+		std::vector<float> rows((size_t)pitch * 3);
+		for (int y = y0; y < y1; y++) {
+			for (int r = 0; r < 3; r++) {
+				padRow(source, borderIndex(y - 1 + r, source.height, BORDER_CLAMP), 0, source.width, 1, BORDER_CLAMP, &rows[(size_t)r * pitch]);
+			}
+			float* out = &dest.data[(size_t)y * count];
+
+			int i = 0;
+#ifdef IMAGE_SSE2
+			for (; i + 4 <= count; i += 4) {
+				__m128 v[9];
+				for (int r = 0; r < 3; r++) {
+					for (int k = 0; k < 3; k++) {
+						v[r * 3 + k] = _mm_loadu_ps(&rows[(size_t)r * pitch + k * channels + i]);
+					}
+				}
+				sortNine(v);
+				_mm_storeu_ps(&out[i], v[rank]);
+			}
+#endif
+			for (; i < count; i++) {
+				float v[9];
+				for (int r = 0; r < 3; r++) {
+					for (int k = 0; k < 3; k++) {
+						v[r * 3 + k] = rows[(size_t)r * pitch + k * channels + i];
+					}
+				}
+				sortNine(v);
+				out[i] = v[rank];
+			}
+		}
+	});
+}
+
+// 256 fine bins in 16 coarse ones
+const int RANK_BINS = 256;
+const int RANK_COARSE = 16;
+
+inline u8 quantizeRank(float value)
+{
+	float scaled = value * 255.0f + 0.5f;
+	return !(scaled > 0.0f) ? 0 : (scaled >= 255.0f ? 255 : (u8)scaled);
+}
+
+// dest[i] += enter[i] - leave[i] over 16 counts
+inline void slideCounts(u16* dest, const u16* enter, const u16* leave)
+{
+#ifdef IMAGE_SSE2
+	for (int i = 0; i < 16; i += 8) {
+		__m128i sum = _mm_loadu_si128((const __m128i*)&dest[i]);
+		sum = _mm_add_epi16(sum, _mm_loadu_si128((const __m128i*)&enter[i]));
+		sum = _mm_sub_epi16(sum, _mm_loadu_si128((const __m128i*)&leave[i]));
+		_mm_storeu_si128((__m128i*)&dest[i], sum);
+	}
+#else
+	for (int i = 0; i < 16; i++) {
+		dest[i] = (u16)(dest[i] + enter[i] - leave[i]);
+	}
+#endif
+}
+
+inline void addCounts(u16* dest, const u16* add)
+{
+#ifdef IMAGE_SSE2
+	for (int i = 0; i < 16; i += 8) {
+		__m128i sum = _mm_add_epi16(_mm_loadu_si128((const __m128i*)&dest[i]), _mm_loadu_si128((const __m128i*)&add[i]));
+		_mm_storeu_si128((__m128i*)&dest[i], sum);
+	}
+#else
+	for (int i = 0; i < 16; i++) {
+		dest[i] = (u16)(dest[i] + add[i]);
+	}
+#endif
+}
+
+// the first of 16 bins where the running count passes rank, with below
+// counting everything before it on the way. rank is always reached within
+// the 16 bins.
+inline int searchCounts(const u16* counts, int rank, int& below)
+{
+#ifdef IMAGE_SSE2
+	// running sums of both halves, then the first half's total carried on
+	__m128i low = _mm_loadu_si128((const __m128i*)&counts[0]);
+	__m128i high = _mm_loadu_si128((const __m128i*)&counts[8]);
+	low = _mm_add_epi16(low, _mm_slli_si128(low, 2));
+	high = _mm_add_epi16(high, _mm_slli_si128(high, 2));
+	low = _mm_add_epi16(low, _mm_slli_si128(low, 4));
+	high = _mm_add_epi16(high, _mm_slli_si128(high, 4));
+	low = _mm_add_epi16(low, _mm_slli_si128(low, 8));
+	high = _mm_add_epi16(high, _mm_slli_si128(high, 8));
+	high = _mm_add_epi16(high, _mm_set1_epi16((short)_mm_extract_epi16(low, 7)));
+
+	// the sums are unsigned, a saturating subtract is 0 exactly where the
+	// running count is still at or below rank
+	__m128i target = _mm_set1_epi16((short)(u16)(rank - below));
+	__m128i zero = _mm_setzero_si128();
+	__m128i lowBelow = _mm_srli_epi16(_mm_cmpeq_epi16(_mm_subs_epu16(low, target), zero), 15);
+	__m128i highBelow = _mm_srli_epi16(_mm_cmpeq_epi16(_mm_subs_epu16(high, target), zero), 15);
+	__m128i lanes = _mm_sad_epu8(_mm_add_epi16(lowBelow, highBelow), zero);
+	int index = _mm_cvtsi128_si32(lanes) + _mm_extract_epi16(lanes, 4);
+
+	u16 sums[16];
+	_mm_storeu_si128((__m128i*)&sums[0], low);
+	_mm_storeu_si128((__m128i*)&sums[8], high);
+	below += index > 0 ? sums[index - 1] : 0;
+	return index;
+#else
+	int index = 0;
+	while (below + counts[index] <= rank) {
+		below += counts[index];
+		index++;
+	}
+	return index;
+#endif
+}
+
+// columns per tile of the histogram filter, the column histograms of a
+// tile stay in l2
+const int RANK_TILE_COLUMNS = 256;
+
+// one channel of the tile [x0, x1) x [y0, y1). every column keeps a
+// histogram of the 2 * radius + 1 values above and below, which moves down
+// a row with one increment and one decrement. the window histogram is the
+// sum of its columns and moves right by adding one column and dropping
+// another. only the coarse bins move every pixel, the 16 fine bins of a
+// coarse bin are brought up to date when the search needs them.
+inline void rankFilterHistogram(const Image& source, const u8* plane, int channel, int radius, int rank, int x0, int x1, int y0, int y1, Image& dest)
+{
+	int width = source.width;
+	int height = source.height;
+	// the columns the windows of the tile read, after clamping
+	int left = x0 - radius - 1 < 0 ? 0 : x0 - radius - 1;
+	int right = x1 + radius > width ? width : x1 + radius;
+	int columns = right - left;
+	std::vector<u16> columnFine((size_t)columns * RANK_BINS, 0);
+	std::vector<u16> columnCoarse((size_t)columns * RANK_COARSE, 0);
+	u16 fine[RANK_BINS];
+	u16 coarse[RANK_COARSE];
+	// the x each coarse bin's fine bins are up to date for
+	int fineX[RANK_COARSE];
+
+	auto count = [&](int y, int step) {
+		const u8* row = &plane[(size_t)borderIndex(y, height, BORDER_CLAMP) * width];
+		for (int x = left; x < right; x++) {
+			columnFine[(size_t)(x - left) * RANK_BINS + row[x]] += (u16)step;
+			columnCoarse[(size_t)(x - left) * RANK_COARSE + (row[x] >> 4)] += (u16)step;
+		}
+	};
+	// clamped column of every x from x0 - radius - 1 on, relative to left
+	std::vector<int> clamped(x1 - x0 + 2 * radius + 1);
+	for (size_t i = 0; i < clamped.size(); i++) {
+		clamped[i] = borderIndex(x0 - radius - 1 + (int)i, width, BORDER_CLAMP) - left;
+	}
+	auto fineOf = [&](int x, int bin) {
+		return &columnFine[(size_t)clamped[x - x0 + radius + 1] * RANK_BINS + bin * 16];
+	};
+	auto coarseOf = [&](int x) {
+		return &columnCoarse[(size_t)clamped[x - x0 + radius + 1] * RANK_COARSE];
+	};
+
+	for (int k = -radius; k <= radius; k++) {
+		count(y0 + k, 1);
+	}
+
+	for (int y = y0; y < y1; y++) {
+		if (y > y0) {
+			count(y + radius, 1);
+			count(y - radius - 1, -1);
+		}
+
+		memset(coarse, 0, sizeof(coarse));
+		for (int k = -radius; k <= radius; k++) {
+			addCounts(coarse, coarseOf(x0 + k));
+		}
+		for (int bin = 0; bin < RANK_COARSE; bin++) {
+			fineX[bin] = x0 - RANK_MAX_RADIUS * 4;
+		}
+
+		float* out = &dest.data[(size_t)y * width * source.channels + channel];
+		for (int x = x0; x < x1; x++) {
+			if (x > x0) {
+				slideCounts(coarse, coarseOf(x + radius), coarseOf(x - radius - 1));
+			}
+
+			int below = 0;
+			int bin = searchCounts(coarse, rank, below);
+
+			u16* bins = &fine[bin * 16];
+			if (x - fineX[bin] > 2 * radius + 1) {
+				// cheaper to sum the window than to replay the steps missed
+				memset(bins, 0, sizeof(u16) * 16);
+				for (int k = -radius; k <= radius; k++) {
+					addCounts(bins, fineOf(x + k, bin));
+				}
+			}
+			else {
+				for (int step = fineX[bin] + 1; step <= x; step++) {
+					slideCounts(bins, fineOf(step + radius, bin), fineOf(step - radius - 1, bin));
+				}
+			}
+			fineX[bin] = x;
+
+			int value = searchCounts(bins, rank, below);
+			out[(size_t)x * source.channels] = (bin * 16 + value) / 255.0f;
+		}
+	}
+}
+
+// percentile of every (2 * radius + 1)^2 window, 0 is the minimum, 0.5 the
+// median and 1 the maximum. returns a new image the caller frees. past
+// radius 1 the values come out quantized to 8 bits.
+inline Image rankFilter(const Image& source, int radius, float percentile, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("rankFilter", "image");
+	radius = radius < 1 ? 1 : (radius > RANK_MAX_RADIUS ? RANK_MAX_RADIUS : radius);
+	percentile = percentile < 0.0f ? 0.0f : (percentile > 1.0f ? 1.0f : percentile);
+	int taps = (2 * radius + 1) * (2 * radius + 1);
+	int rank = (int)roundf(percentile * (taps - 1));
+
+	Image dest = source;
+	dest.data = (float*)malloc(sizeof(float) * source.width * source.height * source.channels);
+
+	if (radius == 1) {
+		rankFilter3x3(source, rank, dest, pool);
+		return dest;
+	}
+
+	std::vector<u8> plane((size_t)source.width * source.height);
+	for (int c = 0; c < source.channels; c++) {
+		forEachRankBand(source.height, pool, [&](int y0, int y1) {
+			for (size_t i = (size_t)y0 * source.width; i < (size_t)y1 * source.width; i++) {
+				plane[i] = quantizeRank(source.data[i * source.channels + c]);
+			}
+		});
+		forEachRankBand(source.height, pool, [&](int y0, int y1) {
+			for (int x0 = 0; x0 < source.width; x0 += RANK_TILE_COLUMNS) {
+				int x1 = x0 + RANK_TILE_COLUMNS < source.width ? x0 + RANK_TILE_COLUMNS : source.width;
+				rankFilterHistogram(source, plane.data(), c, radius, rank, x0, x1, y0, y1, dest);
+			}
+		});
+	}
+	return dest;
+}
+
+inline Image medianFilter(const Image& source, int radius, ThreadPool* pool = nullptr)
+{
+	return rankFilter(source, radius, 0.5f, pool);
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+#include "blur.h"
+#include "convolve.h"
+#include "image.h"
+
+// separable resizing of every channel. the weights of every output column
+// and row are computed once, the horizontal pass runs one sse2 vector per
+// pixel and the vertical pass whole rows at a time through convolveBlock.
+// edges are clamped.
+
+enum ResampleFilter
+{
+	// area average when shrinking, nearest with blended edges when growing
+	RESAMPLE_BOX,
+	RESAMPLE_BILINEAR,
+	// catmull - rom
+	RESAMPLE_BICUBIC,
+	RESAMPLE_LANCZOS3,
+};
+
+// how far the filter reaches at scale 1, in source pixels
+inline float resampleSupport(ResampleFilter filter)
+{
+	switch (filter) {
+	case RESAMPLE_BILINEAR:
+		return 1.0f;
+	case RESAMPLE_BICUBIC:
+		return 2.0f;
+	case RESAMPLE_LANCZOS3:
+		return 3.0f;
+	default:
+		return 0.5f;
+	}
+}
+
+inline float resampleKernel(ResampleFilter filter, float x)
+{
+	x = fabsf(x);
+	switch (filter) {
+	case RESAMPLE_BILINEAR:
+		return x < 1.0f ? 1.0f - x : 0.0f;
+	case RESAMPLE_BICUBIC:
+		if (x < 1.0f) {
+			return 1.5f * x * x * x - 2.5f * x * x + 1.0f;
+		}
+		return x < 2.0f ? -0.5f * x * x * x + 2.5f * x * x - 4.0f * x + 2.0f : 0.0f;
+	case RESAMPLE_LANCZOS3: {
+		if (x < 1e-6f) {
+			return 1.0f;
+		}
+		if (x >= 3.0f) {
+			return 0.0f;
+		}
+		float px = PI * x;
+		return 3.0f * sinf(px) * sinf(px / 3.0f) / (px * px);
+	}
+	default:
+		return x < 0.5f ? 1.0f : 0.0f;
+	}
+}
+
+// taps weights per output pixel, applied to the source pixels from
+// first[i] on. every output uses the same tap count so the passes have no
+// per pixel branches, unused taps weigh 0.
+struct ResampleWeights
+{
+	int taps;
+	std::vector<int> first;
+	std::vector<float> weights;
+};
+
+inline ResampleWeights resampleWeights(int sourceSize, int destSize, ResampleFilter filter)
+{
+	ResampleWeights table;
+	float scale = (float)sourceSize / destSize;
+	// shrinking stretches the filter over the source pixels each output covers
+	float stretch = scale > 1.0f ? scale : 1.0f;
+	float support = resampleSupport(filter) * stretch;
+
+	table.taps = (int)ceilf(support * 2.0f) + 1;
+	table.taps = table.taps < sourceSize ? table.taps : sourceSize;
+	table.first.resize(destSize);
+	table.weights.assign((size_t)destSize * table.taps, 0.0f);
+
+	for (int i = 0; i < destSize; i++) {
+		// output i covers [i, i + 1) * scale of the source
+		float begin = i * scale;
+		float end = (i + 1) * scale;
+		float center = (begin + end) * 0.5f;
+		int start = (int)floorf(center - support);
+		int first = start < 0 ? 0 : start;
+		first = first < sourceSize - table.taps ? first : sourceSize - table.taps;
+		table.first[i] = first;
+
+		float* weights = &table.weights[(size_t)i * table.taps];
+		float sum = 0.0f;
+		for (int j = start; j <= (int)ceilf(center + support); j++) {
+			float weight;
+			if (filter == RESAMPLE_BOX) {
+				// overlap of source pixel j with the covered interval,
+				// at least the pixel under the center when growing
+				float overlap = fminf(end, j + 1.0f) - fmaxf(begin, (float)j);
+				weight = overlap > 0.0f ? overlap : 0.0f;
+			}
+			else {
+				weight = resampleKernel(filter, (j + 0.5f - center) / stretch);
+			}
+			if (weight == 0.0f) {
+				continue;
+			}
+			// pixels past the edges fold onto the edge pixel
+			int clamped = j < 0 ? 0 : (j >= sourceSize ? sourceSize - 1 : j);
+			weights[clamped - first] += weight;
+			sum += weight;
+		}
+		for (int k = 0; k < table.taps; k++) {
+			weights[k] = sum != 0.0f ? weights[k] / sum : 0.0f;
+		}
+	}
+	return table;
+}
+
+// rows of source into rows of dest, resized along x only.
+inline void resampleRows(const Image& source, int y0, int y1, const ResampleWeights& table, int destWidth, float* dest)
+{
+	int channels = source.channels;
+	std::vector<float> lanes((size_t)source.width * 4);
+	std::vector<float> resized((size_t)destWidth * 4);
+
+	for (int y = y0; y < y1; y++) {
+		rowToLanes(&source.data[(size_t)y * source.width * channels], source.width, channels, lanes.data());
+		for (int x = 0; x < destWidth; x++) {
+			const float* pixels = &lanes[(size_t)table.first[x] * 4];
+			const float* weights = &table.weights[(size_t)x * table.taps];
+			Lanes sum = lanesSet(0.0f);
+			for (int k = 0; k < table.taps; k++) {
+				sum = lanesAdd(sum, lanesMul(lanesSet(weights[k]), lanesLoad(&pixels[k * 4])));
+			}
+			lanesStore(&resized[x * 4], sum);
+		}
+		lanesToRow(resized.data(), destWidth, channels, &dest[(size_t)(y - y0) * destWidth * channels]);
+	}
+}
+
+// rows per task of both passes
+const int RESAMPLE_BAND_ROWS = 32;
+
+// returns a new image the caller frees.
+inline Image resizeImage(const Image& source, int width, int height, ResampleFilter filter, ThreadPool* pool = nullptr)
+{
+	TRACE_SCOPE("resizeImage", "image");
+	ResampleWeights columns = resampleWeights(source.width, width, filter);
+	ResampleWeights rows = resampleWeights(source.height, height, filter);
+	int channels = source.channels;
+	size_t pitch = (size_t)width * channels;
+
+	// every source row resized along x, then every output row is a weighted
+	// sum of whole rows of that
+	std::vector<float> wide(pitch * source.height);
+	int sourceBands = (source.height + RESAMPLE_BAND_ROWS - 1) / RESAMPLE_BAND_ROWS;
+	auto horizontal = [&](int b) {
+		int y0 = b * RESAMPLE_BAND_ROWS;
+		int y1 = y0 + RESAMPLE_BAND_ROWS < source.height ? y0 + RESAMPLE_BAND_ROWS : source.height;
+		resampleRows(source, y0, y1, columns, width, &wide[(size_t)y0 * pitch]);
+	};
+
+	Image dest = source;
+	dest.width = width;
+	dest.height = height;
+	dest.data = (float*)malloc(sizeof(float) * pitch * height);
+	int destBands = (height + RESAMPLE_BAND_ROWS - 1) / RESAMPLE_BAND_ROWS;
+	auto vertical = [&](int b) {
+		int y0 = b * RESAMPLE_BAND_ROWS;
+		int y1 = y0 + RESAMPLE_BAND_ROWS < height ? y0 + RESAMPLE_BAND_ROWS : height;
+		for (int y = y0; y < y1; y++) {
+			const float* weights = &rows.weights[(size_t)y * rows.taps];
+			convolveBlock(&wide[(size_t)rows.first[y] * pitch], 0, (int)pitch, weights, 1, rows.taps, &dest.data[(size_t)y * pitch], (int)pitch);
+		}
+	};
+
+	if (pool) {
+		pool->parallelFor(sourceBands, horizontal);
+		pool->parallelFor(destBands, vertical);
+	}
+	else {
+		for (int b = 0; b < sourceBands; b++) {
+			horizontal(b);
+		}
+		for (int b = 0; b < destBands; b++) {
+			vertical(b);
+		}
+	}
+	return dest;
+}
+
+// scales image down to fit maxWidth x maxHeight keeping its aspect, frees
+// the original. images that already fit are returned as they are.
+inline Image fitImage(Image image, int maxWidth, int maxHeight, ResampleFilter filter = RESAMPLE_LANCZOS3, ThreadPool* pool = nullptr)
+{
+	if (image.width <= maxWidth && image.height <= maxHeight) {
+		return image;
+	}
+
+	float scale = fminf((float)maxWidth / image.width, (float)maxHeight / image.height);
+	int width = (int)roundf(image.width * scale);
+	int height = (int)roundf(image.height * scale);
+	Image fitted = resizeImage(image, width > 0 ? width : 1, height > 0 ? height : 1, filter, pool);
+	free(image.data);
+	return fitted;
+}
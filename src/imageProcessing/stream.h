@@ -0,0 +1,437 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <common.h>
+#include <trace.h>
+
+#include "encode.h"
+#include "image.h"
+
+// row strip access to images that do not fit in memory as floats. pnm,
+// pfm and headerless raw files are read row by row straight from disk.
+// stb_image has no scanline api, so every other format is decoded whole,
+// but as 8 bits per channel, a quarter of the float image.
+
+inline bool seekFile(FILE* file, u64 offset)
+{
+#ifdef _MSC_VER
+	return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+inline u64 tellFile(FILE* file)
+{
+#ifdef _MSC_VER
+	return (u64)_ftelli64(file);
+#else
+	return (u64)ftello(file);
+#endif
+}
+
+// next whitespace separated token of a pnm header, skips # comments.
+inline bool readPnmToken(FILE* file, char* token, int size)
+{
+	int c = fgetc(file);
+	while (c != EOF && (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#')) {
+		if (c == '#') {
+			while (c != EOF && c != '\n') {
+				c = fgetc(file);
+			}
+		}
+		c = fgetc(file);
+	}
+
+	int length = 0;
+	while (c != EOF && !(c == ' ' || c == '\t' || c == '\r' || c == '\n') && length + 1 < size) {
+		token[length++] = (char)c;
+		c = fgetc(file);
+	}
+	token[length] = 0;
+	// c is the single whitespace that ends the header, already consumed
+	return length > 0;
+}
+
+// <name>_<width>x<height>x<channels>.raw, as written by the raw encoder.
+inline bool parseRawName(const char* path, int& width, int& height, int& channels)
+{
+	const char* underscore = strrchr(path, '_');
+	const char* dot = strrchr(path, '.');
+	if (!underscore || !dot || strcmp(dot, ".raw") != 0) {
+		return false;
+	}
+	return sscanf(underscore + 1, "%ix%ix%i", &width, &height, &channels) == 3 && width > 0 && height > 0 && channels > 0;
+}
+
+// formats only the strip reader understands.
+inline bool isStripFormat(const char* path)
+{
+	const char* dot = strrchr(path, '.');
+	return dot && (strcmp(dot, ".pfm") == 0 || strcmp(dot, ".raw") == 0);
+}
+
+enum StripSource
+{
+	SOURCE_PNM,
+	SOURCE_PFM,
+	SOURCE_RAW,
+	SOURCE_DECODED,
+};
+
+struct StripReader
+{
+	FILE* file;
+	StripSource source;
+	int width, height;
+	// channels stored in the file and of the rows handed out
+	int fileChannels, channels;
+	// pnm samples are 1 or 2 bytes, scaled by maxValue
+	int sampleBytes;
+	float maxValue;
+	// pfm with a positive scale is big endian
+	bool swap;
+	u64 dataOffset;
+	int row;
+
+	// 8 bit samples to linear floats with LDR_GAMMA, as stbi_loadf does,
+	// so the 8 bit writers turn them back into the same bytes
+	float linear[256];
+
+	// whole image for formats without row access
+	u8* decoded;
+	float* decodedFloat;
+	std::vector<u8> buffer;
+
+	// channels is what read hands out, 3 or 4, or 0 for the file's own
+	// through rgbChannels.
+	bool open(const char* path, int channels)
+	{
+		TRACE_SCOPE_DETAIL("StripReader open", "stream", path);
+		*this = StripReader();
+		this->channels = channels;
+		this->maxValue = 1.0f;
+		this->sampleBytes = 4;
+		for (int i = 0; i < 256; i++) {
+			this->linear[i] = powf(i / 255.0f, LDR_GAMMA);
+		}
+
+		if (parseRawName(path, this->width, this->height, this->fileChannels)) {
+			this->source = SOURCE_RAW;
+			this->channels = channels ? channels : rgbChannels(this->fileChannels);
+			this->file = fopen(path, "rb");
+			return this->file != nullptr;
+		}
+
+		this->file = fopen(path, "rb");
+		if (!this->file) {
+			printf("Failed to open %s\n", path);
+			return false;
+		}
+
+		char magic[3] = {};
+		if (fread(magic, 1, 2, this->file) == 2 && magic[0] == 'P') {
+			char token[32];
+			bool pnm = magic[1] == '5' || magic[1] == '6';
+			bool pfm = magic[1] == 'F' || magic[1] == 'f';
+
+			if (pnm || pfm) {
+				bool parsed = readPnmToken(this->file, token, sizeof(token)) && (this->width = atoi(token)) > 0;
+				parsed = parsed && readPnmToken(this->file, token, sizeof(token)) && (this->height = atoi(token)) > 0;
+				parsed = parsed && readPnmToken(this->file, token, sizeof(token));
+				if (!parsed) {
+					printf("Bad header in %s\n", path);
+					this->close();
+					return false;
+				}
+
+				if (pnm) {
+					this->source = SOURCE_PNM;
+					this->fileChannels = magic[1] == '6' ? 3 : 1;
+					this->maxValue = (float)atoi(token);
+					this->sampleBytes = this->maxValue > 255.0f ? 2 : 1;
+				}
+				else {
+					this->source = SOURCE_PFM;
+					this->fileChannels = magic[1] == 'F' ? 3 : 1;
+					this->swap = atof(token) > 0.0;
+				}
+
+				this->channels = channels ? channels : rgbChannels(this->fileChannels);
+				this->dataOffset = tellFile(this->file);
+				return true;
+			}
+		}
+		fclose(this->file);
+		this->file = nullptr;
+
+		// no row access, decode everything at 8 bits, or floats for hdr
+		this->source = SOURCE_DECODED;
+		this->sampleBytes = 1;
+		if (!channels && stbi_info(path, &this->width, &this->height, &this->fileChannels)) {
+			channels = rgbChannels(this->fileChannels);
+		}
+		this->channels = channels ? channels : 4;
+		if (stbi_is_hdr(path)) {
+			this->decodedFloat = stbi_loadf(path, &this->width, &this->height, &this->fileChannels, this->channels);
+			this->fileChannels = this->channels;
+			return this->decodedFloat != nullptr;
+		}
+		this->decoded = stbi_load(path, &this->width, &this->height, &this->fileChannels, this->channels);
+		this->fileChannels = this->channels;
+		if (!this->decoded) {
+			printf("Failed to decode %s: %s\n", path, stbi_failure_reason());
+		}
+		return this->decoded != nullptr;
+	}
+
+	float sample(const u8* data, int index) const
+	{
+		if (this->source == SOURCE_DECODED || (this->source == SOURCE_PNM && this->maxValue == 255.0f)) {
+			return this->linear[data[index]];
+		}
+		if (this->source == SOURCE_PNM) {
+			float value = this->sampleBytes == 2 ? (float)(data[index * 2] << 8 | data[index * 2 + 1]) : (float)data[index];
+			return powf(value / this->maxValue, LDR_GAMMA);
+		}
+
+		u8 bytes[4];
+		memcpy(bytes, &data[index * 4], 4);
+		if (this->swap) {
+			u8 t = bytes[0]; bytes[0] = bytes[3]; bytes[3] = t;
+			t = bytes[1]; bytes[1] = bytes[2]; bytes[2] = t;
+		}
+		float value;
+		memcpy(&value, bytes, 4);
+		return value;
+	}
+
+	// alpha is not gamma encoded. only 8 bit decoded and raw files have it
+	float alphaSample(const u8* data, int index) const
+	{
+		return this->sampleBytes == 1 ? data[index] / 255.0f : this->sample(data, index);
+	}
+
+	// grey is spread over rgb, missing alpha is opaque.
+	void convertRow(const u8* data, float* dest) const
+	{
+		for (int x = 0; x < this->width; x++) {
+			int source = x * this->fileChannels;
+			float* pixel = &dest[x * this->channels];
+			if (this->fileChannels < 3) {
+				pixel[0] = pixel[1] = pixel[2] = this->sample(data, source);
+			}
+			else {
+				pixel[0] = this->sample(data, source);
+				pixel[1] = this->sample(data, source + 1);
+				pixel[2] = this->sample(data, source + 2);
+			}
+			if (this->channels == 4) {
+				pixel[3] = this->fileChannels == 4 || this->fileChannels == 2 ? this->alphaSample(data, source + this->fileChannels - 1) : 1.0f;
+			}
+		}
+	}
+
+	// the next rows, top to bottom.
+	bool read(float* dest, int rows)
+	{
+		TRACE_SCOPE("StripReader read", "stream");
+		ASSERT(this->row + rows <= this->height);
+
+		size_t rowBytes = (size_t)this->width * this->fileChannels * this->sampleBytes;
+		size_t rowFloats = (size_t)this->width * this->channels;
+
+		if (this->source == SOURCE_DECODED) {
+			for (int y = 0; y < rows; y++, this->row++) {
+				if (this->decodedFloat) {
+					memcpy(&dest[y * rowFloats], &this->decodedFloat[this->row * rowFloats], rowFloats * sizeof(float));
+				}
+				else {
+					this->convertRow(&this->decoded[this->row * rowBytes], &dest[y * rowFloats]);
+				}
+			}
+			return true;
+		}
+
+		if (this->source == SOURCE_PFM) {
+			// stored bottom row first
+			this->buffer.resize(rowBytes);
+			for (int y = 0; y < rows; y++, this->row++) {
+				u64 offset = this->dataOffset + (u64)(this->height - 1 - this->row) * rowBytes;
+				if (!seekFile(this->file, offset) || fread(this->buffer.data(), 1, rowBytes, this->file) != rowBytes) {
+					return false;
+				}
+				this->convertRow(this->buffer.data(), &dest[y * rowFloats]);
+			}
+			return true;
+		}
+
+		this->buffer.resize(rowBytes * rows);
+		if (fread(this->buffer.data(), 1, this->buffer.size(), this->file) != this->buffer.size()) {
+			return false;
+		}
+		for (int y = 0; y < rows; y++) {
+			this->convertRow(&this->buffer[y * rowBytes], &dest[y * rowFloats]);
+		}
+		this->row += rows;
+		return true;
+	}
+
+	void close()
+	{
+		if (this->file) {
+			fclose(this->file);
+		}
+		stbi_image_free(this->decoded);
+		stbi_image_free(this->decodedFloat);
+		this->file = nullptr;
+		this->decoded = nullptr;
+		this->decodedFloat = nullptr;
+	}
+};
+
+// writes an image strip by strip in any of the encoder formats. png strips
+// become independent deflate pieces, qoi keeps its state across strips,
+// pfm rows are placed bottom up by seeking.
+struct StripWriter
+{
+	FILE* file;
+	ImageFormat format;
+	int width, height, channels;
+	int row;
+	u64 dataOffset;
+
+	std::vector<u8> out;
+	std::vector<u8> bytes;
+	std::vector<u8> previousRow;
+	u32 adler;
+	QoiEncoder qoi;
+
+	bool flush()
+	{
+		bool written = fwrite(this->out.data(), 1, this->out.size(), this->file) == this->out.size();
+		this->out.clear();
+		return written;
+	}
+
+	bool open(const char* path, ImageFormat format, int width, int height, int channels)
+	{
+		*this = StripWriter();
+		this->format = format;
+		this->width = width;
+		this->height = height;
+		this->channels = channels;
+		this->adler = 1;
+
+		this->file = fopen(path, "wb");
+		if (!this->file) {
+			printf("Failed to open %s for writing\n", path);
+			return false;
+		}
+
+		char header[64];
+		int headerSize = 0;
+		switch (format) {
+		case FORMAT_PNG:
+			this->out = pngHeader(width, height, channels == 4 ? 6 : 2);
+			// zlib header in its own idat, the pieces follow
+			{
+				const u8 zlib[2] = { 0x78, 0x01 };
+				appendPngData(this->out, zlib, 2);
+			}
+			break;
+		case FORMAT_QOI:
+			this->qoi.begin(width, height, channels, this->out);
+			break;
+		case FORMAT_PFM:
+			headerSize = snprintf(header, sizeof(header), "PF\n%i %i\n-1.0\n", width, height);
+			this->out.insert(this->out.end(), header, header + headerSize);
+			this->dataOffset = headerSize;
+			break;
+		case FORMAT_PPM:
+			headerSize = snprintf(header, sizeof(header), "P6\n%i %i\n255\n", width, height);
+			this->out.insert(this->out.end(), header, header + headerSize);
+			break;
+		default:
+			break;
+		}
+		return this->flush();
+	}
+
+	bool write(const float* rows, int count)
+	{
+		TRACE_SCOPE("StripWriter write", "stream");
+		ASSERT(this->row + count <= this->height);
+
+		size_t pixels = (size_t)this->width * count;
+		if (this->format == FORMAT_RAW) {
+			this->row += count;
+			return fwrite(rows, sizeof(float), pixels * this->channels, this->file) == pixels * this->channels;
+		}
+
+		if (this->format == FORMAT_PFM) {
+			size_t rowBytes = (size_t)this->width * 3 * sizeof(float);
+			std::vector<float> rgb((size_t)this->width * 3);
+			for (int y = 0; y < count; y++, this->row++) {
+				for (int x = 0; x < this->width; x++) {
+					memcpy(&rgb[x * 3], &rows[((size_t)y * this->width + x) * this->channels], sizeof(float) * 3);
+				}
+				u64 offset = this->dataOffset + (u64)(this->height - 1 - this->row) * rowBytes;
+				if (!seekFile(this->file, offset) || fwrite(rgb.data(), 1, rowBytes, this->file) != rowBytes) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		this->bytes.resize(pixels * this->channels);
+		quantizeBytes(rows, this->bytes.size(), this->channels, this->bytes.data());
+
+		if (this->format == FORMAT_PNG) {
+			int rowBytes = this->width * this->channels;
+			bool last = this->row + count == this->height;
+			size_t filteredSize = 0;
+			std::vector<u8> piece;
+			u32 pieceAdler = deflatePngRows(this->bytes.data(), this->row ? this->previousRow.data() : nullptr, count, rowBytes, this->channels, last, piece, filteredSize);
+			this->adler = adler32Combine(this->adler, pieceAdler, filteredSize);
+			appendPngData(this->out, piece.data(), piece.size());
+			this->previousRow.assign(this->bytes.end() - rowBytes, this->bytes.end());
+		}
+		else if (this->format == FORMAT_QOI) {
+			this->qoi.encode(this->bytes.data(), pixels, this->channels, this->out);
+		}
+		else {
+			for (size_t i = 0; i < pixels; i++) {
+				this->out.insert(this->out.end(), &this->bytes[i * this->channels], &this->bytes[i * this->channels] + 3);
+			}
+		}
+
+		this->row += count;
+		return this->flush();
+	}
+
+	// false when not every row was written.
+	bool close()
+	{
+		bool complete = this->row == this->height;
+		if (complete && this->format == FORMAT_PNG) {
+			u8 adler[4] = { (u8)(this->adler >> 24), (u8)(this->adler >> 16), (u8)(this->adler >> 8), (u8)this->adler };
+			appendPngData(this->out, adler, 4);
+			appendPngChunk(this->out, "IEND", nullptr, 0);
+		}
+		else if (complete && this->format == FORMAT_QOI) {
+			this->qoi.end(this->out);
+		}
+
+		complete = this->flush() && complete;
+		fclose(this->file);
+		this->file = nullptr;
+		return complete;
+	}
+};
@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <common.h>
+#include <threadPool.h>
+#include <trace.h>
+
+// image.h pulls in stb_image
+#define STB_IMAGE_IMPLEMENTATION
+#include <encode.h>
+#include <image.h>
+#include <palette.h>
+#include <stream.h>
+
+#include "ops.h"
+
+// extensions stb_image decodes, plus the float formats --strip reads
+const char* INPUT_EXTENSIONS[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tga", ".psd", ".gif", ".hdr", ".pic", ".ppm", ".pgm", ".pfm", ".raw" };
+
+// one file on its way through read -> decode -> process -> encode. every
+// stage is its own task on the pool, so while one file decodes the next
+// can be read and the previous one encoded.
+struct Job
+{
+	std::string input;
+	std::vector<u8> encoded;
+	Image image;
+};
+
+struct Batch
+{
+	ThreadPool* pool;
+	std::vector<Op> ops;
+	// built once from ops, with its point runs baked when --lut is given
+	ImageGraph graph;
+	const char* outDir;
+	ImageFormat format;
+	// --strip <rows>, 0 processes whole images
+	int stripRows;
+	// --palette <colors>, 0 writes true color
+	int paletteColors;
+	PaletteDither dither;
+
+	// files between read and the end of encode, bounded so a directory of
+	// thousands of files does not decode all of them at once
+	int inFlight;
+	int maxInFlight;
+	std::mutex mutex;
+	std::condition_variable slotFree;
+
+	std::atomic<int> written;
+	std::atomic<int> failed;
+	std::atomic<long long> pixels;
+	// seconds spent in each stage summed over all threads, in microseconds
+	std::atomic<long long> stageMicroseconds[4];
+};
+
+const char* STAGE_NAMES[] = { "read", "decode", "process", "encode" };
+
+struct StageTimer
+{
+	Batch* batch;
+	int stage;
+	double start;
+
+	StageTimer(Batch* batch, int stage)
+	{
+		this->batch = batch;
+		this->stage = stage;
+		this->start = timeNow();
+	}
+
+	~StageTimer()
+	{
+		this->batch->stageMicroseconds[this->stage] += (long long)((timeNow() - this->start) * 1.0e6);
+	}
+};
+
+bool hasInputExtension(const char* name)
+{
+	const char* dot = strrchr(name, '.');
+	if (!dot) {
+		return false;
+	}
+
+	for (const char* extension : INPUT_EXTENSIONS) {
+		size_t length = strlen(extension);
+		if (strlen(dot) != length) {
+			continue;
+		}
+
+		bool same = true;
+		for (size_t i = 0; i < length; i++) {
+			char c = dot[i] >= 'A' && dot[i] <= 'Z' ? dot[i] - 'A' + 'a' : dot[i];
+			same = same && c == extension[i];
+		}
+		if (same) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// adds the images directly inside path, or path itself when it is a file.
+void collectInputs(const char* path, std::vector<std::string>& inputs)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path);
+	if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		inputs.push_back(path);
+		return;
+	}
+
+	WIN32_FIND_DATAA entry;
+	std::string pattern = std::string(path) + "\\*";
+	HANDLE find = FindFirstFileA(pattern.c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	do {
+		if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && hasInputExtension(entry.cFileName)) {
+			inputs.push_back(std::string(path) + "/" + entry.cFileName);
+		}
+	} while (FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	struct stat info;
+	if (stat(path, &info) != 0 || !S_ISDIR(info.st_mode)) {
+		inputs.push_back(path);
+		return;
+	}
+
+	DIR* dir = opendir(path);
+	if (!dir) {
+		return;
+	}
+	while (dirent* entry = readdir(dir)) {
+		std::string file = std::string(path) + "/" + entry->d_name;
+		if (hasInputExtension(entry->d_name) && stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+			inputs.push_back(file);
+		}
+	}
+	closedir(dir);
+#endif
+}
+
+// <outDir>/<input name without extension>.<format>, raw files also get
+// _<width>x<height>x<channels> as they have no header.
+std::string outputPath(const char* outDir, const std::string& input, ImageFormat format, const Image& image)
+{
+	size_t slash = input.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+	size_t dot = name.rfind('.');
+	if (dot != std::string::npos) {
+		name = name.substr(0, dot);
+	}
+	if (format == FORMAT_RAW) {
+		char size[64];
+		snprintf(size, sizeof(size), "_%ix%ix%i", image.width, image.height, image.channels);
+		name += size;
+	}
+	return std::string(outDir) + "/" + name + FORMAT_EXTENSIONS[format];
+}
+
+void finishJob(Batch* batch, Job* job, bool success)
+{
+	if (job->image.data) {
+		free(job->image.data);
+	}
+	delete job;
+
+	(success ? batch->written : batch->failed)++;
+	{
+		std::lock_guard<std::mutex> lock(batch->mutex);
+		batch->inFlight--;
+	}
+	batch->slotFree.notify_one();
+}
+
+void encodeStage(Batch* batch, Job* job)
+{
+	bool written = false;
+	{
+		std::string output = outputPath(batch->outDir, job->input, batch->format, job->image);
+		TRACE_SCOPE_DETAIL("encode", "imgproc", output.c_str());
+		StageTimer timer(batch, 3);
+
+		// png deflates its row pieces on the same pool
+		std::vector<u8> encoded;
+		if (batch->paletteColors) {
+			Palette palette = buildPalette(job->image, batch->paletteColors, 8, batch->pool);
+			IndexedImage indexed = mapToPalette(job->image, palette, batch->dither, batch->pool);
+			encoded = encodeIndexedPNG(indexed.indices.data(), indexed.width, indexed.height, palette.colors, palette.count, batch->pool);
+		}
+		else {
+			encoded = encodeImage(job->image, batch->format, batch->pool);
+		}
+		written = writeFile(output.c_str(), encoded);
+	}
+	finishJob(batch, job, written);
+}
+
+void processStage(Batch* batch, Job* job)
+{
+	{
+		TRACE_SCOPE_DETAIL("process", "imgproc", job->input.c_str());
+		StageTimer timer(batch, 2);
+		batch->graph.evaluate(job->image, batch->pool);
+	}
+	batch->pool->submit([batch, job]() { encodeStage(batch, job); });
+}
+
+void decodeStage(Batch* batch, Job* job)
+{
+	{
+		TRACE_SCOPE_DETAIL("decode", "imgproc", job->input.c_str());
+		StageTimer timer(batch, 1);
+
+		Image& image = job->image;
+		image = decodeImage(job->encoded.data(), (int)job->encoded.size());
+		job->encoded = std::vector<u8>();
+
+		// pfm and raw, stb_image reads neither, take every row of the strip reader
+		StripReader reader;
+		if (!image.data && isStripFormat(job->input.c_str()) && reader.open(job->input.c_str(), 0)) {
+			image.channels = reader.channels;
+			image.width = reader.width;
+			image.height = reader.height;
+			image.data = (float*)malloc(sizeof(float) * image.width * image.height * image.channels);
+			if (!reader.read(image.data, image.height)) {
+				free(image.data);
+				image.data = nullptr;
+			}
+			reader.close();
+		}
+	}
+
+	if (!job->image.data) {
+		printf("Failed to decode %s: %s\n", job->input.c_str(), stbi_failure_reason());
+		finishJob(batch, job, false);
+		return;
+	}
+
+	batch->pixels += (long long)job->image.width * job->image.height;
+	batch->pool->submit([batch, job]() { processStage(batch, job); });
+}
+
+void readStage(Batch* batch, Job* job)
+{
+	bool read = false;
+	{
+		TRACE_SCOPE_DETAIL("read", "imgproc", job->input.c_str());
+		StageTimer timer(batch, 0);
+
+		FILE* file = fopen(job->input.c_str(), "rb");
+		if (file) {
+			fseek(file, 0, SEEK_END);
+			long size = ftell(file);
+			fseek(file, 0, SEEK_SET);
+			job->encoded.resize(size > 0 ? size : 0);
+			read = size > 0 && fread(job->encoded.data(), 1, size, file) == (size_t)size;
+			fclose(file);
+		}
+	}
+
+	if (!read) {
+		printf("Failed to read %s\n", job->input.c_str());
+		finishJob(batch, job, false);
+		return;
+	}
+
+	batch->pool->submit([batch, job]() { decodeStage(batch, job); });
+}
+
+// the whole chain for one file, stripRows at a time. keeps only the strip
+// plus the rows the blurs reach into above and below it in memory.
+void streamStage(Batch* batch, Job* job)
+{
+	bool written = false;
+	{
+		TRACE_SCOPE_DETAIL("stream", "imgproc", job->input.c_str());
+		StageTimer timer(batch, 2);
+
+		StripReader reader;
+		if (reader.open(job->input.c_str(), 0)) {
+			const int channels = reader.channels;
+			Image size = { reader.width, reader.height, channels, true, nullptr };
+			std::string output = outputPath(batch->outDir, job->input, batch->format, size);
+
+			StripWriter writer;
+			if (writer.open(output.c_str(), batch->format, reader.width, reader.height, channels)) {
+				int halo = opsHalo(batch->ops);
+				size_t rowFloats = (size_t)reader.width * channels;
+
+				// rows windowStart .. windowStart + windowRows of the input
+				std::vector<float> window;
+				int windowStart = 0;
+				int windowRows = 0;
+				bool ok = true;
+
+				for (int y = 0; ok && y < reader.height; y += batch->stripRows) {
+					int end = std::min(y + batch->stripRows, reader.height);
+					int needStart = std::max(y - halo, 0);
+					int needEnd = std::min(end + halo, reader.height);
+
+					int drop = needStart - windowStart;
+					window.erase(window.begin(), window.begin() + drop * rowFloats);
+					windowStart = needStart;
+					windowRows -= drop;
+
+					int missing = needEnd - (windowStart + windowRows);
+					window.resize((size_t)(windowRows + missing) * rowFloats);
+					ok = reader.read(&window[windowRows * rowFloats], missing);
+					windowRows += missing;
+
+					Image strip = { reader.width, windowRows, channels, true, (float*)malloc(window.size() * sizeof(float)) };
+					memcpy(strip.data, window.data(), window.size() * sizeof(float));
+					batch->graph.evaluate(strip);
+					ok = ok && writer.write(&strip.data[(y - windowStart) * rowFloats], end - y);
+					free(strip.data);
+				}
+
+				batch->pixels += (long long)reader.width * reader.height;
+				written = writer.close() && ok;
+			}
+			reader.close();
+		}
+	}
+
+	if (!written) {
+		printf("Failed to stream %s\n", job->input.c_str());
+	}
+	finishJob(batch, job, written);
+}
+
+void printUsage()
+{
+	printf("usage: imgproc [options] <file or directory>...\n");
+	printf("    --out <dir>       where the results go, required\n");
+	printf("    --ops <chain>     comma separated operations, e.g. hsi,intensity:1.2,rgb,blur:2\n");
+	printf("    --format <name>   png (default), qoi, pfm or raw floats, ppm\n");
+	printf("    --strip <rows>    stream every file in strips of rows instead of loading it\n");
+	printf("                      whole, for images larger than memory. also reads pnm,\n");
+	printf("                      pfm and raw row by row\n");
+	printf("    --palette <n>     png of at most n <= 256 indexed colors, not with --strip\n");
+	printf("    --dither <name>   fs (default), ordered or none, for --palette\n");
+	printf("    --lut <size>      bakes every run of per pixel ops from rgb to rgb into a\n");
+	printf("                      size^3 lut, 33 or 65 are typical. colors outside [0, 1]\n");
+	printf("                      clamp, and steps like the black and grey cutoffs of\n");
+	printf("                      hsi are only approximated\n");
+	printf("    --threads <n>     worker threads, all cores by default\n");
+	printf("    --in-flight <n>   files decoded at once, 2 per thread by default\n");
+	printf("    --trace <file>    chrome trace of every stage\n");
+	printOps();
+}
+
+int main(int argc, char* argv[])
+{
+	const char* outDir = nullptr;
+	const char* opsText = "";
+	const char* formatName = "png";
+	const char* traceJson = nullptr;
+	int threads = (int)std::thread::hardware_concurrency();
+	int maxInFlight = 0;
+	int stripRows = 0;
+	int paletteColors = 0;
+	const char* ditherName = "fs";
+	int lutSize = 0;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; i++) {
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+			printUsage();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--out") == 0 && value) {
+			outDir = value;
+			i++;
+		}
+		else if (strcmp(argv[i], "--ops") == 0 && value) {
+			opsText = value;
+			i++;
+		}
+		else if (strcmp(argv[i], "--format") == 0 && value) {
+			formatName = value;
+			i++;
+		}
+		else if (strcmp(argv[i], "--strip") == 0 && value) {
+			stripRows = atoi(value);
+			i++;
+		}
+		else if (strcmp(argv[i], "--palette") == 0 && value) {
+			paletteColors = atoi(value);
+			i++;
+		}
+		else if (strcmp(argv[i], "--dither") == 0 && value) {
+			ditherName = value;
+			i++;
+		}
+		else if (strcmp(argv[i], "--lut") == 0 && value) {
+			lutSize = atoi(value);
+			i++;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && value) {
+			threads = atoi(value);
+			i++;
+		}
+		else if (strcmp(argv[i], "--in-flight") == 0 && value) {
+			maxInFlight = atoi(value);
+			i++;
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && value) {
+			traceJson = value;
+			i++;
+		}
+		else if (strncmp(argv[i], "--", 2) == 0) {
+			printf("Unknown option %s\n", argv[i]);
+			printUsage();
+			return -1;
+		}
+		else {
+			collectInputs(argv[i], inputs);
+		}
+	}
+
+	if (!outDir || inputs.empty()) {
+		printUsage();
+		return -1;
+	}
+
+	std::vector<Op> ops;
+	if (!parseOps(opsText, ops) || (stripRows > 0 && !opsStreamable(ops))) {
+		return -2;
+	}
+
+	ImageFormat format = formatFromName(formatName);
+	if (format == FORMAT_COUNT) {
+		printf("Unknown format %s, use png, qoi, pfm, raw or ppm\n", formatName);
+		return -2;
+	}
+
+	PaletteDither dither = PALETTE_DITHER_FLOYD_STEINBERG;
+	if (strcmp(ditherName, "ordered") == 0) {
+		dither = PALETTE_DITHER_ORDERED;
+	}
+	else if (strcmp(ditherName, "none") == 0) {
+		dither = PALETTE_DITHER_NONE;
+	}
+	else if (strcmp(ditherName, "fs") != 0) {
+		printf("Unknown dither %s, use fs, ordered or none\n", ditherName);
+		return -2;
+	}
+	if (lutSize && (lutSize < 2 || lutSize > 256)) {
+		printf("--lut takes a size from 2 to 256\n");
+		return -2;
+	}
+	if (paletteColors && (paletteColors < 1 || paletteColors > PALETTE_MAX_COLORS || format != FORMAT_PNG || stripRows > 0)) {
+		printf("--palette takes 1 to %i colors, png output and whole images\n", PALETTE_MAX_COLORS);
+		return -2;
+	}
+
+	if (traceJson) {
+		startTrace(traceJson);
+		traceThreadName("main");
+	}
+
+	threads = threads > 0 ? threads : 1;
+	Batch* batch = new Batch();
+	batch->ops = ops;
+	batch->graph = buildGraph(ops);
+	if (lutSize) {
+		batch->graph.bakePoints(lutSize);
+	}
+	batch->outDir = outDir;
+	batch->format = format;
+	batch->stripRows = stripRows > 0 ? stripRows : 0;
+	batch->paletteColors = paletteColors;
+	batch->dither = dither;
+	batch->inFlight = 0;
+	batch->maxInFlight = maxInFlight > 0 ? maxInFlight : threads * 2;
+	batch->written = 0;
+	batch->failed = 0;
+	batch->pixels = 0;
+	for (std::atomic<long long>& stage : batch->stageMicroseconds) {
+		stage = 0;
+	}
+
+	double start = timeNow();
+	{
+		ThreadPool pool(threads);
+		batch->pool = &pool;
+
+		for (const std::string& input : inputs) {
+			{
+				std::unique_lock<std::mutex> lock(batch->mutex);
+				batch->slotFree.wait(lock, [batch]() { return batch->inFlight < batch->maxInFlight; });
+				batch->inFlight++;
+			}
+
+			Job* job = new Job();
+			job->input = input;
+			if (batch->stripRows) {
+				pool.submit([batch, job]() { streamStage(batch, job); });
+			}
+			else {
+				pool.submit([batch, job]() { readStage(batch, job); });
+			}
+		}
+
+		pool.wait();
+	}
+	double seconds = timeNow() - start;
+
+	printf("%i written, %i failed in %.3f s, %.1f files/min, %.1f MPix/s on %i threads\n",
+		(int)batch->written, (int)batch->failed, seconds, (batch->written + batch->failed) * 60.0 / seconds,
+		batch->pixels / seconds / 1.0e6, threads);
+	for (int i = 0; i < 4; i++) {
+		printf("    %-8s %9.3f s thread time\n", STAGE_NAMES[i], batch->stageMicroseconds[i] / 1.0e6);
+	}
+
+	int result = batch->failed ? -3 : 0;
+	delete batch;
+	stopTrace();
+	return result;
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <blur.h>
+#include <convolve.h>
+#include <graph.h>
+#include <histogram.h>
+#include <image.h>
+#include <integral.h>
+#include <morphology.h>
+#include <rank.h>
+#include <resample.h>
+#include <trace.h>
+
+// one step of the --ops chain, "name" or "name:value".
+enum OpType
+{
+	OP_HSI,
+	OP_RGB,
+	OP_INTENSITY,
+	OP_SATURATION,
+	OP_HUE,
+	OP_EXPOSURE,
+	OP_GAMMA,
+	OP_INVERT,
+	OP_BLUR,
+	OP_GAUSSIAN,
+	OP_FASTBLUR,
+	OP_SOBEL,
+	OP_EQUALIZE,
+	OP_CLAHE,
+	OP_THRESHOLD,
+	OP_RESIZE,
+	OP_MEDIAN,
+	OP_ERODE,
+	OP_DILATE,
+	OP_OPEN,
+	OP_CLOSE,
+};
+
+struct OpInfo
+{
+	const char* name;
+	OpType type;
+	// which space the op works in, both for blur
+	bool needsRgb, needsHsi;
+	bool hasValue;
+	float defaultValue;
+};
+
+const OpInfo OP_INFOS[] = {
+	{ "hsi", OP_HSI, true, false, false, 0.0f },
+	{ "rgb", OP_RGB, false, true, false, 0.0f },
+	{ "intensity", OP_INTENSITY, false, true, true, 1.0f },
+	{ "saturation", OP_SATURATION, false, true, true, 1.0f },
+	{ "hue", OP_HUE, false, true, true, 0.0f },
+	{ "exposure", OP_EXPOSURE, true, false, true, 0.0f },
+	{ "gamma", OP_GAMMA, true, false, true, 2.2f },
+	{ "invert", OP_INVERT, true, false, false, 0.0f },
+	{ "blur", OP_BLUR, false, false, true, 1.0f },
+	{ "gaussian", OP_GAUSSIAN, false, false, true, 1.0f },
+	{ "fastblur", OP_FASTBLUR, false, false, true, 8.0f },
+	{ "sobel", OP_SOBEL, true, false, false, 0.0f },
+	{ "equalize", OP_EQUALIZE, false, true, false, 0.0f },
+	{ "clahe", OP_CLAHE, false, true, true, 2.0f },
+	{ "threshold", OP_THRESHOLD, true, false, true, 8.0f },
+	{ "resize", OP_RESIZE, false, false, true, 0.5f },
+	{ "median", OP_MEDIAN, false, false, true, 1.0f },
+	{ "erode", OP_ERODE, false, false, true, 1.0f },
+	{ "dilate", OP_DILATE, false, false, true, 1.0f },
+	{ "open", OP_OPEN, false, false, true, 1.0f },
+	{ "close", OP_CLOSE, false, false, true, 1.0f },
+};
+
+struct Op
+{
+	const OpInfo* info;
+	float value;
+};
+
+inline void printOps()
+{
+	printf("operations, applied left to right:\n");
+	printf("    hsi               convert rgb to hue, saturation, intensity\n");
+	printf("    rgb               convert back, done implicitly at the end\n");
+	printf("    intensity:<scale> hsi, scale intensity\n");
+	printf("    saturation:<scale> hsi, scale saturation\n");
+	printf("    hue:<radians>     hsi, rotate hue\n");
+	printf("    exposure:<stops>  rgb, multiply by 2^stops\n");
+	printf("    gamma:<g>         rgb, raise to 1/g\n");
+	printf("    invert            rgb, 1 - value\n");
+	printf("    blur:<radius>     box blur of every channel\n");
+	printf("    gaussian:<sigma>  gaussian blur of every channel\n");
+	printf("    fastblur:<sigma>  recursive gaussian, same cost for any sigma\n");
+	printf("    sobel             rgb, gradient magnitude\n");
+	printf("    equalize          hsi, histogram equalize intensity\n");
+	printf("    clahe:<clip>      hsi, equalize intensity in 8x8 tiles, bins capped at clip x mean\n");
+	printf("    threshold:<radius> rgb, 1 above 85%% of the local mean, else 0\n");
+	printf("    resize:<scale>    lanczos 3 resample of every channel\n");
+	printf("    median:<radius>   median of every channel, 8 bit past radius 1\n");
+	printf("    erode:<radius>    min of every channel over a square\n");
+	printf("    dilate:<radius>   max of every channel over a square\n");
+	printf("    open:<radius>     erode then dilate\n");
+	printf("    close:<radius>    dilate then erode\n");
+}
+
+// "hsi,intensity:1.2,rgb,blur:2". checks that every op sees the color
+// space it expects and appends the conversion back to rgb when needed.
+inline bool parseOps(const char* text, std::vector<Op>& ops)
+{
+	bool rgb = true;
+	std::string chain = text ? text : "";
+	size_t start = 0;
+	while (start < chain.size()) {
+		size_t end = chain.find(',', start);
+		end = end == std::string::npos ? chain.size() : end;
+		std::string token = chain.substr(start, end - start);
+		start = end + 1;
+		if (token.empty()) {
+			continue;
+		}
+
+		std::string name = token.substr(0, token.find(':'));
+		const OpInfo* info = nullptr;
+		for (const OpInfo& candidate : OP_INFOS) {
+			if (name == candidate.name) {
+				info = &candidate;
+			}
+		}
+		if (!info) {
+			printf("Unknown operation %s\n", name.c_str());
+			return false;
+		}
+
+		Op op = {};
+		op.info = info;
+		op.value = info->defaultValue;
+		if (token.size() > name.size()) {
+			if (!info->hasValue) {
+				printf("Operation %s takes no value\n", info->name);
+				return false;
+			}
+			op.value = (float)atof(token.c_str() + name.size() + 1);
+		}
+
+		if ((info->needsRgb && !rgb) || (info->needsHsi && rgb)) {
+			printf("Operation %s needs %s input, convert first\n", info->name, info->needsRgb ? "rgb" : "hsi");
+			return false;
+		}
+		rgb = info->type == OP_HSI ? false : (info->type == OP_RGB ? true : rgb);
+		ops.push_back(op);
+	}
+
+	if (!rgb) {
+		Op back = { &OP_INFOS[OP_RGB], 0.0f };
+		ops.push_back(back);
+	}
+	return true;
+}
+
+// rows above and below a strip the chain needs to produce the strip
+// exactly, every neighborhood op widens it by its radius.
+inline int opsHalo(const std::vector<Op>& ops)
+{
+	int halo = 0;
+	for (const Op& op : ops) {
+		halo += op.info->type == OP_BLUR ? (int)op.value : 0;
+		halo += op.info->type == OP_GAUSSIAN && op.value > 0.0f ? gaussianKernel(op.value).radius : 0;
+		// the recursive filter reaches the whole image, this is where its
+		// weights add up to less than float precision. strips still differ
+		// by the float rounding of the recursion, which grows with sigma and
+		// does not shrink with a wider halo: on data/ up to 3e-6 at sigma 4,
+		// 6e-6 at 5, 3e-5 at 8 and 1e-3 at 24
+		halo += op.info->type == OP_FASTBLUR && op.value > 0.0f ? recursiveGaussianReach(op.value) : 0;
+		halo += op.info->type == OP_SOBEL ? 1 : 0;
+		halo += op.info->type == OP_THRESHOLD ? (int)op.value : 0;
+		halo += op.info->type == OP_MEDIAN ? (int)op.value : 0;
+		halo += op.info->type == OP_ERODE || op.info->type == OP_DILATE ? (int)op.value : 0;
+		halo += op.info->type == OP_OPEN || op.info->type == OP_CLOSE ? 2 * (int)op.value : 0;
+	}
+	return halo;
+}
+
+// false when an op needs the whole image at once, which --strip can't give.
+inline bool opsStreamable(const std::vector<Op>& ops)
+{
+	for (const Op& op : ops) {
+		if (op.info->type == OP_EQUALIZE || op.info->type == OP_CLAHE || op.info->type == OP_RESIZE) {
+			printf("Operation %s needs the whole image, it can't run on strips\n", op.info->name);
+			return false;
+		}
+	}
+	return true;
+}
+
+// per pixel ops for the graph, params[0] is the op's value.
+inline void pointIntensity(float* p, int count, int channels, const float* params)
+{
+	for (int i = 0; i < count; i++, p += channels) {
+		p[2] *= params[0];
+	}
+}
+
+inline void pointSaturation(float* p, int count, int channels, const float* params)
+{
+	for (int i = 0; i < count; i++, p += channels) {
+		p[1] = fminf(p[1] * params[0], 1.0f);
+	}
+}
+
+inline void pointHue(float* p, int count, int channels, const float* params)
+{
+	for (int i = 0; i < count; i++, p += channels) {
+		p[0] = fmodf(p[0] + params[0] + 4.0f * PI, 2.0f * PI);
+	}
+}
+
+inline void pointScale(float* p, int count, int channels, const float* params)
+{
+	for (int i = 0; i < count; i++, p += channels) {
+		p[0] *= params[0];
+		p[1] *= params[0];
+		p[2] *= params[0];
+	}
+}
+
+inline void pointPower(float* p, int count, int channels, const float* params)
+{
+	for (int i = 0; i < count; i++, p += channels) {
+		p[0] = powf(fmaxf(p[0], 0.0f), params[0]);
+		p[1] = powf(fmaxf(p[1], 0.0f), params[0]);
+		p[2] = powf(fmaxf(p[2], 0.0f), params[0]);
+	}
+}
+
+inline void pointInvert(float* p, int count, int channels, const float*)
+{
+	for (int i = 0; i < count; i++, p += channels) {
+		p[0] = 1.0f - p[0];
+		p[1] = 1.0f - p[1];
+		p[2] = 1.0f - p[2];
+	}
+}
+
+// records the chain in an ImageGraph, nothing runs yet.
+inline ImageGraph buildGraph(const std::vector<Op>& ops)
+{
+	ImageGraph graph;
+	for (const Op& op : ops) {
+		float value = op.value;
+		switch (op.info->type) {
+		case OP_HSI:
+			graph.toHSI();
+			break;
+		case OP_RGB:
+			graph.toRGB();
+			break;
+		case OP_INTENSITY:
+			graph.point(op.info->name, pointIntensity, value);
+			break;
+		case OP_SATURATION:
+			graph.point(op.info->name, pointSaturation, value);
+			break;
+		case OP_HUE:
+			graph.point(op.info->name, pointHue, value);
+			break;
+		case OP_EXPOSURE:
+			graph.point(op.info->name, pointScale, powf(2.0f, value));
+			break;
+		case OP_GAMMA:
+			graph.point(op.info->name, pointPower, 1.0f / value);
+			break;
+		case OP_INVERT:
+			graph.point(op.info->name, pointInvert);
+			break;
+		case OP_BLUR:
+			graph.blur((int)value);
+			break;
+		case OP_GAUSSIAN: {
+			if (value <= 0.0f) {
+				break;
+			}
+			Kernel1D kernel = gaussianKernel(value);
+			graph.filter(op.info->name, [kernel](Image& image, ThreadPool* pool) {
+				Image blurred = convolveSeparable(image, kernel, kernel, BORDER_CLAMP, pool);
+				free(image.data);
+				image = blurred;
+			});
+			break;
+		}
+		case OP_FASTBLUR: {
+			if (value <= 0.0f) {
+				break;
+			}
+			graph.filter(op.info->name, [value](Image& image, ThreadPool* pool) {
+				Image blurred = gaussianBlurRecursive(image, value, pool);
+				free(image.data);
+				image = blurred;
+			});
+			break;
+		}
+		case OP_SOBEL:
+			graph.filter(op.info->name, [](Image& image, ThreadPool* pool) {
+				Image edges = sobelMagnitude(image, BORDER_CLAMP, pool);
+				free(image.data);
+				image = edges;
+			});
+			break;
+		case OP_THRESHOLD:
+			graph.filter(op.info->name, [value](Image& image, ThreadPool* pool) {
+				Image binary = adaptiveThreshold(image, (int)value, 0.15f, pool);
+				free(image.data);
+				image = binary;
+			});
+			break;
+		case OP_RESIZE:
+			graph.filter(op.info->name, [value](Image& image, ThreadPool* pool) {
+				int width = (int)roundf(image.width * value);
+				int height = (int)roundf(image.height * value);
+				Image resized = resizeImage(image, width > 0 ? width : 1, height > 0 ? height : 1, RESAMPLE_LANCZOS3, pool);
+				free(image.data);
+				image = resized;
+			});
+			break;
+		case OP_MEDIAN:
+			graph.filter(op.info->name, [value](Image& image, ThreadPool* pool) {
+				Image filtered = medianFilter(image, (int)value, pool);
+				free(image.data);
+				image = filtered;
+			});
+			break;
+		case OP_ERODE:
+		case OP_DILATE:
+		case OP_OPEN:
+		case OP_CLOSE: {
+			MorphologyOp morph = (MorphologyOp)(MORPH_ERODE + (op.info->type - OP_ERODE));
+			graph.filter(op.info->name, [morph, value](Image& image, ThreadPool* pool) {
+				Image filtered = morphology(image, morph, (int)value, pool);
+				free(image.data);
+				image = filtered;
+			});
+			break;
+		}
+		case OP_EQUALIZE:
+			graph.filter(op.info->name, [](Image& image, ThreadPool* pool) {
+				equalizeIntensity(image, 256, pool);
+			});
+			break;
+		case OP_CLAHE:
+			graph.filter(op.info->name, [value](Image& image, ThreadPool* pool) {
+				claheIntensity(image, value, 8, 8, 256, pool);
+			});
+			break;
+		}
+	}
+	return graph;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <common.h>
+
+// image.h pulls in stb_image
+#define STB_IMAGE_IMPLEMENTATION
+#include <encode.h>
+#include <image.h>
+#include <stream.h>
+
+#include "ops.h"
+
+// an empty chain has to write every 8 bit input back byte for byte, through
+// the whole image path of imgproc and through --strip. run by ctest.
+
+// the 8 bit pixels of a file as stb reads them, always rgba to compare
+// files with different channel counts.
+std::vector<u8> pixels8(const u8* encoded, int size, int& width, int& height)
+{
+	int unused;
+	u8* decoded = stbi_load_from_memory(encoded, size, &width, &height, &unused, 4);
+	if (!decoded) {
+		return std::vector<u8>();
+	}
+	std::vector<u8> pixels(decoded, decoded + (size_t)width * height * 4);
+	stbi_image_free(decoded);
+	return pixels;
+}
+
+std::vector<u8> readBytes(const char* path)
+{
+	std::vector<u8> data;
+	FILE* file = fopen(path, "rb");
+	if (file) {
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		data.resize(size > 0 ? size : 0);
+		if (fread(data.data(), 1, data.size(), file) != data.size()) {
+			data.clear();
+		}
+		fclose(file);
+	}
+	return data;
+}
+
+bool sameImage(const char* name, const char* path, const std::vector<u8>& input, const std::vector<u8>& output)
+{
+	int width, height, outWidth, outHeight;
+	std::vector<u8> expected = pixels8(input.data(), (int)input.size(), width, height);
+	std::vector<u8> written = pixels8(output.data(), (int)output.size(), outWidth, outHeight);
+	if (expected.empty() || written.empty() || width != outWidth || height != outHeight) {
+		printf("%s %s: could not decode, or the size changed\n", path, name);
+		return false;
+	}
+
+	size_t differ = 0;
+	for (size_t i = 0; i < expected.size(); i++) {
+		differ += expected[i] != written[i];
+	}
+	if (differ) {
+		printf("%s %s: %zu of %zu bytes differ\n", path, name, differ, expected.size());
+	}
+	return differ == 0;
+}
+
+// decode, empty graph, encode, as processStage and encodeStage do it.
+bool wholeRoundTrip(const char* path, int fileChannels)
+{
+	std::vector<u8> input = readBytes(path);
+	Image image = decodeImage(input.data(), (int)input.size());
+	if (!image.data) {
+		printf("Failed to decode %s\n", path);
+		return false;
+	}
+	if (image.channels != rgbChannels(fileChannels)) {
+		printf("%s: decoded to %i channels for a %i channel file\n", path, image.channels, fileChannels);
+		free(image.data);
+		return false;
+	}
+
+	buildGraph(std::vector<Op>()).evaluate(image);
+	std::vector<u8> png = encodeImage(image, FORMAT_PNG);
+	free(image.data);
+	return sameImage("whole", path, input, png);
+}
+
+// strip reader to strip writer in uneven strips, as streamStage does it.
+bool stripRoundTrip(const char* path, const char* output)
+{
+	StripReader reader;
+	if (!reader.open(path, 0)) {
+		return false;
+	}
+	StripWriter writer;
+	bool ok = writer.open(output, FORMAT_PNG, reader.width, reader.height, reader.channels);
+	std::vector<float> rows;
+	for (int y = 0; ok && y < reader.height; y += 7) {
+		int count = reader.height - y < 7 ? reader.height - y : 7;
+		rows.resize((size_t)count * reader.width * reader.channels);
+		ok = reader.read(rows.data(), count) && writer.write(rows.data(), count);
+	}
+	ok = writer.close() && ok;
+	reader.close();
+	if (!ok) {
+		printf("Failed to stream %s\n", path);
+		return false;
+	}
+	return sameImage("strip", path, readBytes(path), readBytes(output));
+}
+
+int main()
+{
+	int failed = 0;
+
+	// every byte value in every channel, with and without alpha
+	for (int channels = 3; channels <= 4; channels++) {
+		const int width = 256, height = 16;
+		std::vector<u8> pixels((size_t)width * height * channels);
+		for (size_t i = 0; i < pixels.size(); i++) {
+			pixels[i] = (u8)(i * 7 + i / (width * channels) * 31);
+		}
+		char path[64];
+		snprintf(path, sizeof(path), "roundTrip%i.png", channels);
+		if (!writeFile(path, encodePNG(pixels.data(), width, height, channels))) {
+			return -1;
+		}
+		failed += !wholeRoundTrip(path, channels);
+		failed += !stripRoundTrip(path, "roundTripStrip.png");
+	}
+
+	const char* assets[] = { "/face.png", "/wall.jpg" };
+	for (const char* asset : assets) {
+		std::string path = std::string(DATA_DIR) + asset;
+		int width, height, channels;
+		if (!stbi_info(path.c_str(), &width, &height, &channels)) {
+			printf("Failed to read %s\n", path.c_str());
+			failed++;
+			continue;
+		}
+		failed += !wholeRoundTrip(path.c_str(), channels);
+		failed += !stripRoundTrip(path.c_str(), "roundTripStrip.png");
+	}
+
+	printf("%s\n", failed ? "round trip failed" : "round trip ok");
+	return failed ? -1 : 0;
+}
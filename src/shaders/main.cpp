@@ -4,12 +4,16 @@
 #include <stdio.h>
 #include <math.h>
 
+#include <frameLoop.h>
+#include <meshArena.h>
+
 const int WIDTH = 800;
 const int HEIGHT = 400;
 
 typedef unsigned int u32;
 
 bool createShader(const char* shaderSource, GLuint shaderType, int& outShader) {
+	TRACE_SCOPE("createShader", "shader");
 
 	outShader = glCreateShader(shaderType);
 	glShaderSource(outShader, 1, &shaderSource, nullptr);
@@ -52,6 +56,7 @@ struct Pipeline {
 };
 
 Pipeline initPipeline(const char* vertexSource, const char* fragmentSource) {
+	TRACE_SCOPE("Pipeline", "shader");
 	Pipeline pipeline = {};
 
 	u32 id;
@@ -100,16 +105,9 @@ int helloShaders(GLFWwindow* window) {
 		0.0f,  0.5f, 0.0f,  0.0f, 0.0f, 1.0f    // top 
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	// vertex storage
+	MeshArena arena = MeshArena(VertexFormat::floats(3, 3));
+	Mesh mesh = arena.allocate(vertices, sizeof(vertices) / arena.format.stride, nullptr, 0);
 
 	// vertex shader
 	const char* vertexShaderSource = R"(
@@ -143,29 +141,27 @@ int helloShaders(GLFWwindow* window) {
 		goto done;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 		
 		pipeline.use();
-		glBindVertexArray(vao);
+		arena.bind();
 
-		float time = (float)glfwGetTime();
+		float time = (float)frameTime();
 		float color = (float)sin(time) / 2.0f + 0.5f;
 
 		//draw
-		glDrawArrays(GL_TRIANGLES, 0, 3);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(mesh);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
+
 done:
 	return result;
 }
@@ -182,16 +178,9 @@ int upsideDownShader(GLFWwindow* window) {
 		0.0f,  0.5f, 0.0f,  0.0f, 0.0f, 1.0f    // top 
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	// vertex storage
+	MeshArena arena = MeshArena(VertexFormat::floats(3, 3));
+	Mesh mesh = arena.allocate(vertices, sizeof(vertices) / arena.format.stride, nullptr, 0);
 
 	// vertex shader
 	const char* vertexShaderSource = R"(
@@ -225,29 +214,27 @@ int upsideDownShader(GLFWwindow* window) {
 		goto done;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 
 		pipeline.use();
-		glBindVertexArray(vao);
+		arena.bind();
 
-		float time = (float)glfwGetTime();
+		float time = (float)frameTime();
 		float color = (float)sin(time) / 2.0f + 0.5f;
 
 		//draw
-		glDrawArrays(GL_TRIANGLES, 0, 3);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(mesh);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
+
 done:
 	return result;
 }
@@ -264,16 +251,9 @@ int shadersWithOffset(GLFWwindow* window) {
 		0.0f,  0.5f, 0.0f,  0.0f, 0.0f, 1.0f    // top 
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	// vertex storage
+	MeshArena arena = MeshArena(VertexFormat::floats(3, 3));
+	Mesh mesh = arena.allocate(vertices, sizeof(vertices) / arena.format.stride, nullptr, 0);
 
 	// vertex shader
 	const char* vertexShaderSource = R"(
@@ -309,32 +289,30 @@ int shadersWithOffset(GLFWwindow* window) {
 		goto done;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 
 		pipeline.use();
-		glBindVertexArray(vao);
+		arena.bind();
 
-		float time = (float)glfwGetTime();
+		float time = (float)frameTime();
 		float color = (float)sin(time) / 2.0f + 0.5f;
 
 		int uOffsetLocation = glGetUniformLocation(pipeline.id, "uOffset");
 		glUniform3f(uOffsetLocation, -0.5f, 0.0f, 0.0f);
 
 		//draw
-		glDrawArrays(GL_TRIANGLES, 0, 3);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(mesh);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
+
 done:
 	return result;
 }
@@ -351,16 +329,9 @@ int vertexColor(GLFWwindow* window) {
 		0.0f,  0.5f, 0.0f,  0.0f, 0.0f, 1.0f    // top 
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	// vertex storage
+	MeshArena arena = MeshArena(VertexFormat::floats(3, 3));
+	Mesh mesh = arena.allocate(vertices, sizeof(vertices) / arena.format.stride, nullptr, 0);
 
 	// vertex shader
 	const char* vertexShaderSource = R"(
@@ -394,36 +365,43 @@ int vertexColor(GLFWwindow* window) {
 		goto done;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 
 		pipeline.use();
-		glBindVertexArray(vao);
+		arena.bind();
 
-		float time = (float)glfwGetTime();
+		float time = (float)frameTime();
 		float color = (float)sin(time) / 2.0f + 0.5f;
 
 		//draw
-		glDrawArrays(GL_TRIANGLES, 0, 3);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(mesh);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
+
 done:
 	return result;
 }
 
+// every demo by name, for --demo.
+const Demo demos[] = {
+	{ "helloShaders", helloShaders },
+	{ "upsideDownShader", upsideDownShader },
+	{ "shadersWithOffset", shadersWithOffset },
+	{ "vertexColor", vertexColor },
+};
+
 int main(int argc, char* argv[])
 {
 	int result = 0;
+	initFrameLoop(argc, argv);
 
 	glfwSetErrorCallback(
 		[](int error, const char* description) {
@@ -441,6 +419,7 @@ int main(int argc, char* argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	setFrameLoopWindowHints();
 
 	GLFWwindow* window = glfwCreateWindow(WIDTH,
 											HEIGHT,
@@ -461,10 +440,18 @@ int main(int argc, char* argv[])
 		goto gladLoadGLFail;
 	}
 
+	if (!initRenderTarget(WIDTH, HEIGHT)) {
+		result = -4;
+		goto gladLoadGLFail;
+	}
+
 
 	// turn on the different render outputs by changing the falses to 
 	// true. very primitive but quick to prototype.
-	if (false) {
+	if (frameLoop().demo) {
+		result = runDemos(window, demos, sizeof(demos) / sizeof(demos[0]));
+	}
+	else if (false) {
 		result = helloShaders(window);
 	}
 	else if (false) {
@@ -477,6 +464,8 @@ int main(int argc, char* argv[])
 		result = upsideDownShader(window);
 	}
 
+	shutdownFrameLoop();
+
 	// exit
 gladLoadGLFail:
 	glfwDestroyWindow(window);
@@ -4,6 +4,11 @@
 #include <stdio.h>
 #include <math.h>
 
+#include <frameLoop.h>
+#include <meshArena.h>
+#include <meshOptimizer.h>
+#include <vertexFormat.h>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
@@ -15,6 +20,7 @@ typedef unsigned int u32;
 #define ASSERT(test) if (!(test)) { *(int*)0 = 0; }
 
 bool createShader(const char* shaderSource, GLuint shaderType, int& outShader) {
+	TRACE_SCOPE("createShader", "shader");
 
 	outShader = glCreateShader(shaderType);
 	glShaderSource(outShader, 1, &shaderSource, nullptr);
@@ -38,6 +44,7 @@ struct Pipeline {
 	u32 id;
 
 	Pipeline(const char* vertexSource, const char* fragmentSource) {
+		TRACE_SCOPE("Pipeline", "shader");
 
 		u32 id;
 		int vertexShader = 0;
@@ -97,6 +104,8 @@ struct Texture {
 	u32 id;
 
 	Texture(const char* file, u32 format) {
+		TRACE_SCOPE_DETAIL("Texture", "asset", file);
+
 		glGenTextures(1, &this->id);
 		glBindTexture(GL_TEXTURE_2D, this->id);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -142,23 +151,6 @@ int singleTexture(GLFWwindow* window) {
 		1, 2, 3
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-	u32 ebo;
-	glGenBuffers(1, &ebo);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
 	// vertex shader
 	const char* vertexShaderSource = R"(
 		#version 330 core
@@ -198,13 +190,14 @@ int singleTexture(GLFWwindow* window) {
 		return -5;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
+	MeshData quadData = MeshData::from(vertices, 4, 8 * sizeof(float), indices, 6);
+	optimizeMesh(quadData, 0, "singleTexture");
+
+	// vertex and index storage, packed down to what the pipeline reads
+	PackedVertices packed = packVertices(VertexFormat::floats(3, 3, 2), quadData.vertices.data(), quadData.vertexCount, pipeline.id);
+	packed.print("singleTexture");
+	MeshArena arena = MeshArena(packed.format, indexTypeFor(packed.vertexCount));
+	Mesh quad = arena.allocate(packed.data.data(), packed.vertexCount, quadData.indices.data(), 6);
 
 	// setup texture state
 	u32 texture;
@@ -229,24 +222,27 @@ int singleTexture(GLFWwindow* window) {
 	stbi_image_free(data);
 
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 
 		pipeline.use();
-		glBindVertexArray(vao);
+		arena.bind();
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, texture);
 
-		float time = (float)glfwGetTime();
+		float time = (float)frameTime();
 		float color = (float)sin(time) / 2.0f + 0.5f;
 
 		//draw
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(quad);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
 	return 0;
 }
 
@@ -267,23 +263,6 @@ int blendedTextures(GLFWwindow* window) {
 		1, 2, 3
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-	u32 ebo;
-	glGenBuffers(1, &ebo);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
 	// vertex shader
 	const char* vertexShaderSource = R"(
 		#version 330 core
@@ -332,43 +311,45 @@ int blendedTextures(GLFWwindow* window) {
 		return -5;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
+	MeshData quadData = MeshData::from(vertices, 4, 8 * sizeof(float), indices, 6);
+	optimizeMesh(quadData, 0, "blendedTextures");
 
+	// vertex and index storage, packed down to what the pipeline reads
+	PackedVertices packed = packVertices(VertexFormat::floats(3, 3, 2), quadData.vertices.data(), quadData.vertexCount, pipeline.id);
+	packed.print("blendedTextures");
+	MeshArena arena = MeshArena(packed.format, indexTypeFor(packed.vertexCount));
+	Mesh quad = arena.allocate(packed.data.data(), packed.vertexCount, quadData.indices.data(), 6);
 
 	Texture tex0 = Texture("/face.png", GL_RGBA);
 	Texture tex1 = Texture("/wall.jpg", GL_RGBA);
 
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 		
 		pipeline.use();
 		pipeline.setUniform("uTexture1", 0);
 		pipeline.setUniform("uTexture2", 1);
 
-		glBindVertexArray(vao);
+		arena.bind();
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, tex0.id);
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, tex1.id);
 
-		float time = (float)glfwGetTime();
+		float time = (float)frameTime();
 		float color = (float)sin(time) / 2.0f + 0.5f;
 
 		//draw
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(quad);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
 	return 0;
 }
 
@@ -389,23 +370,6 @@ int textureWrapping(GLFWwindow* window) {
 		1, 2, 3
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-	u32 ebo;
-	glGenBuffers(1, &ebo);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
 	// vertex shader
 	const char* vertexShaderSource = R"(
 		#version 330 core
@@ -454,15 +418,14 @@ int textureWrapping(GLFWwindow* window) {
 		return -5;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
+	MeshData quadData = MeshData::from(vertices, 4, 8 * sizeof(float), indices, 6);
+	optimizeMesh(quadData, 0, "textureWrapping");
 
+	// vertex and index storage, packed down to what the pipeline reads
+	PackedVertices packed = packVertices(VertexFormat::floats(3, 3, 2), quadData.vertices.data(), quadData.vertexCount, pipeline.id);
+	packed.print("textureWrapping");
+	MeshArena arena = MeshArena(packed.format, indexTypeFor(packed.vertexCount));
+	Mesh quad = arena.allocate(packed.data.data(), packed.vertexCount, quadData.indices.data(), 6);
 
 	Texture tex0 = Texture("/face.png", GL_RGBA);
 	Texture tex1 = Texture("/wall.jpg", GL_RGBA);
@@ -472,26 +435,29 @@ int textureWrapping(GLFWwindow* window) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 
 		pipeline.use();
 		pipeline.setUniform("uTexture1", 0);
 		pipeline.setUniform("uTexture2", 1);
 
-		glBindVertexArray(vao);
+		arena.bind();
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, tex0.id);
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, tex1.id);
 
 		//draw
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(quad);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
 	return 0;
 }
 
@@ -512,23 +478,6 @@ int textureMixingInput(GLFWwindow* window) {
 		1, 2, 3
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-	u32 ebo;
-	glGenBuffers(1, &ebo);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
 	// vertex shader
 	const char* vertexShaderSource = R"(
 		#version 330 core
@@ -579,13 +528,14 @@ int textureMixingInput(GLFWwindow* window) {
 		return -5;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
+	MeshData quadData = MeshData::from(vertices, 4, 8 * sizeof(float), indices, 6);
+	optimizeMesh(quadData, 0, "textureMixingInput");
+
+	// vertex and index storage, packed down to what the pipeline reads
+	PackedVertices packed = packVertices(VertexFormat::floats(3, 3, 2), quadData.vertices.data(), quadData.vertexCount, pipeline.id);
+	packed.print("textureMixingInput");
+	MeshArena arena = MeshArena(packed.format, indexTypeFor(packed.vertexCount));
+	Mesh quad = arena.allocate(packed.data.data(), packed.vertexCount, quadData.indices.data(), 6);
 
 	Texture tex0 = Texture("/face.png", GL_RGBA);
 	Texture tex1 = Texture("/wall.jpg", GL_RGBA);
@@ -614,7 +564,7 @@ int textureMixingInput(GLFWwindow* window) {
 	});
 
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 
 		pipeline.use();
@@ -622,25 +572,37 @@ int textureMixingInput(GLFWwindow* window) {
 		pipeline.setUniform("uTexture2", 1);
 		pipeline.setUniform("uMixingParam", mixingParam);
 
-		glBindVertexArray(vao);
+		arena.bind();
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, tex0.id);
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, tex1.id);
 
 		//draw
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(quad);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
 	return 0;
 }
 
+// every demo by name, for --demo.
+const Demo demos[] = {
+	{ "singleTexture", singleTexture },
+	{ "blendedTextures", blendedTextures },
+	{ "textureWrapping", textureWrapping },
+	{ "textureMixingInput", textureMixingInput },
+};
+
 int main(int argc, char* argv[])
 {
 	int result = 0;
+	initFrameLoop(argc, argv);
 	stbi_set_flip_vertically_on_load(true);
 
 	glfwSetErrorCallback(
@@ -659,6 +621,7 @@ int main(int argc, char* argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	setFrameLoopWindowHints();
 
 	GLFWwindow* window = glfwCreateWindow(WIDTH,
 											HEIGHT,
@@ -679,10 +642,18 @@ int main(int argc, char* argv[])
 		goto gladLoadGLFail;
 	}
 
+	if (!initRenderTarget(WIDTH, HEIGHT)) {
+		result = -4;
+		goto gladLoadGLFail;
+	}
+
 
 	// turn on the different render outputs by changing the falses to 
 	// true. very primitive but quick to prototype.
-	if (false) {
+	if (frameLoop().demo) {
+		result = runDemos(window, demos, sizeof(demos) / sizeof(demos[0]));
+	}
+	else if (false) {
 		result = singleTexture(window);
 	}
 	else if (false) {
@@ -698,6 +669,8 @@ int main(int argc, char* argv[])
 		result = 0;
 	}
 
+	shutdownFrameLoop();
+
 	// exit
 gladLoadGLFail:
 	glfwDestroyWindow(window);
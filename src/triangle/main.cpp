@@ -3,12 +3,18 @@
 
 #include <stdio.h>
 
+#include <frameLoop.h>
+#include <meshArena.h>
+#include <meshOptimizer.h>
+#include <multiDraw.h>
+
 const int WIDTH = 800;
 const int HEIGHT = 400;
 
 typedef unsigned int u32;
 
 bool createShader(const char* shaderSource, GLuint shaderType, int& outShader) {
+	TRACE_SCOPE("createShader", "shader");
 
 	outShader = glCreateShader(shaderType);
 	glShaderSource(outShader, 1, &shaderSource, nullptr);
@@ -39,16 +45,9 @@ int oneTri(GLFWwindow* window) {
 		0.0f,  0.5f, 0.0f
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	// vertex storage
+	MeshArena arena = MeshArena(VertexFormat::floats(3));
+	Mesh mesh = arena.allocate(vertices, sizeof(vertices) / arena.format.stride, nullptr, 0);
 
 	// vertex shader
 	const char* vertexShaderSource = R"(
@@ -102,23 +101,23 @@ int oneTri(GLFWwindow* window) {
 		return false;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 		glUseProgram(pipeline);
-		glBindVertexArray(vao);
+		arena.bind();
 
 		//draw
-		glDrawArrays(GL_TRIANGLES, 0, 3);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(mesh);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
+
 done:
 	return result;
 }
@@ -140,22 +139,12 @@ int oneQuad(GLFWwindow* window) {
 		1, 2, 3    // second triangle
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	u32 ebo;
-	glGenBuffers(1, &ebo);
+	MeshData quadData = MeshData::from(vertices, 4, 3 * sizeof(float), indices, 6);
+	optimizeMesh(quadData, 0, "oneQuad");
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	// vertex and index storage
+	MeshArena arena = MeshArena(VertexFormat::floats(3), indexTypeFor(quadData.vertexCount));
+	Mesh quad = arena.allocate(quadData.vertices.data(), quadData.vertexCount, quadData.indices.data(), 6);
 
 	// vertex shader
 	const char* vertexShaderSource = R"(
@@ -209,23 +198,23 @@ int oneQuad(GLFWwindow* window) {
 		return false;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 		glUseProgram(pipeline);
-		glBindVertexArray(vao);
+		arena.bind();
 
 		//draw
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(quad);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
+
 done:
 	return result;
 }
@@ -245,16 +234,9 @@ int twoTri(GLFWwindow* window) {
 		0.5f,  0.5f, 0.0f
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	// vertex storage
+	MeshArena arena = MeshArena(VertexFormat::floats(3));
+	Mesh mesh = arena.allocate(vertices, sizeof(vertices) / arena.format.stride, nullptr, 0);
 
 	// vertex shader
 	const char* vertexShaderSource = R"(
@@ -308,23 +290,23 @@ int twoTri(GLFWwindow* window) {
 		return false;
 	}
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
-
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 		glUseProgram(pipeline);
-		glBindVertexArray(vao);
+		arena.bind();
 
 		//draw
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+		{
+			PROFILE_GPU("draw");
+			arena.draw(mesh);
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	arena.destroy();
+
 done:
 	return result;
 }
@@ -423,7 +405,7 @@ int twoVAO(GLFWwindow* window) {
 	}
 
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
 		glUseProgram(pipeline);
 
@@ -431,11 +413,11 @@ int twoVAO(GLFWwindow* window) {
 			glBindVertexArray(vao[i]);
 
 			//draw
+			PROFILE_GPU(i == 0 ? "left" : "right");
 			glDrawArrays(GL_TRIANGLES, 0, 3);
 		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
 done:
@@ -457,16 +439,10 @@ int twoFrag(GLFWwindow* window) {
 		0.5f,  0.5f, 0.0f
 	};
 
-	//vertex array object
-	u32 vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	// vertex buffer
-	u32 vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	// vertex storage
+	MeshArena arena = MeshArena(VertexFormat::floats(3));
+	Mesh left = arena.allocate(vertices, 3, nullptr, 0);
+	Mesh right = arena.allocate(vertices + 9, 3, nullptr, 0);
 
 	// vertex shader
 	const char* vertexShaderSource = R"(
@@ -534,34 +510,165 @@ int twoFrag(GLFWwindow* window) {
 	}
 	glDeleteShader(vertexShader);
 
+	// main loop
+	while (beginFrame(window)) {
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		arena.bind();
+
+		{
+			PROFILE_GPU("left");
+			glUseProgram(pipeline[0]);
+			arena.draw(left);
+		}
+		{
+			PROFILE_GPU("right");
+			glUseProgram(pipeline[1]);
+			arena.draw(right);
+		}
+
+		endFrame(window);
+	}
+
+	arena.destroy();
+
+done:
+	return result;
+}
+
+
+int manyQuads(GLFWwindow* window) {
+	int result = 0;
+
+	glClearColor(0.7f, 0.3f, 0.7f, 1.0f);
+
+	// a grid of small quads, every quad its own mesh in the shared arena.
+	const int gridSize = 64;
+	const float cell = 2.0f / gridSize;
+	const float size = cell * 0.4f;
+
+	MeshArena arena = MeshArena(VertexFormat::floats(3));
+	MultiDraw multiDraw = MultiDraw(&arena);
+
+	u32 indices[] = {
+		0, 1, 3,   // first triangle
+		1, 2, 3    // second triangle
+	};
+
+	for (int y = 0; y < gridSize; y++) {
+		for (int x = 0; x < gridSize; x++) {
+			float cx = -1.0f + cell * (x + 0.5f);
+			float cy = -1.0f + cell * (y + 0.5f);
+
+			float vertices[] = {
+				cx + size, cy + size, 0.0f,  // top right
+				cx + size, cy - size, 0.0f,  // bottom right
+				cx - size, cy - size, 0.0f,  // bottom left
+				cx - size, cy + size, 0.0f   // top left 
+			};
+
+			multiDraw.add(arena.allocate(vertices, 4, indices, 6));
+		}
+	}
+
+	multiDraw.upload();
+
+	// vertex shader
+	const char* vertexShaderSource = R"(
+		#version 330 core
+		layout (location = 0) in vec3 pos;
+
+		out vec2 vPos;
+
+		void main() {
+			gl_Position = vec4(pos.xyz, 1.0);
+			vPos = pos.xy;
+		}	
+	)";
+
+	int vertexShader = 0;
+	if (!createShader(vertexShaderSource, GL_VERTEX_SHADER, vertexShader)) {
+		printf("Failed to create and compile vertex shader\n");
+		result = -4;
+		goto done;
+	}
+
+	// fragment shader
+	const char* fragmentShaderSource = R"(
+		#version 330 core
+		in vec2 vPos;
+		out vec4 color;
+
+		void main() {
+			color = vec4(vPos * 0.5 + 0.5, 0.2f, 1.0f);
+		}
+	)";
+
+	int fragmentShader = 0;
+	if (!createShader(fragmentShaderSource, GL_FRAGMENT_SHADER, fragmentShader)) {
+		printf("Failed to create and compile fragment shader\n");
+		result = -5;
+		goto done;
+	}
+
+	// pipeline
+	u32 pipeline = glCreateProgram();
+	glAttachShader(pipeline, vertexShader);
+	glAttachShader(pipeline, fragmentShader);
+	glLinkProgram(pipeline);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	int success = 0;
+	char infoLog[512];
+	glGetProgramiv(pipeline, GL_LINK_STATUS, &success);
 
-	// setup vertex attributes
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
-	glEnableVertexAttribArray(0);
+	if (!success) {
+		glGetProgramInfoLog(pipeline, 512, nullptr, infoLog);
+		printf("failed to compile vertex shader: \n%s", infoLog);
+		return false;
+	}
+
+	arena.printStats("manyQuads");
+	printf("manyQuads: %i draws, %s\n", (int)multiDraw.commands.size(),
+		multiDraw.multiDrawElementsIndirect ? "glMultiDrawElementsIndirect" : "draw loop fallback");
 
 	// main loop
-	while (!glfwWindowShouldClose(window)) {
+	while (beginFrame(window)) {
 		glClear(GL_COLOR_BUFFER_BIT);
+		glUseProgram(pipeline);
 
-		glBindVertexArray(vao);
-
-		glUseProgram(pipeline[0]);
-		glDrawArrays(GL_TRIANGLES, 0, 3);
-		glUseProgram(pipeline[1]);
-		glDrawArrays(GL_TRIANGLES, 3, 3);
+		//draw
+		{
+			PROFILE_GPU("draw");
+			multiDraw.draw();
+		}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endFrame(window);
 	}
 
+	multiDraw.destroy();
+	arena.destroy();
+
 done:
 	return result;
 }
 
 
+// every demo by name, for --demo.
+const Demo demos[] = {
+	{ "oneTri", oneTri },
+	{ "oneQuad", oneQuad },
+	{ "twoTri", twoTri },
+	{ "twoVAO", twoVAO },
+	{ "twoFrag", twoFrag },
+	{ "manyQuads", manyQuads },
+};
+
 int main(int argc, char* argv[])
 {
 	int result = 0;
+	initFrameLoop(argc, argv);
 
 	glfwSetErrorCallback(
 		[](int error, const char* description) {
@@ -579,6 +686,7 @@ int main(int argc, char* argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	setFrameLoopWindowHints();
 
 	GLFWwindow* window = glfwCreateWindow(WIDTH,
 											HEIGHT,
@@ -599,10 +707,18 @@ int main(int argc, char* argv[])
 		goto gladLoadGLFail;
 	}
 
+	if (!initRenderTarget(WIDTH, HEIGHT)) {
+		result = -4;
+		goto gladLoadGLFail;
+	}
+
 
 	// turn on the different render outputs by changing the falses to 
 	// true. very primitive but quick to prototype.
-	if (false) {
+	if (frameLoop().demo) {
+		result = runDemos(window, demos, sizeof(demos) / sizeof(demos[0]));
+	}
+	else if (false) {
 		result = oneTri(window);
 	}
 	else if (false) {
@@ -614,9 +730,14 @@ int main(int argc, char* argv[])
 	else if (false) {
 		result = twoVAO(window);
 	}
-	else {
+	else if (false) {
 		result = twoFrag(window);
 	}
+	else {
+		result = manyQuads(window);
+	}
+
+	shutdownFrameLoop();
 
 	// exit
 gladLoadGLFail: